@@ -24,6 +24,9 @@ namespace mtt
 				uint32_t maxTorrentConnections = 50;
 
 				bool upnpPortMapping = false;
+
+				//peer connections over uTP on udp port, tcp is used when it fails
+				bool enableUtp = false;
 			}
 			connection;
 
@@ -36,6 +39,7 @@ namespace mtt
 			struct Files
 			{
 				std::string defaultDirectory;
+				bool mappedStorage = false;
 			}
 			files;
 
@@ -50,6 +54,24 @@ namespace mtt
 
 			uint32_t trackerKey;
 			uint32_t maxPeersPerTrackerRequest = 100;
+			uint32_t maxOpenFiles = 64;
+			uint32_t maxWriteQueueSize = 64 * 1024 * 1024;
+
+			//threads hashing stored pieces in one files check, each with own reader thread, 0 means hardware concurrency
+			uint32_t checkThreads = 0;
+			//concurrent check reads from one device, set low for spinning disks, 0 means unlimited
+			uint32_t checkReadsPerDevice = 0;
+			//pieces buffers of all running files checks, at least two pieces per check thread
+			uint32_t maxCheckBufferSize = 64 * 1024 * 1024;
+			//threads hashing downloaded pieces, shared by all torrents, 0 means hardware concurrency
+			uint32_t verifyThreads = 0;
+			//bounds of outstanding block requests per peer, sized by peer bandwidth-delay product
+			uint32_t minPeerRequests = 4;
+			uint32_t maxPeerRequests = 500;
+			//threads of session service running network and torrents io, added by load up to this count, 0 means hardware concurrency
+			uint32_t serviceThreads = 0;
+			//bind each service thread to its own cpu core
+			bool pinServiceThreads = false;
 
 			struct
 			{
@@ -29,5 +29,8 @@ namespace mttApi
 
 		API_EXPORT void registerAlerts(uint32_t alertMask);
 		API_EXPORT std::vector<std::unique_ptr<mtt::AlertMessage>> popAlerts();
+
+		//pool of piece block buffers used by uploads
+		API_EXPORT mtt::BufferPoolInfo getBlockBuffersInfo();
 	};
 }
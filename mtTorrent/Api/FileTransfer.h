@@ -15,5 +15,10 @@ namespace mttApi
 
 		API_EXPORT std::vector<uint32_t> getCurrentRequests();
 		API_EXPORT uint32_t getCurrentRequestsCount();
+
+		API_EXPORT mtt::WriteQueueInfo getWriteQueueInfo();
+		API_EXPORT mtt::VerificationInfo getVerificationInfo();
+		API_EXPORT mtt::EndgameInfo getEndgameInfo();
+		API_EXPORT mtt::StreamingInfo getStreamingInfo();
 	};
 }
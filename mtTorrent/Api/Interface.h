@@ -129,6 +129,60 @@ namespace mtt
 		uint32_t partsCount = 0;
 	};
 
+	struct WriteQueueInfo
+	{
+		uint32_t queuedPieces = 0;
+		size_t queuedSize = 0;
+
+		//ms from queuing to finished write
+		uint32_t lastWriteLatency = 0;
+		uint32_t averageWriteLatency = 0;
+	};
+
+	struct VerificationInfo
+	{
+		uint32_t queuedPieces = 0;
+		uint32_t verifiedPieces = 0;
+		uint32_t invalidPieces = 0;
+
+		//ms of hashing one piece
+		uint32_t averageVerifyTime = 0;
+		//bytes hashed per second of verifying
+		size_t throughput = 0;
+	};
+
+	struct EndgameInfo
+	{
+		//all missing pieces are being downloaded, blocks are requested from multiple peers
+		bool active = false;
+
+		uint32_t duplicateRequests = 0;
+		uint32_t cancelledRequests = 0;
+		//received blocks which were already downloaded
+		uint64_t wastedBytes = 0;
+	};
+
+	struct StreamingInfo
+	{
+		//pieces with deadline not received yet
+		uint32_t pendingPieces = 0;
+		//hit rate is metDeadlines / (metDeadlines + missedDeadlines)
+		uint32_t metDeadlines = 0;
+		uint32_t missedDeadlines = 0;
+		//blocks requested from another peer to meet close deadline
+		uint32_t duplicateRequests = 0;
+	};
+
+	struct BufferPoolInfo
+	{
+		//hit rate is hits / requests
+		uint64_t requests = 0;
+		uint64_t hits = 0;
+
+		uint32_t usedBuffers = 0;
+		uint32_t peakUsedBuffers = 0;
+	};
+
 	struct PiecesCheck
 	{
 		uint32_t piecesCount = 0;
@@ -154,6 +208,11 @@ namespace mtt
 		uint32_t downloadSpeed = 0;
 		float percentage = 0;
 		std::string country;
+
+		//ms from block request to its arrival, smoothed
+		uint32_t requestRtt = 0;
+		//allowed outstanding block requests
+		uint32_t requestQueueDepth = 0;
 	};
 
 	struct AlertMessage
@@ -33,6 +33,12 @@ namespace mttApi
 		API_EXPORT std::vector<float> getFilesProgress();
 		API_EXPORT bool selectFiles(const std::vector<bool>&);
 		API_EXPORT void setFilesPriority(const std::vector<mtt::Priority>&);
+
+		//file is read sequentially from offset at bytesPerSecond (0 means download speed), pieces ahead get deadlines replacing previous ones
+		API_EXPORT void setReadCursor(uint32_t fileIdx, uint64_t offset, uint32_t bytesPerSecond);
+		//piece is wanted within ms, pieces with deadline are requested first from fastest peers
+		API_EXPORT void setPieceDeadline(uint32_t pieceIdx, uint32_t ms);
+		API_EXPORT void clearPieceDeadlines();
 		API_EXPORT std::string getLocationPath();
 		API_EXPORT mtt::Status setLocationPath(const std::string& path);
 
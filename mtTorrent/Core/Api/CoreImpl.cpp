@@ -2,6 +2,7 @@
 
 #include "Core.h"
 #include "IncomingPeersListener.h"
+#include "utils/BufferPool.h"
 
 std::shared_ptr<mttApi::Core> mttApi::Core::create()
 {
@@ -82,3 +83,16 @@ std::vector<std::unique_ptr<mtt::AlertMessage>> mttApi::Core::popAlerts()
 {
 	return static_cast<mtt::Core*>(this)->alerts.popAlerts();
 }
+
+mtt::BufferPoolInfo mttApi::Core::getBlockBuffersInfo()
+{
+	auto pool = BufferPool::Blocks().getInfo();
+
+	mtt::BufferPoolInfo info;
+	info.requests = pool.requests;
+	info.hits = pool.hits;
+	info.usedBuffers = pool.used;
+	info.peakUsedBuffers = pool.peakUsed;
+
+	return info;
+}
@@ -24,3 +24,23 @@ uint32_t mttApi::FileTransfer::getCurrentRequestsCount()
 {
 	return static_cast<mtt::FileTransfer*>(this)->getCurrentRequestsCount();
 }
+
+mtt::WriteQueueInfo mttApi::FileTransfer::getWriteQueueInfo()
+{
+	return static_cast<mtt::FileTransfer*>(this)->getWriteQueueInfo();
+}
+
+mtt::VerificationInfo mttApi::FileTransfer::getVerificationInfo()
+{
+	return static_cast<mtt::FileTransfer*>(this)->getVerificationInfo();
+}
+
+mtt::EndgameInfo mttApi::FileTransfer::getEndgameInfo()
+{
+	return static_cast<mtt::FileTransfer*>(this)->getEndgameInfo();
+}
+
+mtt::StreamingInfo mttApi::FileTransfer::getStreamingInfo()
+{
+	return static_cast<mtt::FileTransfer*>(this)->getStreamingInfo();
+}
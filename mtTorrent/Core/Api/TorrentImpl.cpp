@@ -43,6 +43,21 @@ void mttApi::Torrent::setFilesPriority(const std::vector<mtt::Priority>& p)
 	return static_cast<mtt::Torrent*>(this)->setFilesPriority(p);
 }
 
+void mttApi::Torrent::setReadCursor(uint32_t fileIdx, uint64_t offset, uint32_t bytesPerSecond)
+{
+	static_cast<mtt::Torrent*>(this)->setReadCursor(fileIdx, offset, bytesPerSecond);
+}
+
+void mttApi::Torrent::setPieceDeadline(uint32_t pieceIdx, uint32_t ms)
+{
+	static_cast<mtt::Torrent*>(this)->setPieceDeadline(pieceIdx, ms);
+}
+
+void mttApi::Torrent::clearPieceDeadlines()
+{
+	static_cast<mtt::Torrent*>(this)->clearPieceDeadlines();
+}
+
 mtt::DownloadSelection mttApi::Torrent::getFilesSelection()
 {
 	return static_cast<mtt::Torrent*>(this)->files.selection;
@@ -134,9 +149,11 @@ bool mttApi::Torrent::getReceivedPieces(uint32_t* dataPieces, size_t& dataSize)
 	}
 
 	size_t idx = 0;
-	for (uint32_t i = 0; i < progress.pieces.size(); i++)
-		if (progress.hasPiece(i))
-			dataPieces[idx++] = i;
+	progress.forEachReceived([&](uint32_t i)
+		{
+			if (idx < dataSize)
+				dataPieces[idx++] = i;
+		});
 
 	dataSize = idx;
 	return true;
@@ -45,6 +45,7 @@ namespace mtt
 			changed |= val.udpPort != external.connection.udpPort;
 			changed |= val.maxTorrentConnections != external.connection.maxTorrentConnections;
 			changed |= val.upnpPortMapping != external.connection.upnpPortMapping;
+			changed |= val.enableUtp != external.connection.enableUtp;
 
 			if (changed)
 			{
@@ -67,6 +68,7 @@ namespace mtt
 		void setValues(const External::Files& val)
 		{
 			bool changed = val.defaultDirectory != external.files.defaultDirectory;
+			changed |= val.mappedStorage != external.files.mappedStorage;
 
 			if (changed)
 			{
@@ -88,6 +90,8 @@ namespace mtt
 					external.connection.maxTorrentConnections = conn->value["maxConn"].GetUint();
 				if (conn->value.HasMember("upnp"))
 					external.connection.upnpPortMapping = conn->value["upnp"].GetBool();
+				if (conn->value.HasMember("utp"))
+					external.connection.enableUtp = conn->value["utp"].GetBool();
 			}
 
 			auto dht = externalSettings.FindMember("dht");
@@ -102,6 +106,8 @@ namespace mtt
 			{
 				if (files->value.HasMember("directory"))
 					external.files.defaultDirectory = files->value["directory"].GetString();
+				if (files->value.HasMember("mapped"))
+					external.files.mappedStorage = files->value["mapped"].GetBool();
 			}
 		}
 
@@ -126,6 +132,46 @@ namespace mtt
 			if (item != internalSettings.MemberEnd())
 				internal_.maxPeersPerTrackerRequest = item->value.GetUint();
 
+			item = internalSettings.FindMember("maxOpenFiles");
+			if (item != internalSettings.MemberEnd())
+				internal_.maxOpenFiles = item->value.GetUint();
+
+			item = internalSettings.FindMember("maxWriteQueueSize");
+			if (item != internalSettings.MemberEnd())
+				internal_.maxWriteQueueSize = item->value.GetUint();
+
+			item = internalSettings.FindMember("checkThreads");
+			if (item != internalSettings.MemberEnd())
+				internal_.checkThreads = item->value.GetUint();
+
+			item = internalSettings.FindMember("checkReadsPerDevice");
+			if (item != internalSettings.MemberEnd())
+				internal_.checkReadsPerDevice = item->value.GetUint();
+
+			item = internalSettings.FindMember("maxCheckBufferSize");
+			if (item != internalSettings.MemberEnd())
+				internal_.maxCheckBufferSize = item->value.GetUint();
+
+			item = internalSettings.FindMember("verifyThreads");
+			if (item != internalSettings.MemberEnd())
+				internal_.verifyThreads = item->value.GetUint();
+
+			item = internalSettings.FindMember("minPeerRequests");
+			if (item != internalSettings.MemberEnd())
+				internal_.minPeerRequests = item->value.GetUint();
+
+			item = internalSettings.FindMember("maxPeerRequests");
+			if (item != internalSettings.MemberEnd())
+				internal_.maxPeerRequests = item->value.GetUint();
+
+			item = internalSettings.FindMember("serviceThreads");
+			if (item != internalSettings.MemberEnd())
+				internal_.serviceThreads = item->value.GetUint();
+
+			item = internalSettings.FindMember("pinServiceThreads");
+			if (item != internalSettings.MemberEnd())
+				internal_.pinServiceThreads = item->value.GetBool();
+
 			auto dhtSettings = internalSettings.FindMember("dht");
 			if (dhtSettings != internalSettings.MemberEnd())
 			{
@@ -274,6 +320,7 @@ namespace mtt
 				writer.Key("udpPort"); writer.Uint(connection.udpPort);
 				writer.Key("maxConn"); writer.Uint(connection.maxTorrentConnections);
 				writer.Key("upnp"); writer.Bool(connection.upnpPortMapping);
+				writer.Key("utp"); writer.Bool(connection.enableUtp);
 				writer.EndObject();
 			}
 
@@ -288,6 +335,7 @@ namespace mtt
 			{
 				writer.StartObject();
 				writer.Key("directory"); writer.String(files.defaultDirectory.data());
+				writer.Key("mapped"); writer.Bool(files.mappedStorage);
 				writer.EndObject();
 			}
 
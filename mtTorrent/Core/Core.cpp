@@ -9,6 +9,8 @@
 #include "State.h"
 #include "utils/HexEncoding.h"
 #include "utils/TorrentFileParser.h"
+#include "utils/FileHandleCache.h"
+#include "utils/UtpManager.h"
 
 mtt::Core core;
 
@@ -96,12 +98,22 @@ void mtt::Core::init()
 
 	mtt::config::load();
 
-	dht = std::make_shared<dht::Communication>();
+	{
+		auto& settings = mtt::config::getInternal();
+		uint32_t threads = settings.serviceThreads ? settings.serviceThreads : std::max(1u, std::thread::hardware_concurrency());
+
+		auto& service = ServiceThreadpool::session();
+		service.start(1);
+		service.setWorkersLimits(1, threads);
+		service.setCpuPinning(settings.pinServiceThreads);
+	}
+
+	dht = std::make_shared<dht::Communication>(ServiceThreadpool::session());
 
 	if(mtt::config::getExternal().dht.enable)
 		dht->start();
 
-	listener = std::make_shared<IncomingPeersListener>([this](std::shared_ptr<TcpAsyncStream> s, const uint8_t* hash)
+	listener = std::make_shared<IncomingPeersListener>(ServiceThreadpool::session(), [this](std::shared_ptr<TcpAsyncStream> s, const uint8_t* hash)
 	{
 		auto t = getTorrent(hash);
 		if (t)
@@ -174,7 +186,11 @@ void mtt::Core::deinit()
 		dht.reset();
 	}
 
+	UtpManager::Get().stop();
 	UdpAsyncComm::Deinit();
+	FileHandleCache::Get().closeAll();
+
+	ServiceThreadpool::session().stop();
 
 	mtt::config::save();
 }
@@ -4,7 +4,7 @@
 
 mtt::dht::Communication* comm;
 
-mtt::dht::Communication::Communication() : responder(*this)
+mtt::dht::Communication::Communication(ServiceThreadpool& s) : responder(*this), service(s)
 {
 	udp = UdpAsyncComm::Get();
 	udp->listen(std::bind(&Communication::onUnknownUdpPacket, this, std::placeholders::_1, std::placeholders::_2));
@@ -25,8 +25,6 @@ mtt::dht::Communication& mtt::dht::Communication::get()
 
 void mtt::dht::Communication::start()
 {
-	service.start(2);
-
 	load();
 
 	refreshTable();
@@ -57,7 +55,6 @@ void mtt::dht::Communication::stop()
 	refreshTimer = nullptr;
 
 	udp->removeListeners();
-	service.stop();
 
 	save();
 }
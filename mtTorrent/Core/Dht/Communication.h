@@ -16,7 +16,7 @@ namespace mtt
 		{
 		public:
 
-			Communication();
+			Communication(ServiceThreadpool& service);
 			~Communication();
 
 			static Communication& get();
@@ -63,7 +63,7 @@ namespace mtt
 
 			std::shared_ptr<Table> table;
 			Responder responder;
-			ServiceThreadpool service;
+			ServiceThreadpool& service;
 
 			void loadDefaultRoots();
 
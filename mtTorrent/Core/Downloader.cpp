@@ -3,15 +3,80 @@
 #include "Torrent.h"
 #include "utils/HexEncoding.h"
 #include "Configuration.h"
-#include <numeric>
-#include <random>
+#include "utils/ServiceThreadpool.h"
 
 #define DL_LOG(x) WRITE_LOG(LogTypeDownload, x)
 
 const size_t MaxPreparedPieces = 10;
-const uint32_t MinPendingPeerRequestsBeforeNext = 5;
 const uint32_t MaxPendingPeerRequests = 10;
-const uint32_t MaxPendingPeerRequestsToSpeedRatio = (1024*1024);
+//blocks needed before speed and rtt are trusted
+const uint32_t MinReceivedBlocksForQueueDepth = 30;
+//peers requesting same block in endgame or close to deadline
+const uint8_t MaxEndgameBlockRequests = 3;
+//deadline is close when piece wouldnt be finished this long before it
+const int64_t DeadlineMarginMs = 1000;
+//deadline pieces added in front of requests of fast peer
+const uint32_t MaxDeadlinePiecesPerPeer = 4;
+//block request without response is released for other peers after this long, or after multiple of peer rtt
+const uint32_t BlockRequestTimeoutMs = 20000;
+const uint32_t BlockRequestTimeoutRtts = 8;
+
+//hashing of finished pieces, shared by all torrents
+static ServiceThreadpool& getVerifyService()
+{
+	static ServiceThreadpool verifyService([]()
+		{
+			uint32_t threads = mtt::config::getInternal().verifyThreads;
+			if (threads == 0)
+				threads = std::max(1u, std::thread::hardware_concurrency());
+
+			return std::min(threads, 20u);
+		}());
+
+	return verifyService;
+}
+
+bool mtt::ActivePeer::RequestedPiece::hasBlock(uint32_t begin) const
+{
+	return PiecesProgress::hasBit(blocksMask, begin / BlockRequestMaxSize);
+}
+
+void mtt::ActivePeer::RequestedPiece::addBlock(uint32_t begin)
+{
+	auto blockIdx = begin / BlockRequestMaxSize;
+
+	if (blockIdx / 64 >= blocksMask.size())
+		blocksMask.resize(blockIdx / 64 + 1);
+
+	blocksMask[blockIdx / 64] |= 1ull << (blockIdx % 64);
+	blocks.push_back({ begin, std::chrono::steady_clock::now() });
+}
+
+bool mtt::ActivePeer::RequestedPiece::removeBlock(uint32_t begin)
+{
+	if (!hasBlock(begin))
+		return false;
+
+	auto blockIdx = begin / BlockRequestMaxSize;
+	blocksMask[blockIdx / 64] &= ~(1ull << (blockIdx % 64));
+
+	for (auto it = blocks.begin(); it != blocks.end(); it++)
+	{
+		if (it->begin == begin)
+		{
+			blocks.erase(it);
+			break;
+		}
+	}
+
+	return true;
+}
+
+void mtt::ActivePeer::RequestedPiece::clearBlocks()
+{
+	blocks.clear();
+	blocksMask.clear();
+}
 
 mtt::Downloader::Downloader(TorrentPtr t)
 {
@@ -20,169 +85,439 @@ mtt::Downloader::Downloader(TorrentPtr t)
 
 void mtt::Downloader::reset()
 {
+	requests.init(torrent->infoFile.info.pieces.size());
+	verifyingPieces.clear();
+	resetGeneration++;
+	pieceHolders.clear();
+	picker.init(torrent->infoFile.info.pieces.size());
+	deadlinesChanged();
+
+	updateStats();
+}
+
+void mtt::Downloader::setPiecesPriority(const std::vector<Priority>& priority)
+{
+	picker.setPriority(priority, torrent->files.progress);
+}
+
+void mtt::Downloader::pieceAvailable(uint32_t idx)
+{
+	picker.addAvailability(idx);
+}
+
+void mtt::Downloader::piecesAvailable(const PiecesProgress& peerPieces)
+{
+	picker.addAvailability(peerPieces);
+}
+
+void mtt::Downloader::piecesUnavailable(const PiecesProgress& peerPieces)
+{
+	picker.removeAvailability(peerPieces);
+}
+
+void mtt::Downloader::setDeadline(uint32_t pieceIdx, std::chrono::steady_clock::time_point time)
+{
+	addDeadline(pieceIdx, time);
+	deadlinesChanged();
+}
+
+void mtt::Downloader::setDeadlines(const std::vector<std::pair<uint32_t, std::chrono::steady_clock::time_point>>& pieces)
+{
+	deadlines.clear();
+
+	for (auto& p : pieces)
+		addDeadline(p.first, p.second);
+
+	deadlinesChanged();
+}
+
+void mtt::Downloader::clearDeadlines()
+{
+	deadlines.clear();
+	deadlinesChanged();
+}
+
+void mtt::Downloader::addDeadline(uint32_t pieceIdx, std::chrono::steady_clock::time_point time)
+{
+	for (auto it = deadlines.begin(); it != deadlines.end(); it++)
+	{
+		if (it->idx == pieceIdx)
+		{
+			deadlines.erase(it);
+			break;
+		}
+	}
+
+	if (torrent->files.progress.hasPiece(pieceIdx))
+		return;
+
+	PieceDeadline deadline;
+	deadline.idx = pieceIdx;
+	deadline.time = time;
+	deadline.critical = isDeadlineClose(deadline, std::chrono::steady_clock::now());
+
+	auto pos = std::upper_bound(deadlines.begin(), deadlines.end(), deadline, [](const PieceDeadline& d1, const PieceDeadline& d2) { return d1.time < d2.time; });
+	deadlines.insert(pos, deadline);
+}
+
+bool mtt::Downloader::isDeadlineClose(const PieceDeadline& deadline, std::chrono::steady_clock::time_point now)
+{
+	auto timeLeft = std::chrono::duration_cast<std::chrono::milliseconds>(deadline.time - now).count();
+
+	uint64_t holdersSpeed = 0;
+	auto holders = pieceHolders.find(deadline.idx);
+	if (holders != pieceHolders.end())
 	{
-		std::lock_guard<std::mutex> guard(requestsMutex);
-		requests.clear();
+		for (auto peer : holders->second)
+			holdersSpeed += peer->downloadSpeed;
 	}
 
+	if (holdersSpeed == 0)
+		return timeLeft < DeadlineMarginMs;
+
+	uint64_t remaining = torrent->infoFile.info.getPieceSize(deadline.idx);
+	if (auto r = requests.find(deadline.idx))
+		remaining -= std::min<uint64_t>(remaining, r->receivedSize);
+
+	//expected time of peers already downloading it
+	return (int64_t)(remaining * 1000 / holdersSpeed) + DeadlineMarginMs > timeLeft;
+}
+
+void mtt::Downloader::deadlinesChanged()
+{
+	auto words = (torrent->infoFile.info.pieces.size() + 63) / 64;
+	reservedPieces.assign(words, 0);
+	criticalPieces.assign(words, 0);
+
+	for (auto& d : deadlines)
 	{
-		std::lock_guard<std::mutex> guard(priorityMutex);
+		auto bit = 1ull << (d.idx % 64);
+
+		if (d.critical)
+			criticalPieces[d.idx / 64] |= bit;
 
-		piecesPriority.resize(torrent->infoFile.info.pieces.size());
-		std::iota(piecesPriority.begin(), piecesPriority.end(), 0);
+		//close deadline piece nobody downloads is picked by any peer
+		if (!d.critical || pieceHolders.find(d.idx) != pieceHolders.end())
+			reservedPieces[d.idx / 64] |= bit;
 	}
+
+	deadlinesVersion++;
 }
 
-void mtt::Downloader::sortPriorityByAvailability(const std::vector<uint32_t>& availability)
+bool mtt::Downloader::updateDeadlines(const std::list<ActivePeer>& peers)
 {
-	std::lock_guard<std::mutex> guard(priorityMutex);
+	std::vector<uint32_t> speeds;
+	for (auto& peer : peers)
+		speeds.push_back(peer.downloadSpeed);
+
+	fastPeerSpeed = 0;
+	if (!speeds.empty())
+	{
+		auto fastest = speeds.begin() + (speeds.size() - 1) / 4;
+		std::nth_element(speeds.begin(), fastest, speeds.end(), std::greater<uint32_t>());
+		fastPeerSpeed = *fastest;
+	}
+
+	if (deadlines.empty())
+		return false;
+
+	auto now = std::chrono::steady_clock::now();
+	bool changed = false;
 
-	std::iota(piecesPriority.begin(), piecesPriority.end(), 0);
+	for (auto it = deadlines.begin(); it != deadlines.end();)
+	{
+		//received or unselected meanwhile
+		if (!torrent->files.progress.wantedPiece(it->idx))
+		{
+			it = deadlines.erase(it);
+			changed = true;
+			continue;
+		}
+
+		if (!it->missed && it->time < now)
+		{
+			it->missed = true;
+			streamingStats.missedDeadlines++;
+		}
+
+		bool critical = isDeadlineClose(*it, now);
+		if (critical != it->critical)
+		{
+			it->critical = critical;
+			changed = true;
+		}
+
+		it++;
+	}
+
+	if (changed)
+		deadlinesChanged();
 
-	std::sort(piecesPriority.begin(), piecesPriority.end(),
-		[&availability](uint32_t i1, uint32_t i2) {return availability[i1] < availability[i2]; });
+	return changed;
+}
+
+void mtt::Downloader::addDeadlinePieces(ActivePeer* peer)
+{
+	bool fastPeer = peer->downloadSpeed >= fastPeerSpeed;
+	uint32_t deadlinePieces = 0;
+	//position after deadline pieces in front of requests
+	size_t insertPos = 0;
+	auto& pieces = peer->requestedPieces;
 
-	uint32_t lastIdx = 0;
-	auto rng = std::default_random_engine{};
-	for (uint32_t i = 1; i <= (uint32_t)piecesPriority.size(); i++)
+	for (auto& d : deadlines)
 	{
-		if (i == (uint32_t)piecesPriority.size() || availability[piecesPriority[i]] != availability[piecesPriority[i - 1]])
+		if (deadlinePieces >= MaxDeadlinePiecesPerPeer)
+			break;
+
+		//slow peers help only with close deadline nobody downloads
+		if (!fastPeer && PiecesProgress::hasBit(reservedPieces, d.idx))
+			continue;
+
+		if (!peer->comm->info.pieces.hasPiece(d.idx) || !torrent->files.progress.wantedPiece(d.idx))
+			continue;
+
+		bool requested = false;
+		for (size_t i = 0; i < pieces.size(); i++)
 		{
-			if (lastIdx + 1 < i)
+			if (pieces[i].idx == d.idx)
 			{
-				std::shuffle(piecesPriority.begin() + lastIdx, piecesPriority.begin() + i, rng);
+				//keep deadline order in front of other pieces
+				if (i >= insertPos)
+				{
+					std::rotate(pieces.begin() + insertPos, pieces.begin() + i, pieces.begin() + i + 1);
+					insertPos++;
+				}
+
+				requested = true;
+				break;
 			}
+		}
 
-			lastIdx = i;
+		if (requested)
+		{
+			deadlinePieces++;
+			continue;
 		}
+
+		//verifying
+		if (requests.isActive(d.idx) && !requests.find(d.idx))
+			continue;
+
+		//downloaded by others in time
+		if (requests.find(d.idx) && !d.critical)
+			continue;
+
+		pieces.insert(pieces.begin() + insertPos++, ActivePeer::RequestedPiece{ d.idx,{} });
+		addPieceHolder(peer, d.idx);
+		deadlinePieces++;
 	}
 }
 
-void mtt::Downloader::sortPriority(const std::vector<Priority>& priority)
+mtt::StreamingInfo mtt::Downloader::getStreamingInfo()
 {
-	std::sort(piecesPriority.begin(), piecesPriority.end(),
-		[&](uint32_t i1, uint32_t i2) {return priority[i1] > priority[i2]; });
+	std::lock_guard<std::mutex> guard(statsMutex);
+	return stats.streaming;
 }
 
 std::vector<uint32_t> mtt::Downloader::getCurrentRequests()
 {
-	std::vector<uint32_t> out;
-
-	std::lock_guard<std::mutex> guard(requestsMutex);
-	for (auto& r : requests)
-	{
-		out.push_back(r.pieceIdx);
-	}
-
-	return out;
+	std::lock_guard<std::mutex> guard(statsMutex);
+	return stats.requests;
 }
 
 uint32_t mtt::Downloader::getCurrentRequestsCount()
 {
-	std::lock_guard<std::mutex> guard(requestsMutex);
-	return (uint32_t) requests.size();
+	std::lock_guard<std::mutex> guard(statsMutex);
+	return (uint32_t)stats.requests.size();
 }
 
 size_t mtt::Downloader::getUnfinishedPiecesDownloadSize()
 {
-	size_t s = 0;
+	std::lock_guard<std::mutex> guard(statsMutex);
+	return stats.unfinishedSize;
+}
+
+void mtt::Downloader::updateStats()
+{
+	size_t unfinishedSize = 0;
+
+	for (auto& p : verifyingPieces)
+	{
+		unfinishedSize += p->data.size();
+	}
 
-	std::lock_guard<std::mutex> guard(requestsMutex);
+	std::lock_guard<std::mutex> guard(statsMutex);
 
+	stats.requests.clear();
 	for (auto& r : requests)
 	{
-		s += r.receivedSize;
+		stats.requests.push_back(r.pieceIdx);
+		unfinishedSize += r.receivedSize;
 	}
 
-	return s;
+	stats.unfinishedSize = unfinishedSize;
+	stats.endgame = endgameStats;
+	stats.endgame.active = isEndgame();
+	stats.streaming = streamingStats;
+	stats.streaming.pendingPieces = (uint32_t)deadlines.size();
 }
 
-mtt::Downloader::PieceStatus mtt::Downloader::pieceBlockReceived(PieceBlock& block)
+mtt::Downloader::PieceStatus mtt::Downloader::pieceBlockReceived(PieceBlockView& block, PeerCommunication* source)
 {
-	bool valid = true;
 	bool finished = false;
+	bool added = false;
 
+	if (auto r = requests.find(block.info.index))
 	{
-		std::lock_guard<std::mutex> guard(requestsMutex);
-
-		for (auto& r : requests)
+		if (!r->piece)
 		{
-			if (r.pieceIdx == block.info.index)
-			{
-				if (!r.piece)
-				{
-					r.piece = std::make_shared<DownloadedPiece>();
-					r.piece->init(r.pieceIdx, torrent->infoFile.info.getPieceSize(r.pieceIdx), r.blocksCount);
-				}
+			r->piece = std::make_shared<DownloadedPiece>();
+			r->piece->init(r->pieceIdx, torrent->infoFile.info.getPieceSize(r->pieceIdx), r->blocksCount);
+		}
 
-				if(r.piece->addBlock(block))
-					r.receivedSize += block.info.length;
+		if (r->piece->addBlock(block))
+		{
+			r->receivedSize += block.info.length;
+			added = true;
+		}
 
-				if (r.piece->remainingBlocks == 0)
-				{
-					finished = true;
-					valid = pieceFinished(&r);
-				}
-				break;
-			}
+		if (r->piece->remainingBlocks == 0)
+		{
+			finished = true;
+			pieceFinished(r, source);
 		}
 	}
 
-	LOG_APPEND("receive " << block.info.index << " " << block.info.begin);
+	//duplicate from endgame or late block of finished piece
+	if (!added)
+		endgameStats.wastedBytes += block.data.size();
 
-	if (valid && finished && torrent->selectionFinished())
-		onFinish();
+	LOG_APPEND("receive " << block.info.index << " " << block.info.begin);
 
-	if (finished)
-		return valid ? Finished : Invalid;
-	else
-		return Ok;
+	return finished ? Finished : Ok;
 }
 
-void mtt::Downloader::removeBlockRequests(std::vector<mtt::ActivePeer>& peers, PieceBlock& block, PieceStatus status, PeerCommunication* source)
+void mtt::Downloader::removeBlockRequests(ActivePeer* sourcePeer, PieceBlockView& block, PieceStatus status, PeerCommunication* source)
 {
-	for (auto& peer : peers)
-	{
-		if (peer.comm == source)
-		{
-			if (status == Invalid)
-				peer.invalidPieces++;
-			else
-				peer.receivedBlocks++;
-		}
+	if (sourcePeer)
+		sourcePeer->receivedBlocks++;
+
+	auto holders = pieceHolders.find(block.info.index);
+	if (holders == pieceHolders.end())
+		return;
 
-		for (auto it = peer.requestedPieces.begin(); it != peer.requestedPieces.end(); it++)
+	//evaluating peers changes holders
+	auto peers = holders->second;
+
+	for (auto peer : peers)
+	{
+		for (auto it = peer->requestedPieces.begin(); it != peer->requestedPieces.end(); it++)
 		{
 			if (it->idx == block.info.index)
 			{
+				if (peer->comm == source)
+					updateRequestRtt(*peer, *it, block.info.begin);
+
+				uint32_t cancelled = 0;
+
 				if (status == Finished)
-					peer.requestedPieces.erase(it);
-				else
 				{
-					for (auto it2 = it->blocks.begin(); it2 != it->blocks.end(); it2++)
+					//other peers still sending blocks of finished piece
+					if (peer->comm != source)
 					{
-						if (*it2 == block.info.begin)
+						for (auto& b : it->blocks)
 						{
-							it->blocks.erase(it2);
-							break;
+							auto info = torrent->infoFile.info.getPieceBlockInfo(it->idx, b.begin / BlockRequestMaxSize);
+							peer->comm->sendCancel(info);
+							cancelled++;
 						}
 					}
+
+					peer->requestedPieces.erase(it);
+					removePieceHolder(peer, block.info.index);
+				}
+				else if (it->removeBlock(block.info.begin))
+				{
+					//duplicate request from endgame
+					if (peer->comm != source)
+					{
+						peer->comm->sendCancel(block.info);
+						cancelled++;
+					}
 				}
 
-				evaluateNextRequests(&peer);
+				endgameStats.cancelledRequests += cancelled;
+
+				evaluateNextRequests(peer);
 				break;
 			}
 		}
 	}
 }
 
+void mtt::Downloader::addPieceHolder(ActivePeer* peer, uint32_t pieceIdx)
+{
+	pieceHolders[pieceIdx].push_back(peer);
+}
+
+void mtt::Downloader::removePieceHolder(ActivePeer* peer, uint32_t pieceIdx)
+{
+	auto it = pieceHolders.find(pieceIdx);
+	if (it == pieceHolders.end())
+		return;
+
+	auto& peers = it->second;
+	for (auto& p : peers)
+	{
+		if (p == peer)
+		{
+			p = peers.back();
+			peers.pop_back();
+			break;
+		}
+	}
+
+	if (peers.empty())
+		pieceHolders.erase(it);
+}
+
 void mtt::Downloader::unchokePeer(ActivePeer* peer)
 {
 	if ((uint32_t)time(0) - peer->lastActivityTime > 5)
 	{
 		for (auto& p : peer->requestedPieces)
 		{
-			p.blocks.clear();
+			for (auto& b : p.blocks)
+				releaseBlockRequest(p.idx, b.begin);
+
+			p.clearBlocks();
+		}
+	}
+
+	evaluateNextRequests(peer);
+}
+
+void mtt::Downloader::blockRejected(ActivePeer* peer, PieceBlockInfo& block)
+{
+	for (auto it = peer->requestedPieces.begin(); it != peer->requestedPieces.end(); it++)
+	{
+		if (it->idx == block.index)
+		{
+			if (it->removeBlock(block.begin))
+				releaseBlockRequest(block.index, block.begin);
+
+			//rejected while choked, dont retry until unchoked or allowed
+			if (peer->comm->state.peerChoking && !peer->comm->info.isAllowedFast(block.index))
+			{
+				//other blocks of piece wont be rejected again without their request
+				for (auto& b : it->blocks)
+					releaseBlockRequest(it->idx, b.begin);
+
+				peer->requestedPieces.erase(it);
+				removePieceHolder(peer, block.index);
+			}
+
+			break;
 		}
 	}
 
@@ -193,12 +528,27 @@ void mtt::Downloader::evaluateNextRequests(ActivePeer* peer)
 {
 	if (peer->comm->state.peerChoking)
 	{
-		if (!peer->comm->info.pieces.empty() && !peer->comm->state.amInterested)
+		if (!peer->comm->state.amInterested && torrent->files.progress.wantsAnyFrom(peer->comm->info.pieces))
 			peer->comm->setInterested(true);
 
+		//only allowed fast pieces can be requested while choked
+		if (peer->comm->info.allowedFast.empty())
+			return;
+	}
+
+	//wait until storage writes queued pieces
+	if (torrent->files.storage.isWriteQueueFull())
+	{
+		writeQueueLimited = true;
 		return;
 	}
 
+	if (!deadlines.empty() && peer->deadlinesVersion != deadlinesVersion && !peer->comm->state.peerChoking)
+	{
+		peer->deadlinesVersion = deadlinesVersion;
+		addDeadlinePieces(peer);
+	}
+
 	if (peer->requestedPieces.empty())
 	{
 		auto pieces = getBestNextPieces(peer);
@@ -208,6 +558,7 @@ void mtt::Downloader::evaluateNextRequests(ActivePeer* peer)
 			for (auto& piece : pieces)
 			{
 				peer->requestedPieces.push_back(ActivePeer::RequestedPiece{ piece,{} });
+				addPieceHolder(peer, piece);
 			}
 		}
 	}
@@ -221,44 +572,71 @@ std::vector<uint32_t> mtt::Downloader::getBestNextPieces(ActivePeer* p)
 	std::vector<uint32_t> out;
 	std::vector<uint32_t> requestedElsewhere;
 
-	std::lock_guard<std::mutex> guard(priorityMutex);
+	//pieces peer has and we want, computed by words instead of testing each piece
+	auto wantedCount = torrent->files.progress.getWantedFrom(p->comm->info.pieces, wantedFromPeer);
+	if (wantedCount == 0)
+		return out;
+
+	bool fastPeer = deadlines.empty() || p->downloadSpeed >= fastPeerSpeed;
 
-	for(auto idx : piecesPriority)
+	auto pickPiece = [&](uint32_t idx)
 	{
-		if (p->comm->info.pieces.pieces[idx])
+		if (PiecesProgress::hasBit(wantedFromPeer, idx))
 		{
-			if (torrent->files.progress.wantedPiece(idx))
+			//visited once
+			wantedFromPeer[idx / 64] &= ~(1ull << (idx % 64));
+			wantedCount--;
+
+			bool alreadyRequested = std::find(out.begin(), out.end(), idx) != out.end()
+				|| std::find(requestedElsewhere.begin(), requestedElsewhere.end(), idx) != requestedElsewhere.end();
+
+			//deadline pieces are left to fast peers
+			if (!fastPeer && PiecesProgress::hasBit(reservedPieces, idx))
+				alreadyRequested = true;
+			for (auto& r : p->requestedPieces)
 			{
-				bool alreadyRequested = false;
-				for (auto& r : p->requestedPieces)
-				{
-					if (r.idx == idx)
-						alreadyRequested = true;
-				}
+				if (r.idx == idx)
+					alreadyRequested = true;
+			}
 
-				if (!alreadyRequested)
+			if (!alreadyRequested)
+			{
+				if (requests.find(idx))
 				{
-					std::lock_guard<std::mutex> guard(requestsMutex);
-					for (auto& r : requests)
-					{
-						if (r.pieceIdx == idx)
-						{
-							if (requestedElsewhere.size() + out.size() < MaxPreparedPieces)
-								requestedElsewhere.push_back(idx);
-
-							alreadyRequested = true;
-							break;
-						}
-					}
+					if (requestedElsewhere.size() + out.size() < MaxPreparedPieces)
+						requestedElsewhere.push_back(idx);
 
-					if(!alreadyRequested)
-						out.push_back(idx);
+					alreadyRequested = true;
 				}
+				else if (requests.isActive(idx))
+					alreadyRequested = true;
+
+				if(!alreadyRequested)
+					out.push_back(idx);
 			}
 		}
 
-		if(out.size() >= MaxPreparedPieces)
-			break;
+		//stop when all wanted pieces of peer were visited
+		return out.size() < MaxPreparedPieces && wantedCount > 0;
+	};
+
+	//only allowed fast pieces can be requested while choked
+	if (p->comm->state.peerChoking)
+	{
+		for (auto idx : p->comm->info.allowedFast)
+			if (!pickPiece(idx))
+				break;
+	}
+	else
+	{
+		//pieces suggested by peer are likely cached on its side, try them first
+		bool picking = true;
+		for (auto idx : p->comm->info.suggestedPieces)
+			if (!(picking = pickPiece(idx)))
+				break;
+
+		if (picking)
+			picker.forEach(pickPiece);
 	}
 
 	if (out.size() < MaxPreparedPieces && !requestedElsewhere.empty())
@@ -281,38 +659,31 @@ void mtt::Downloader::sendPieceRequests(ActivePeer* p)
 		count += (uint32_t)piece.blocks.size();
 	}
 
-	if (count < MinPendingPeerRequestsBeforeNext)
-	{
-		auto maxRequests = MaxPendingPeerRequests;
-		if (p->receivedBlocks > 30)
-		{
-			maxRequests = MaxPendingPeerRequests * std::max(1U, p->downloadSpeed / MaxPendingPeerRequestsToSpeedRatio);
-		}
+	auto maxRequests = getRequestQueueDepth(p);
 
-		std::lock_guard<std::mutex> guard(requestsMutex);
+	//refill when at least quarter of queue is free, to send requests in batches
+	if (count < std::max(1u, maxRequests - maxRequests / 4))
+	{
+		bool endgame = isEndgame();
 
 		for (auto& currentPiece : p->requestedPieces)
 		{
-			RequestInfo* request = nullptr;
-			for (auto& r : requests)
-			{
-				if (r.pieceIdx == currentPiece.idx)
-				{
-					request = &r;
-					break;
-				}
-			}
+			if (p->comm->state.peerChoking && !p->comm->info.isAllowedFast(currentPiece.idx))
+				continue;
+
+			PieceRequest* request = requests.find(currentPiece.idx);
 
 			if (!request)
 			{
+				//finished meanwhile
+				if (requests.isActive(currentPiece.idx))
+					continue;
+
 				DL_LOG("Request add " << currentPiece.idx);
-				requests.push_back(RequestInfo());
-				request = &requests.back();
-				request->pieceIdx = currentPiece.idx;
-				request->blocksCount = (uint16_t)torrent->infoFile.info.getPieceBlocksCount(currentPiece.idx);
+				request = requests.add(currentPiece.idx, (uint16_t)torrent->infoFile.info.getPieceBlocksCount(currentPiece.idx));
 			}
 
-			count += sendPieceRequests(p, &currentPiece, request, maxRequests - count);
+			count += sendPieceRequests(p, &currentPiece, request, maxRequests - count, endgame);
 
 			if(count >= maxRequests)
 				break;
@@ -320,20 +691,34 @@ void mtt::Downloader::sendPieceRequests(ActivePeer* p)
 	}
 }
 
-uint32_t mtt::Downloader::sendPieceRequests(ActivePeer* peer, ActivePeer::RequestedPiece* request, RequestInfo* r, uint32_t max)
+uint32_t mtt::Downloader::sendPieceRequests(ActivePeer* peer, ActivePeer::RequestedPiece* request, PieceRequest* r, uint32_t max, bool endgame)
 {
 	uint32_t count = 0;
+	bool critical = PiecesProgress::hasBit(criticalPieces, request->idx);
 
 	uint16_t nextBlock = r->nextBlockRequestIdx;
 	for (uint32_t i = 0; i < r->blocksCount; i++)
 	{
-		if (!r->piece || r->piece->blocksTodo[nextBlock] == 0)
+		auto requestedCount = r->blockRequests[nextBlock];
+
+		//block requested elsewhere is requested again only in endgame or when deadline of piece is close
+		if ((!r->piece || r->piece->blocksTodo[nextBlock] == 0) && (requestedCount == 0 || ((endgame || critical) && requestedCount < MaxEndgameBlockRequests)))
 		{
-			if (std::find(request->blocks.begin(), request->blocks.end(), nextBlock*BlockRequestMaxSize) == request->blocks.end())
+			if (!request->hasBlock(nextBlock * BlockRequestMaxSize))
 			{
 				auto info = torrent->infoFile.info.getPieceBlockInfo(request->idx, nextBlock);
 				DL_LOG("Send block request " << info.index << "-" << info.begin);
-				request->blocks.push_back(info.begin);
+				request->addBlock(info.begin);
+
+				if (requestedCount)
+				{
+					if (endgame)
+						endgameStats.duplicateRequests++;
+					else
+						streamingStats.duplicateRequests++;
+				}
+				r->blockRequests[nextBlock]++;
+
 				peer->comm->requestPieceBlock(info);
 				count++;
 
@@ -351,29 +736,230 @@ uint32_t mtt::Downloader::sendPieceRequests(ActivePeer* peer, ActivePeer::Reques
 	return count;
 }
 
-bool mtt::Downloader::pieceFinished(RequestInfo* r)
+bool mtt::Downloader::isEndgame()
+{
+	auto& progress = torrent->files.progress;
+	auto missingPieces = progress.selectedPieces - progress.getSelectedReceivedPiecesCount();
+
+	//nothing left to request which isnt already being downloaded
+	return missingPieces > 0 && missingPieces <= requests.size() + verifyingPieces.size();
+}
+
+void mtt::Downloader::releaseBlockRequest(uint32_t pieceIdx, uint32_t blockBegin)
+{
+	if (auto r = requests.find(pieceIdx))
+	{
+		auto blockIdx = blockBegin / BlockRequestMaxSize;
+
+		if (blockIdx < r->blockRequests.size() && r->blockRequests[blockIdx])
+			r->blockRequests[blockIdx]--;
+	}
+}
+
+void mtt::Downloader::peerRemoved(ActivePeer* peer)
+{
+	for (auto& p : peer->requestedPieces)
+	{
+		for (auto& b : p.blocks)
+			releaseBlockRequest(p.idx, b.begin);
+
+		removePieceHolder(peer, p.idx);
+	}
+
+	peer->requestedPieces.clear();
+}
+
+void mtt::Downloader::peerChoked(ActivePeer* peer)
+{
+	//with fast extension the peer rejects each discarded request
+	if (!peer->comm->info.supportsFastExtension())
+		peerRemoved(peer);
+}
+
+bool mtt::Downloader::releaseStalledRequests(ActivePeer* peer)
+{
+	auto now = std::chrono::steady_clock::now();
+	auto timeout = std::chrono::milliseconds(std::max(BlockRequestTimeoutMs, peer->requestRtt * BlockRequestTimeoutRtts));
+	bool released = false;
+
+	for (auto it = peer->requestedPieces.begin(); it != peer->requestedPieces.end();)
+	{
+		bool pieceReleased = false;
+
+		for (size_t i = 0; i < it->blocks.size();)
+		{
+			if (now - it->blocks[i].time > timeout)
+			{
+				auto begin = it->blocks[i].begin;
+				it->removeBlock(begin);
+				releaseBlockRequest(it->idx, begin);
+				pieceReleased = true;
+			}
+			else
+				i++;
+		}
+
+		if (pieceReleased && it->blocks.empty())
+		{
+			removePieceHolder(peer, it->idx);
+			it = peer->requestedPieces.erase(it);
+		}
+		else
+			it++;
+
+		released |= pieceReleased;
+	}
+
+	return released;
+}
+
+mtt::EndgameInfo mtt::Downloader::getEndgameInfo()
+{
+	std::lock_guard<std::mutex> guard(statsMutex);
+	return stats.endgame;
+}
+
+uint32_t mtt::Downloader::getRequestQueueDepth(ActivePeer* peer)
+{
+	auto& settings = mtt::config::getInternal();
+	uint32_t depth = MaxPendingPeerRequests;
+
+	if (peer->receivedBlocks > MinReceivedBlocksForQueueDepth && peer->minRequestRtt)
+	{
+		//bytes in flight covering peer speed over round trip, doubled to leave room for growing speed
+		uint64_t bdp = (uint64_t)peer->downloadSpeed * peer->minRequestRtt / 1000;
+		depth = (uint32_t)std::min<uint64_t>(2 * bdp / BlockRequestMaxSize + 1, UINT32_MAX);
+	}
+
+	depth = std::max(depth, settings.minPeerRequests);
+	depth = std::min(depth, std::max(settings.maxPeerRequests, settings.minPeerRequests));
+
+	peer->requestQueueDepth = depth;
+
+	return depth;
+}
+
+void mtt::Downloader::updateRequestRtt(ActivePeer& peer, ActivePeer::RequestedPiece& piece, uint32_t blockBegin)
+{
+	for (auto& b : piece.blocks)
+	{
+		if (b.begin == blockBegin)
+		{
+			auto sample = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - b.time).count();
+			sample = std::max(sample, 1u);
+
+			peer.requestRtt = peer.requestRtt ? (7 * peer.requestRtt + sample) / 8 : sample;
+
+			//samples include waiting behind queued blocks, lowest one is closest to pure latency
+			//slowly raised to follow changing route, step rounded up so samples close above still raise it
+			if (!peer.minRequestRtt || sample < peer.minRequestRtt)
+				peer.minRequestRtt = sample;
+			else
+				peer.minRequestRtt += (sample - peer.minRequestRtt + 63) / 64;
+
+			break;
+		}
+	}
+}
+
+void mtt::Downloader::pieceFinished(PieceRequest* r, PeerCommunication* source)
 {
 	DL_LOG("Finished piece " << r->pieceIdx);
 
-	bool valid = r->piece->isValid(torrent->infoFile.info.pieces[r->pieceIdx].hash);
+	auto piece = r->piece;
+	verifyingPieces.push_back(piece);
+
+	DL_LOG("Request rem " << r->pieceIdx);
+	requests.setVerifying(r->pieceIdx);
+
+	{
+		std::lock_guard<std::mutex> guard(verifyMutex);
+		verifyStats.queuedPieces++;
+	}
+
+	auto t = torrent;
+	auto generation = resetGeneration;
+	getVerifyService().io.post([this, t, piece, source, generation]()
+		{
+			auto start = std::chrono::steady_clock::now();
+			bool valid = piece->isValid(t->infoFile.info.pieces[piece->index].hash);
+			auto duration = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+			{
+				std::lock_guard<std::mutex> guard(verifyMutex);
+				verifyStats.queuedPieces--;
+				verifyStats.verifiedPieces++;
+				if (!valid)
+					verifyStats.invalidPieces++;
+
+				verifiedBytes += piece->data.size();
+				verifyTime += duration;
+			}
+
+			t->strand->post([this, t, piece, valid, source, generation]() { pieceVerified(piece, valid, source, generation); });
+		});
+}
+
+void mtt::Downloader::pieceVerified(std::shared_ptr<DownloadedPiece> piece, bool valid, PeerCommunication* source, uint32_t generation)
+{
+	DL_LOG("Verified piece " << piece->index << " " << valid);
+
+	//finished after stop or reset, source peer may be gone
+	if (generation != resetGeneration)
+		return;
 
 	if (valid)
-		torrent->files.addPiece(*r->piece.get());
+	{
+		torrent->files.addPiece(std::move(*piece));
+		picker.removePiece(piece->index);
+
+		for (auto it = deadlines.begin(); it != deadlines.end(); it++)
+		{
+			if (it->idx == piece->index)
+			{
+				if (!it->missed)
+				{
+					if (it->time < std::chrono::steady_clock::now())
+						streamingStats.missedDeadlines++;
+					else
+						streamingStats.metDeadlines++;
+				}
 
-	for (auto it = requests.begin(); it != requests.end(); it++)
+				deadlines.erase(it);
+				deadlinesChanged();
+				break;
+			}
+		}
+	}
+
+	for (auto it = verifyingPieces.begin(); it != verifyingPieces.end(); it++)
 	{
-		if (it->pieceIdx == r->pieceIdx)
+		if (*it == piece)
 		{
-			DL_LOG("Request rem " << r->pieceIdx);
-			requests.erase(it);
+			verifyingPieces.erase(it);
+			requests.verified(piece->index);
 			break;
 		}
 	}
 
-	return valid;
+	updateStats();
+
+	if (onPieceVerified)
+		onPieceVerified(piece->index, valid, source);
 }
 
-void mtt::Downloader::onFinish()
+mtt::VerificationInfo mtt::Downloader::getVerificationInfo()
 {
-	torrent->files.storage.flush();
+	std::lock_guard<std::mutex> guard(verifyMutex);
+
+	VerificationInfo info = verifyStats;
+
+	if (verifyStats.verifiedPieces)
+		info.averageVerifyTime = (uint32_t)(verifyTime / verifyStats.verifiedPieces / 1000);
+
+	if (verifyTime)
+		info.throughput = (size_t)(verifiedBytes * 1000000 / verifyTime);
+
+	return info;
 }
+
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "Storage.h"
+#include "PiecesPicker.h"
+#include "PieceRequestsTable.h"
 #include "IPeerListener.h"
 #include "LogFile.h"
+#include <unordered_map>
+#include <list>
 
 namespace mtt
 {
@@ -19,61 +23,161 @@ namespace mtt
 		size_t downloaded = 0;
 		size_t uploaded = 0;
 
+		struct RequestedBlock
+		{
+			uint32_t begin;
+			std::chrono::steady_clock::time_point time;
+		};
 		struct RequestedPiece
 		{
 			uint32_t idx;
-			std::vector<uint32_t> blocks;
+			std::vector<RequestedBlock> blocks;
+
+			bool hasBlock(uint32_t begin) const;
+			void addBlock(uint32_t begin);
+			bool removeBlock(uint32_t begin);
+			void clearBlocks();
+
+			//bit of each block in blocks
+			std::vector<uint64_t> blocksMask;
 		};
 		std::vector<RequestedPiece> requestedPieces;
 
 		uint32_t receivedBlocks = 0;
 		uint32_t invalidPieces = 0;
+
+		//ms, smoothed and lowest recent request round trip
+		uint32_t requestRtt = 0;
+		uint32_t minRequestRtt = 0;
+		uint32_t requestQueueDepth = 0;
+
+		//deadlines state last evaluated by peer
+		uint32_t deadlinesVersion = 0;
 	};
 
+	//used only from torrent strand, except getters of stats and verification
 	class Downloader
 	{
 	public:
 
 		Downloader(TorrentPtr);
 
-		enum PieceStatus {Ok, Invalid, Finished};
-		PieceStatus pieceBlockReceived(PieceBlock& block);
-		void removeBlockRequests(std::vector<ActivePeer>& peers, PieceBlock& block, PieceStatus status, PeerCommunication* source);
+		enum PieceStatus {Ok, Finished};
+		//finished piece is verified asynchronously, result comes with onPieceVerified on torrent strand
+		PieceStatus pieceBlockReceived(PieceBlockView& block, PeerCommunication* source);
+		std::function<void(uint32_t pieceIdx, bool valid, PeerCommunication* source)> onPieceVerified;
+		//requests of block or finished piece are removed from peers holding the piece
+		void removeBlockRequests(ActivePeer* sourcePeer, PieceBlockView& block, PieceStatus status, PeerCommunication* source);
+		//fast extension reject, block can be requested again
+		void blockRejected(ActivePeer*, PieceBlockInfo& block);
 		void evaluateNextRequests(ActivePeer*);
 		void unchokePeer(ActivePeer*);
+		//outstanding requests of peer can be requested elsewhere
+		void peerRemoved(ActivePeer*);
+		//choke without fast extension discards all requests of peer
+		void peerChoked(ActivePeer*);
+		//requests without response for too long are released for other peers, returns true if any was released
+		bool releaseStalledRequests(ActivePeer*);
 
 		void reset();
-		void sortPriorityByAvailability(const std::vector<uint32_t>& availability);
-		void sortPriority(const std::vector<Priority>& priority);
-
+		//wanted pieces are picked again in order of priority and availability
+		void setPiecesPriority(const std::vector<Priority>& priority);
+		void pieceAvailable(uint32_t idx);
+		void piecesAvailable(const PiecesProgress& peerPieces);
+		void piecesUnavailable(const PiecesProgress& peerPieces);
+
+		//pieces with deadline are requested first from fastest peers, blocks are requested again from other peers when deadline is close
+		void setDeadline(uint32_t pieceIdx, std::chrono::steady_clock::time_point time);
+		//replaces all deadlines
+		void setDeadlines(const std::vector<std::pair<uint32_t, std::chrono::steady_clock::time_point>>& pieces);
+		void clearDeadlines();
+		//called every second with measured peers, returns true if peers should pick pieces again
+		bool updateDeadlines(const std::list<ActivePeer>& peers);
+
+		//state published with updateStats
 		std::vector<uint32_t> getCurrentRequests();
 		uint32_t getCurrentRequestsCount();
-
 		size_t getUnfinishedPiecesDownloadSize();
+		EndgameInfo getEndgameInfo();
+		StreamingInfo getStreamingInfo();
+		void updateStats();
+
+		VerificationInfo getVerificationInfo();
+
+		bool writeQueueLimited = false;
 
 	private:
 
-		std::vector<uint32_t> piecesPriority;
-		std::mutex priorityMutex;
+		PiecesPicker picker;
+		//reused mask of pieces wanted from evaluated peer
+		std::vector<uint64_t> wantedFromPeer;
+
+		PieceRequestsTable requests;
+
+		bool isEndgame();
+		void releaseBlockRequest(uint32_t pieceIdx, uint32_t blockBegin);
 
-		struct RequestInfo
+		EndgameInfo endgameStats;
+
+		struct PieceDeadline
 		{
-			uint32_t pieceIdx = 0;
-			std::shared_ptr<DownloadedPiece> piece;
-			uint16_t nextBlockRequestIdx = 0;
-			uint16_t blocksCount = 0;
-			uint32_t receivedSize = 0;
+			uint32_t idx;
+			std::chrono::steady_clock::time_point time;
+			bool missed = false;
+			//about to be missed with current holders
+			bool critical = false;
 		};
-		std::vector<RequestInfo> requests;
-		std::mutex requestsMutex;
+		//sorted by time
+		std::vector<PieceDeadline> deadlines;
+		//increased when peers should pick deadline pieces again
+		uint32_t deadlinesVersion = 1;
+		void addDeadline(uint32_t pieceIdx, std::chrono::steady_clock::time_point time);
+		bool isDeadlineClose(const PieceDeadline&, std::chrono::steady_clock::time_point now);
+		void deadlinesChanged();
+
+		//deadline pieces left to fastest peers
+		std::vector<uint64_t> reservedPieces;
+		//deadline pieces requested also from other peers
+		std::vector<uint64_t> criticalPieces;
+		//lowest download speed of fastest quarter of peers
+		uint32_t fastPeerSpeed = 0;
+		void addDeadlinePieces(ActivePeer*);
+
+		StreamingInfo streamingStats;
+
+		struct
+		{
+			std::vector<uint32_t> requests;
+			size_t unfinishedSize = 0;
+			EndgameInfo endgame;
+			StreamingInfo streaming;
+		}
+		stats;
+		std::mutex statsMutex;
+
+		//peers with piece in their requested pieces
+		std::unordered_map<uint32_t, std::vector<ActivePeer*>> pieceHolders;
+		void addPieceHolder(ActivePeer*, uint32_t pieceIdx);
+		void removePieceHolder(ActivePeer*, uint32_t pieceIdx);
 
 		std::vector<uint32_t> getBestNextPieces(ActivePeer*);
 		void sendPieceRequests(ActivePeer*);
-		uint32_t sendPieceRequests(ActivePeer*,ActivePeer::RequestedPiece*, RequestInfo*, uint32_t max);
-		bool pieceFinished(RequestInfo*);
+		uint32_t sendPieceRequests(ActivePeer*,ActivePeer::RequestedPiece*, PieceRequest*, uint32_t max, bool endgame);
+		uint32_t getRequestQueueDepth(ActivePeer*);
+		void updateRequestRtt(ActivePeer&, ActivePeer::RequestedPiece&, uint32_t blockBegin);
+		void pieceFinished(PieceRequest*, PeerCommunication* source);
+
+		//finished pieces waiting for hash check, not requested again meanwhile
+		std::vector<std::shared_ptr<DownloadedPiece>> verifyingPieces;
+		void pieceVerified(std::shared_ptr<DownloadedPiece>, bool valid, PeerCommunication* source, uint32_t generation);
+		//increased by reset, results of verifications started before are dropped
+		uint32_t resetGeneration = 0;
+
+		VerificationInfo verifyStats;
+		uint64_t verifiedBytes = 0;
+		uint64_t verifyTime = 0;
+		std::mutex verifyMutex;
 
 		TorrentPtr torrent;
-
-		void onFinish();
 	};
 }
@@ -79,7 +79,7 @@ namespace mtt
 
 			void sendHandshake();
 
-			MessageType load(char id, DataBuffer& data);
+			MessageType load(char id, const BufferView& data);
 			DataBuffer createExtendedHandshakeMessage(bool enablePex = true, uint16_t metadataSize = 0);
 
 			std::shared_ptr<TcpAsyncStream> stream;
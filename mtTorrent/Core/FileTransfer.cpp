@@ -7,14 +7,21 @@
 #include "utils/ScheduledTimer.h"
 #include "utils/FastIpToCountry.h"
 #include <fstream>
+#include <future>
 
 FastIpToCountry ipToCountry;
 bool ipToCountryLoaded = false;
 
+//pieces ahead of read cursor getting deadlines
+const uint32_t StreamingReadaheadMs = 30000;
+const size_t MaxStreamingPieces = 64;
+
 mtt::FileTransfer::FileTransfer(TorrentPtr t) : downloader(t), uploader(t), torrent(t)
 {
 	log.init("download");
 
+	downloader.onPieceVerified = [this](uint32_t pieceIdx, bool valid, PeerCommunication* source) { pieceVerified(pieceIdx, valid, source); };
+
 	if (!ipToCountryLoaded)
 	{
 		ipToCountryLoaded = true;
@@ -24,60 +31,95 @@ mtt::FileTransfer::FileTransfer(TorrentPtr t) : downloader(t), uploader(t), torr
 
 void mtt::FileTransfer::start()
 {
-	piecesAvailability.resize(torrent->infoFile.info.pieces.size());
-	updatePiecesPriority();
-	downloader.reset();
+	started = true;
 
-	torrent->peers->start([this](Status s, mtt::PeerSource)
+	torrent->strand->post([this]()
 		{
-			if (s == Status::Success)
-			{
-				evaluateCurrentPeers();
-			}
-		}
-	, this);
+			downloader.reset();
+			updatePiecesPriority();
 
-	refreshTimer = ScheduledTimer::create(torrent->service.io, [this]
-		{
-			evalCurrentPeers();
-			updateMeasures();
+			torrent->peers->start([this](Status s, mtt::PeerSource)
+				{
+					if (s == Status::Success)
+					{
+						evaluateCurrentPeers();
+					}
+				}
+			, this);
 
-			refreshTimer->schedule(1);
-		}
-	);
+			refreshTimer = ScheduledTimer::create(torrent->service.io, torrent->strand->wrap([this]
+				{
+					evalCurrentPeers();
+					updateMeasures();
+
+					if (downloader.writeQueueLimited && !torrent->files.storage.isWriteQueueFull())
+					{
+						downloader.writeQueueLimited = false;
+						reevaluate();
+					}
 
-	refreshTimer->schedule(1);
+					refreshTimer->schedule(1);
+				}
+			));
+
+			refreshTimer->schedule(1);
+		});
 }
 
 void mtt::FileTransfer::stop()
 {
 	saveLogEvents();
 
-	{
-		std::lock_guard<std::mutex> guard(peersMutex);
-		activePeers.clear();
-	}
-
 	torrent->peers->stop();
-	downloader.reset();
-	torrent->files.storage.flush();
 
-	if(refreshTimer)
-		refreshTimer->disable();
+	//wait until events being handled finish, torrent service is stopped next
+	//from session service handler other than strand this could block the only worker needed to run it
+	std::promise<void> stopped;
+	runOnStrand([this, &stopped]()
+		{
+			for (auto& peer : activePeers)
+				downloader.peerRemoved(&peer);
+			activePeers.clear();
+			activePeersIndex.clear();
+
+			downloader.reset();
+
+			if (refreshTimer)
+				refreshTimer->disable();
+
+			{
+				std::lock_guard<std::mutex> guard(statsMutex);
+				peersStats.clear();
+			}
+
+			stopped.set_value();
+		});
+	stopped.get_future().wait();
+
+	started = false;
+	torrent->files.storage.flush();
 }
 
 void mtt::FileTransfer::reevaluate()
 {
-	std::lock_guard<std::mutex> guard(peersMutex);
-	for(auto& p : activePeers)
-		downloader.evaluateNextRequests(&p);
+	runOnStrand([this]()
+		{
+			for (auto& p : activePeers)
+				downloader.evaluateNextRequests(&p);
+		});
 }
 
 void mtt::FileTransfer::handshakeFinished(PeerCommunication* p)
 {
 	LOG_APPEND("handshake " << p->getAddressName());
-	if (!torrent->files.progress.empty())
-		p->sendBitfield(torrent->files.progress.toBitfield());
+	auto& progress = torrent->files.progress;
+
+	if (p->info.supportsFastExtension() && progress.hasAll())
+		p->sendHaveAll();
+	else if (!progress.empty())
+		p->sendBitfield(progress.toBitfield());
+	else
+		p->sendHaveNone();
 
 	addPeer(p);
 }
@@ -85,6 +127,7 @@ void mtt::FileTransfer::handshakeFinished(PeerCommunication* p)
 void mtt::FileTransfer::connectionClosed(PeerCommunication* p, int code)
 {
 	LOG_APPEND("closed " << p->getAddressName());
+	downloader.piecesUnavailable(p->info.pieces);
 	removePeer(p);
 }
 
@@ -96,25 +139,42 @@ void mtt::FileTransfer::messageReceived(PeerCommunication* p, PeerMessage& msg)
 	{
 		LOG_APPEND("piece " << msg.piece.info.index << " " << msg.piece.info.begin << " " << p->getAddressName());
 
-		auto status = downloader.pieceBlockReceived(msg.piece);
+		auto status = downloader.pieceBlockReceived(msg.piece, p);
 
-		std::lock_guard<std::mutex> guard(peersMutex);
-		downloader.removeBlockRequests(activePeers, msg.piece, status, p);
+		auto peer = getActivePeer(p);
+		downloader.removeBlockRequests(peer, msg.piece, status, p);
 
-		if (auto peer = getActivePeer(p))
+		if (peer)
 		{
 			peer->lastActivityTime = (uint32_t)time(0);
 		}
 	}
 	else if (msg.id == Unchoke)
 	{
-		std::lock_guard<std::mutex> guard(peersMutex);
 		if (auto peer = getActivePeer(p))
 		{
 			downloader.unchokePeer(peer);
 			peer->lastActivityTime = (uint32_t)time(0);
 		}
 	}
+	else if (msg.id == Choke)
+	{
+		if (auto peer = getActivePeer(p))
+			downloader.peerChoked(peer);
+	}
+	else if (msg.id == Reject)
+	{
+		if (auto peer = getActivePeer(p))
+		{
+			downloader.blockRejected(peer, msg.request);
+			peer->lastActivityTime = (uint32_t)time(0);
+		}
+	}
+	else if (msg.id == AllowedFast || msg.id == Suggest)
+	{
+		if (auto peer = getActivePeer(p))
+			downloader.evaluateNextRequests(peer);
+	}
 	else if (msg.id == Interested)
 	{
 		uploader.isInterested(p);
@@ -123,7 +183,6 @@ void mtt::FileTransfer::messageReceived(PeerCommunication* p, PeerMessage& msg)
 	{
 		if (uploader.pieceRequest(p, msg.request))
 		{
-			std::lock_guard<std::mutex> guard(peersMutex);
 			if (auto peer = getActivePeer(p))
 				peer->uploaded += msg.request.length;
 		}
@@ -145,16 +204,9 @@ void mtt::FileTransfer::pexReceived(PeerCommunication*, ext::PeerExchange::Messa
 void mtt::FileTransfer::progressUpdated(PeerCommunication* p, uint32_t idx)
 {
 	if (idx != -1)
-		piecesAvailability[idx]++;
+		downloader.pieceAvailable(idx);
 	else
-	{
-		auto& peerPieces = p->info.pieces.pieces;
-
-		for(size_t i = 0; i < piecesAvailability.size(); i++)
-		{
-			piecesAvailability[i] += peerPieces[i] ? 1 : 0;
-		}
-	}
+		downloader.piecesAvailable(p->info.pieces);
 
 	evaluateNextRequests(p);
 }
@@ -168,8 +220,8 @@ size_t mtt::FileTransfer::getDownloadSpeed()
 {
 	size_t sum = 0;
 
-	std::lock_guard<std::mutex> guard(peersMutex);
-	for (auto& peer : activePeers)
+	std::lock_guard<std::mutex> guard(statsMutex);
+	for (auto& peer : peersStats)
 		sum += peer.downloadSpeed;
 
 	return sum;
@@ -179,8 +231,8 @@ size_t mtt::FileTransfer::getUploadSpeed()
 {
 	size_t sum = 0;
 
-	std::lock_guard<std::mutex> guard(peersMutex);
-	for (auto& peer : activePeers)
+	std::lock_guard<std::mutex> guard(statsMutex);
+	for (auto& peer : peersStats)
 		sum += peer.uploadSpeed;
 
 	return sum;
@@ -198,7 +250,7 @@ std::vector<mtt::ActivePeerInfo> mtt::FileTransfer::getPeersInfo()
 	std::vector<mtt::ActivePeerInfo> out;
 	out.resize(allPeers.size());
 
-	std::lock_guard<std::mutex> guard(peersMutex);
+	std::lock_guard<std::mutex> guard(statsMutex);
 
 	uint32_t i = 0;
 	for (auto& comm : allPeers)
@@ -209,12 +261,14 @@ std::vector<mtt::ActivePeerInfo> mtt::FileTransfer::getPeersInfo()
 		out[i].percentage = comm->info.pieces.getPercentage();
 		out[i].client = comm->ext.state.client;
 
-		for (auto& active : activePeers)
+		for (auto& active : peersStats)
 		{
 			if (active.comm == comm.get())
 			{
 				out[i].downloadSpeed = active.downloadSpeed;
 				out[i].uploadSpeed = active.uploadSpeed;
+				out[i].requestRtt = active.requestRtt;
+				out[i].requestQueueDepth = active.requestQueueDepth;
 			}
 		}
 
@@ -234,69 +288,162 @@ uint32_t mtt::FileTransfer::getCurrentRequestsCount()
 	return downloader.getCurrentRequestsCount();
 }
 
-void mtt::FileTransfer::updatePiecesPriority()
+mtt::WriteQueueInfo mtt::FileTransfer::getWriteQueueInfo()
 {
-	piecesPriority.resize(torrent->infoFile.info.pieces.size(), Priority(0));
+	return torrent->files.storage.getWriteQueueInfo();
+}
 
-	for (auto& f : torrent->files.selection.files)
-	{
-		for (size_t i = f.info.startPieceIndex; i < f.info.endPieceIndex; i++)
-		{
-			piecesPriority[i] = std::max(piecesPriority[i], f.priority);
-		}
-	}
+mtt::VerificationInfo mtt::FileTransfer::getVerificationInfo()
+{
+	return downloader.getVerificationInfo();
 }
 
-mtt::ActivePeer* mtt::FileTransfer::getActivePeer(PeerCommunication* p)
+mtt::EndgameInfo mtt::FileTransfer::getEndgameInfo()
 {
-	for (auto& peer : activePeers)
-		if (peer.comm == p)
-			return &peer;
+	return downloader.getEndgameInfo();
+}
 
-	return nullptr;
+mtt::StreamingInfo mtt::FileTransfer::getStreamingInfo()
+{
+	return downloader.getStreamingInfo();
 }
 
-void mtt::FileTransfer::addPeer(PeerCommunication* p)
+void mtt::FileTransfer::setReadCursor(uint32_t fileIdx, uint64_t offset, uint32_t bytesPerSecond)
 {
-	std::lock_guard<std::mutex> guard(peersMutex);
-	bool found = false;
-	for (auto& peer : activePeers)
+	auto& info = torrent->infoFile.info;
+
+	if (fileIdx >= info.files.size() || info.pieceSize == 0)
+		return;
+
+	auto& file = info.files[fileIdx];
+	uint64_t fileStart = (uint64_t)file.startPieceIndex * info.pieceSize + file.startPiecePos;
+	uint64_t position = fileStart + offset;
+	uint64_t fileEnd = fileStart + file.size;
+
+	//consumer keeps up with download
+	uint64_t rate = bytesPerSecond ? bytesPerSecond : getDownloadSpeed();
+	rate = std::max<uint64_t>(rate, 1);
+
+	std::vector<std::pair<uint32_t, std::chrono::steady_clock::time_point>> deadlines;
+	auto now = std::chrono::steady_clock::now();
+
+	for (uint64_t pieceStart = position - position % info.pieceSize; pieceStart < fileEnd && deadlines.size() < MaxStreamingPieces; pieceStart += info.pieceSize)
 	{
-		if (peer.comm == p)
-		{
-			found = true;
+		//time when reading gets to piece
+		uint64_t ms = pieceStart > position ? (pieceStart - position) * 1000 / rate : 0;
+		if (ms > StreamingReadaheadMs)
 			break;
-		}
+
+		deadlines.push_back({ (uint32_t)(pieceStart / info.pieceSize), now + std::chrono::milliseconds(ms) });
 	}
 
-	if (!found)
+	runOnStrand([this, deadlines]()
+		{
+			downloader.setDeadlines(deadlines);
+
+			for (auto& p : activePeers)
+				downloader.evaluateNextRequests(&p);
+		});
+}
+
+void mtt::FileTransfer::setPieceDeadline(uint32_t pieceIdx, uint32_t ms)
+{
+	auto time = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+
+	runOnStrand([this, pieceIdx, time]()
+		{
+			downloader.setDeadline(pieceIdx, time);
+
+			for (auto& p : activePeers)
+				downloader.evaluateNextRequests(&p);
+		});
+}
+
+void mtt::FileTransfer::clearPieceDeadlines()
+{
+	runOnStrand([this]()
+		{
+			downloader.clearDeadlines();
+		});
+}
+
+void mtt::FileTransfer::updatePiecesPriority()
+{
+	runOnStrand([this]()
+		{
+			piecesPriority.assign(torrent->infoFile.info.pieces.size(), Priority(0));
+
+			for (auto& f : torrent->files.selection.files)
+			{
+				for (size_t i = f.info.startPieceIndex; i <= f.info.endPieceIndex; i++)
+				{
+					piecesPriority[i] = std::max(piecesPriority[i], f.priority);
+				}
+			}
+
+			downloader.setPiecesPriority(piecesPriority);
+		});
+}
+
+void mtt::FileTransfer::runOnStrand(std::function<void()> f)
+{
+	if (started)
+		torrent->strand->dispatch(std::move(f));
+	else
+		f();
+}
+
+mtt::ActivePeer* mtt::FileTransfer::getActivePeer(PeerCommunication* p)
+{
+	auto it = activePeersIndex.find(p);
+	if (it == activePeersIndex.end())
+		return nullptr;
+
+	return &*it->second;
+}
+
+void mtt::FileTransfer::addPeer(PeerCommunication* p)
+{
+	if (activePeersIndex.find(p) == activePeersIndex.end())
 	{
 		activePeers.push_back({ p,{} });
+		activePeersIndex[p] = std::prev(activePeers.end());
 		activePeers.back().connectionTime = activePeers.back().lastActivityTime = (uint32_t)time(0);
+		//peers connected before transfer start, like during metadata download, already have pieces
+		downloader.piecesAvailable(p->info.pieces);
 		downloader.evaluateNextRequests(&activePeers.back());
 	}
 }
 
 void mtt::FileTransfer::evaluateNextRequests(PeerCommunication* p)
 {
-	std::lock_guard<std::mutex> guard(peersMutex);
 	if (auto peer = getActivePeer(p))
 		downloader.evaluateNextRequests(peer);
 }
 
+void mtt::FileTransfer::pieceVerified(uint32_t pieceIdx, bool valid, PeerCommunication* source)
+{
+	LOG_APPEND("verified " << pieceIdx << " " << valid);
+
+	if (valid)
+		return;
+
+	//invalid piece is wanted again
+	if (auto peer = getActivePeer(source))
+		peer->invalidPieces++;
+
+	for (auto& peer : activePeers)
+		downloader.evaluateNextRequests(&peer);
+}
+
 void mtt::FileTransfer::removePeer(PeerCommunication * p)
 {
+	auto it = activePeersIndex.find(p);
+	if (it != activePeersIndex.end())
 	{
-		std::lock_guard<std::mutex> guard(peersMutex);
-
-		for (auto it = activePeers.begin(); it != activePeers.end(); it++)
-		{
-			if (it->comm == p)
-			{
-				activePeers.erase(it);
-				break;
-			}
-		}
+		downloader.peerRemoved(&*it->second);
+		activePeers.erase(it->second);
+		activePeersIndex.erase(it);
 	}
 
 	evaluateCurrentPeers();
@@ -306,7 +453,10 @@ void mtt::FileTransfer::removePeers(std::vector<uint32_t> sortedIdx)
 {
 	for (auto it = sortedIdx.rbegin(); it != sortedIdx.rend(); it++)
 	{
-		activePeers.erase(activePeers.begin() + *it);
+		auto peer = std::next(activePeers.begin(), *it);
+		downloader.peerRemoved(&*peer);
+		activePeersIndex.erase(peer->comm);
+		activePeers.erase(peer);
 	}
 }
 
@@ -326,113 +476,114 @@ void mtt::FileTransfer::evalCurrentPeers()
 	peersEvalCounter = peersEvalInterval;
 
 	std::vector<uint32_t> removedPeers;
-	{
-		std::lock_guard<std::mutex> guard(peersMutex);
 
-		uint32_t currentTime = (uint32_t)::time(0);
+	uint32_t currentTime = (uint32_t)::time(0);
 
 #ifdef PEER_DIAGNOSTICS
-		std::lock_guard<std::mutex> guardLog(logmtx);
-		logEvals.push_back({ clock(), (uint32_t)activePeers.size() });
+	std::lock_guard<std::mutex> guardLog(logmtx);
+	logEvals.push_back({ clock(), (uint32_t)activePeers.size() });
 
-		size_t logStartIdx = logEvalPeers.size();
+	size_t logStartIdx = logEvalPeers.size();
 
-		if (activePeers.size())
-		{
-			logEvalPeers.resize(logEvalPeers.size() + activePeers.size());
+	if (activePeers.size())
+	{
+		logEvalPeers.resize(logEvalPeers.size() + activePeers.size());
 
-			size_t idx = logStartIdx;
-			for (auto peer : activePeers)
-			{
-				logEvalPeers[idx].addr = peer.comm->getAddress();
-				logEvalPeers[idx].dl = peer.downloadSpeed;
-				logEvalPeers[idx].up = peer.uploadSpeed;
-				logEvalPeers[idx].activityTime = currentTime - peer.lastActivityTime;
-				idx++;
-			}
+		size_t idx = logStartIdx;
+		for (auto peer : activePeers)
+		{
+			logEvalPeers[idx].addr = peer.comm->getAddress();
+			logEvalPeers[idx].dl = peer.downloadSpeed;
+			logEvalPeers[idx].up = peer.uploadSpeed;
+			logEvalPeers[idx].activityTime = currentTime - peer.lastActivityTime;
+			idx++;
 		}
+	}
 #endif
 
-		if ((uint32_t)activePeers.size() < mtt::config::getExternal().connection.maxTorrentConnections)
-		{
-			return;
-		}
+	if ((uint32_t)activePeers.size() < mtt::config::getExternal().connection.maxTorrentConnections)
+	{
+		return;
+	}
 
-		const uint32_t minPeersTimeChance = 10;
-		
-		auto minTimeToEval = currentTime - minPeersTimeChance;
+	const uint32_t minPeersTimeChance = 10;
+	
+	auto minTimeToEval = currentTime - minPeersTimeChance;
 
-		const uint32_t minPeersPiecesTimeChance = 20;
-		auto minTimeToReceive = currentTime - minPeersPiecesTimeChance;
+	const uint32_t minPeersPiecesTimeChance = 20;
+	auto minTimeToReceive = currentTime - minPeersPiecesTimeChance;
 
-		uint32_t slowestSpeed = -1;
-		uint32_t slowestPeer = -1;
+	uint32_t slowestSpeed = -1;
+	uint32_t slowestPeer = -1;
 
-		uint32_t maxUploads = 5;
-		std::vector<uint32_t> currentUploads;
+	uint32_t maxUploads = 5;
+	std::vector<uint32_t> currentUploads;
 
-		uint32_t idx = 0;
-		for (auto peer : activePeers)
+	uint32_t idx = 0;
+	for (auto peer : activePeers)
+	{
+		if (peer.connectionTime > minTimeToEval)
 		{
-			if (peer.connectionTime > minTimeToEval)
-			{
 #ifdef PEER_DIAGNOSTICS
-				logEvalPeers[logStartIdx + idx].action = LogEvalPeer::TooSoon;
+			logEvalPeers[logStartIdx + idx].action = LogEvalPeer::TooSoon;
 #endif
-				continue;
-			}
+			continue;
+		}
 
-			if (peer.comm->state.peerInterested)
-			{
-				currentUploads.push_back(idx);
-			}
+		if (peer.comm->state.peerInterested)
+		{
+			currentUploads.push_back(idx);
+		}
 
-			if (peer.lastActivityTime < minTimeToReceive)
-			{
+		if (peer.lastActivityTime < minTimeToReceive)
+		{
 #ifdef PEER_DIAGNOSTICS
-				logEvalPeers[logStartIdx + idx].action = LogEvalPeer::NotResponding;
+			logEvalPeers[logStartIdx + idx].action = LogEvalPeer::NotResponding;
 #endif
-				removedPeers.push_back(idx);
-				continue;
-			}
-
-			if (peer.downloadSpeed < slowestSpeed)
-			{
-				slowestSpeed = peer.downloadSpeed;
-				slowestPeer = idx;
-			}
-
-			idx++;
+			removedPeers.push_back(idx);
+			continue;
 		}
 
-		if (removedPeers.empty() && slowestPeer != -1)
+		if (peer.downloadSpeed < slowestSpeed)
 		{
+			slowestSpeed = peer.downloadSpeed;
+			slowestPeer = idx;
+		}
+
+		idx++;
+	}
+
+	if (removedPeers.empty() && slowestPeer != -1)
+	{
 #ifdef PEER_DIAGNOSTICS
-			logEvalPeers[logStartIdx + idx].action = LogEvalPeer::TooSlow;
+		logEvalPeers[logStartIdx + idx].action = LogEvalPeer::TooSlow;
 #endif
-			removedPeers.push_back(slowestPeer);
-		}
+		removedPeers.push_back(slowestPeer);
+	}
 
-		if (!currentUploads.empty())
-		{
-			std::sort(currentUploads.begin(), currentUploads.end(), [&](const auto & l, const auto & r) { return activePeers[l].uploadSpeed > activePeers[r].uploadSpeed; });
-			currentUploads.resize(std::min((uint32_t)currentUploads.size(), maxUploads));
+	if (!currentUploads.empty())
+	{
+		std::vector<uint32_t> uploadSpeeds;
+		for (auto& peer : activePeers)
+			uploadSpeeds.push_back(peer.uploadSpeed);
 
-			for (auto idx : currentUploads)
-			{
-				auto it = std::find(removedPeers.begin(), removedPeers.end(), idx);
-				if (it != removedPeers.end())
-					removedPeers.erase(it);
+		std::sort(currentUploads.begin(), currentUploads.end(), [&](const auto & l, const auto & r) { return uploadSpeeds[l] > uploadSpeeds[r]; });
+		currentUploads.resize(std::min((uint32_t)currentUploads.size(), maxUploads));
+
+		for (auto idx : currentUploads)
+		{
+			auto it = std::find(removedPeers.begin(), removedPeers.end(), idx);
+			if (it != removedPeers.end())
+				removedPeers.erase(it);
 
 #ifdef PEER_DIAGNOSTICS
-				logEvalPeers[logStartIdx + idx].action = LogEvalPeer::Upload;
+			logEvalPeers[logStartIdx + idx].action = LogEvalPeer::Upload;
 #endif
-			}
 		}
-
-		removePeers(removedPeers);
 	}
 
+	removePeers(removedPeers);
+
 	evaluateCurrentPeers();
 }
 
@@ -441,41 +592,53 @@ void mtt::FileTransfer::updateMeasures()
 	auto& freshPieces = torrent->files.freshPieces;
 	std::vector<std::pair<PeerCommunication*, std::pair<size_t, size_t>>> currentMeasure;
 
+	for (auto& peer : activePeers)
 	{
-		std::lock_guard<std::mutex> guard(peersMutex);
-		for (auto& peer : activePeers)
-		{
-			peer.downloaded = peer.comm->getReceivedDataCount();
-			currentMeasure.push_back({ peer.comm, {peer.downloaded, peer.uploaded} });
-			peer.downloadSpeed = 0;
-			peer.uploadSpeed = 0;
+		peer.downloaded = peer.comm->getReceivedDataCount();
+		currentMeasure.push_back({ peer.comm, {peer.downloaded, peer.uploaded} });
+		peer.downloadSpeed = 0;
+		peer.uploadSpeed = 0;
 
-			for (auto last : lastSpeedMeasure)
+		for (auto last : lastSpeedMeasure)
+		{
+			if (last.first == peer.comm)
 			{
-				if (last.first == peer.comm)
-				{
-					if (peer.downloaded > last.second.first)
-						peer.downloadSpeed = (uint32_t)(peer.downloaded - last.second.first);
-					if (peer.uploaded > last.second.second)
-						peer.uploadSpeed = (uint32_t)(peer.uploaded - last.second.second);
+				if (peer.downloaded > last.second.first)
+					peer.downloadSpeed = (uint32_t)(peer.downloaded - last.second.first);
+				if (peer.uploaded > last.second.second)
+					peer.uploadSpeed = (uint32_t)(peer.uploaded - last.second.second);
 
-					break;
-				}
+				break;
 			}
-
-			for (auto& piece : freshPieces)
-				if (peer.comm->isEstablished())
-					peer.comm->sendHave(piece);
 		}
+
+		for (auto& piece : freshPieces)
+			if (peer.comm->isEstablished())
+				peer.comm->sendHave(piece);
 	}
 	freshPieces.clear();
 	lastSpeedMeasure = currentMeasure;
 
-	if (!torrent->selectionFinished())
+	//blocks held by unresponsive peers
+	bool releasedRequests = false;
+	for (auto& peer : activePeers)
+		releasedRequests |= downloader.releaseStalledRequests(&peer);
+
+	//closer deadlines or changed speeds of peers
+	if (downloader.updateDeadlines(activePeers) || releasedRequests)
 	{
-		downloader.sortPriorityByAvailability(piecesAvailability);
-		downloader.sortPriority(piecesPriority);
+		for (auto& peer : activePeers)
+			downloader.evaluateNextRequests(&peer);
 	}
+
+	{
+		std::lock_guard<std::mutex> guard(statsMutex);
+		peersStats.clear();
+		for (auto& peer : activePeers)
+			peersStats.push_back({ peer.comm, peer.downloadSpeed, peer.uploadSpeed, peer.requestRtt, peer.requestQueueDepth });
+	}
+
+	downloader.updateStats();
 }
 
 #ifdef PEER_DIAGNOSTICS
@@ -7,9 +7,13 @@
 #include "utils/ScheduledTimer.h"
 #include "LogFile.h"
 #include "Api/FileTransfer.h"
+#include <list>
+#include <unordered_map>
+#include <atomic>
 
 namespace mtt
 {
+	//peer events and transfer state are handled on torrent strand, api getters read stats published from it
 	class FileTransfer : public mttApi::FileTransfer, public IPeerListener
 	{
 	public:
@@ -17,6 +21,7 @@ namespace mtt
 		FileTransfer(TorrentPtr);
 
 		void start();
+		//blocks until torrent strand is idle, call only from api threads, never from session service handlers
 		void stop();
 
 		void reevaluate();
@@ -40,8 +45,17 @@ namespace mtt
 		std::vector<uint32_t> getCurrentRequests();
 		uint32_t getCurrentRequestsCount();
 
+		WriteQueueInfo getWriteQueueInfo();
+		VerificationInfo getVerificationInfo();
+		EndgameInfo getEndgameInfo();
+		StreamingInfo getStreamingInfo();
+
 		void updatePiecesPriority();
 
+		void setReadCursor(uint32_t fileIdx, uint64_t offset, uint32_t bytesPerSecond);
+		void setPieceDeadline(uint32_t pieceIdx, uint32_t ms);
+		void clearPieceDeadlines();
+
 	private:
 
 #ifdef PEER_DIAGNOSTICS
@@ -69,17 +83,36 @@ namespace mtt
 		void saveLogEvents() {}
 #endif
 
-		std::vector<uint32_t> piecesAvailability;
 		std::vector<Priority> piecesPriority;
 
-		std::vector<ActivePeer> activePeers;
-		std::mutex peersMutex;
+		//list keeps peers in place, downloader refers to them
+		std::list<ActivePeer> activePeers;
+		//active peer of each connection, looked up for every received message
+		std::unordered_map<PeerCommunication*, std::list<ActivePeer>::iterator> activePeersIndex;
+
+		//f runs on torrent strand, directly when transfer is stopped
+		void runOnStrand(std::function<void()> f);
+		//set from api thread, read from network threads
+		std::atomic<bool> started{ false };
+
+		struct PeerStats
+		{
+			PeerCommunication* comm;
+			uint32_t downloadSpeed;
+			uint32_t uploadSpeed;
+			uint32_t requestRtt;
+			uint32_t requestQueueDepth;
+		};
+		//measures of active peers, updated every second
+		std::vector<PeerStats> peersStats;
+		std::mutex statsMutex;
 
 		mtt::ActivePeer* getActivePeer(PeerCommunication* p);
 		void addPeer(PeerCommunication*);
 		void removePeer(PeerCommunication*);
 		void evaluateCurrentPeers();
 		void evaluateNextRequests(PeerCommunication*);
+		void pieceVerified(uint32_t pieceIdx, bool valid, PeerCommunication* source);
 
 		std::shared_ptr<ScheduledTimer> refreshTimer;
 
@@ -3,13 +3,14 @@
 #include "utils/TcpAsyncServer.h"
 #include "PeerMessage.h"
 #include "utils/UpnpPortMapping.h"
+#include "utils/UtpManager.h"
 
-mtt::IncomingPeersListener::IncomingPeersListener(std::function<void(std::shared_ptr<TcpAsyncStream>, const uint8_t* hash)> cb)
+mtt::IncomingPeersListener::IncomingPeersListener(ServiceThreadpool& p, std::function<void(std::shared_ptr<TcpAsyncStream>, const uint8_t* hash)> cb) : pool(p)
 {
 	onNewPeer = cb;
-	pool.start(2);
 
 	createListener();
+	updateUtpListener();
 
 	upnpEnabled = mtt::config::getExternal().connection.upnpPortMapping;
 	upnp = std::make_shared<UpnpPortMapping>(pool.io);
@@ -51,6 +52,8 @@ mtt::IncomingPeersListener::IncomingPeersListener(std::function<void(std::shared
 			if (usedPorts.tcp != settings.tcpPort)
 				createListener();
 
+			updateUtpListener();
+
 			usedPorts.tcp = settings.tcpPort;
 			usedPorts.udp = settings.udpPort;
 			upnpEnabled = settings.upnpPortMapping;
@@ -70,6 +73,12 @@ void mtt::IncomingPeersListener::stop()
 		listener = nullptr;
 	}
 
+	if (utpEnabled)
+	{
+		UtpManager::Get().stopListening();
+		utpEnabled = false;
+	}
+
 	std::lock_guard<std::mutex> guard(peersMutex);
 	pendingPeers.clear();
 }
@@ -96,7 +105,36 @@ void mtt::IncomingPeersListener::createListener()
 
 	listener->acceptCallback = [this](std::shared_ptr<TcpAsyncStream> c)
 	{
-		auto sPtr = c.get();
+		addPendingPeer(c);
+	};
+
+	listener->listen();
+}
+
+void mtt::IncomingPeersListener::updateUtpListener()
+{
+	bool enable = mtt::config::getExternal().connection.enableUtp;
+
+	if (enable == utpEnabled)
+		return;
+
+	if (enable)
+		UtpManager::Get().listen(pool.io, [this](std::shared_ptr<UtpStream> c)
+			{
+				addPendingPeer(c);
+			});
+	else
+		UtpManager::Get().stopListening();
+
+	utpEnabled = enable;
+}
+
+void mtt::IncomingPeersListener::addPendingPeer(std::shared_ptr<TcpAsyncStream> c)
+{
+	auto sPtr = c.get();
+
+	{
+		std::lock_guard<std::mutex> guard(c->callbackMutex);
 
 		c->onCloseCallback = [sPtr, this](int)
 		{
@@ -112,12 +150,10 @@ void mtt::IncomingPeersListener::createListener()
 			else if (msg.messageSize == 0)
 				removePeer(sPtr);
 		};
+	}
 
-		std::lock_guard<std::mutex> guard(peersMutex);
-		pendingPeers.push_back(c);
-	};
-
-	listener->listen();
+	std::lock_guard<std::mutex> guard(peersMutex);
+	pendingPeers.push_back(c);
 }
 
 void mtt::IncomingPeersListener::removePeer(TcpAsyncStream* s)
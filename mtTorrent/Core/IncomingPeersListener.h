@@ -11,7 +11,7 @@ namespace mtt
 	{
 	public:
 
-		IncomingPeersListener(std::function<void(std::shared_ptr<TcpAsyncStream>, const uint8_t* hash)> onNewPeer);
+		IncomingPeersListener(ServiceThreadpool& pool, std::function<void(std::shared_ptr<TcpAsyncStream>, const uint8_t* hash)> onNewPeer);
 
 		void stop();
 
@@ -20,6 +20,8 @@ namespace mtt
 	protected:
 
 		void createListener();
+		void updateUtpListener();
+		void addPendingPeer(std::shared_ptr<TcpAsyncStream> stream);
 
 		std::function<void(std::shared_ptr<TcpAsyncStream>, const uint8_t* hash)> onNewPeer;
 
@@ -27,7 +29,7 @@ namespace mtt
 		std::vector<std::shared_ptr<TcpAsyncStream>> pendingPeers;
 
 		std::shared_ptr<TcpAsyncServer> listener;
-		ServiceThreadpool pool;
+		ServiceThreadpool& pool;
 
 		void removePeer(TcpAsyncStream* s);
 		void addPeer(TcpAsyncStream* s, const uint8_t* hash);
@@ -35,6 +37,7 @@ namespace mtt
 
 		std::shared_ptr<UpnpPortMapping> upnp;
 		bool upnpEnabled;
+		bool utpEnabled = false;
 
 		struct UsedPorts
 		{
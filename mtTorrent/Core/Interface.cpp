@@ -10,31 +10,58 @@ using namespace mtt;
 
 bool DownloadedPiece::isValid(const uint8_t* expectedHash)
 {
-	uint8_t hash[SHA_DIGEST_LENGTH];
-	_SHA1((const uint8_t*)data.data(), data.size(), hash);
+	size_t hashedSize = (size_t)hash.size();
 
-	return memcmp(hash, expectedHash, SHA_DIGEST_LENGTH) == 0;
+	if (hashedSize < data.size())
+		hash.update(data.data() + hashedSize, data.size() - hashedSize);
+
+	uint8_t digest[SHA_DIGEST_LENGTH];
+	hash.final(digest);
+	hashedBlocks = 0;
+
+	return memcmp(digest, expectedHash, SHA_DIGEST_LENGTH) == 0;
 }
 
 void mtt::DownloadedPiece::init(uint32_t idx, uint32_t pieceSize, uint32_t blocksCount)
 {
 	data.resize(pieceSize);
 	remainingBlocks = blocksCount;
-	blocksTodo.resize(remainingBlocks, 0);
+	blocksTodo.assign(remainingBlocks, 0);
 	index = idx;
+
+	hash.reset();
+	hashedBlocks = 0;
 }
 
-bool DownloadedPiece::addBlock(PieceBlock& block)
+bool DownloadedPiece::addBlock(const PieceBlockView& block)
 {
 	auto blockIdx = (block.info.begin + 1)/ BlockRequestMaxSize;
 
-	if (blockIdx < blocksTodo.size() && blocksTodo[blockIdx] == 0)
+	if (blockIdx < blocksTodo.size() && blocksTodo[blockIdx] == 0 && (size_t)block.info.begin + block.data.size() <= data.size())
 	{
-		memcpy(&data[0] + block.info.begin, block.data.data(), block.info.length);
+		memcpy(&data[0] + block.info.begin, block.data.data(), block.data.size());
 		blocksTodo[blockIdx] = 1;
 		remainingBlocks--;
+
+		if (blockIdx == hashedBlocks)
+			advanceHash();
+
 		return true;
 	}
 
 	return false;
 }
+
+void DownloadedPiece::advanceHash()
+{
+	while (hashedBlocks < blocksTodo.size() && blocksTodo[hashedBlocks])
+	{
+		size_t offset = (size_t)hashedBlocks * BlockRequestMaxSize;
+
+		if (offset >= data.size())
+			break;
+
+		hash.update(data.data() + offset, std::min<size_t>(BlockRequestMaxSize, data.size() - offset));
+		hashedBlocks++;
+	}
+}
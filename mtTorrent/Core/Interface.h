@@ -4,6 +4,7 @@
 #include "utils\Network.h"
 #include "Public\Status.h"
 #include "Logging.h"
+#include "utils\SHA.h"
 
 #define MT_NAME "mtTorrent 0.9"
 #define MT_HASH_NAME "MT-0-9-"
@@ -22,6 +23,13 @@ namespace mtt
 		DataBuffer data;
 	};
 
+	//block data owned by someone else, e.g. received message
+	struct PieceBlockView
+	{
+		PieceBlockInfo info;
+		BufferView data;
+	};
+
 	struct PieceDownloadInfo
 	{
 		std::vector<PieceBlockInfo> blocksLeft;
@@ -37,8 +45,15 @@ namespace mtt
 		std::vector<uint8_t> blocksTodo;
 
 		void init(uint32_t idx, uint32_t pieceSize, uint32_t blocksCount);
-		bool addBlock(PieceBlock& block);
+		bool addBlock(const PieceBlockView& block);
 		bool isValid(const uint8_t* expectedHash);
+
+	private:
+
+		//hash runs over contiguous prefix of received blocks, rest is hashed in isValid
+		Sha1::Hasher hash;
+		uint32_t hashedBlocks = 0;
+		void advanceHash();
 	};
 
 	struct AnnounceResponse
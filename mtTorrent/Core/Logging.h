@@ -7,6 +7,7 @@ extern void WriteLogImplementation(const char * const,std::stringstream&);
 
 LOG_TYPE(Udp);
 LOG_TYPE(Tcp);
+LOG_TYPE(Utp);
 LOG_TYPE(Test);
 LOG_TYPE(Dht);
 LOG_TYPE(HttpTracker);
@@ -7,13 +7,16 @@
 #define LOG_MGS(x) {}//{std::stringstream ss; ss << x; LogMsg(ss);}
 using namespace mtt;
 
+//bounds of peer provided fast extension lists
+const size_t MaxAllowedFastPieces = 32;
+const size_t MaxSuggestedPieces = 16;
+
 namespace mtt
 {
 	namespace bt
 	{
-		DataBuffer createHandshake(uint8_t* torrentHash, uint8_t* clientHash)
+		void writeHandshake(PacketBuilder& packet, uint8_t* torrentHash, uint8_t* clientHash)
 		{
-			PacketBuilder packet(70);
 			packet.add(19);
 			packet.add("BitTorrent protocol", 19);
 
@@ -23,76 +26,62 @@ namespace mtt
 			if (mtt::config::getExternal().dht.enable)
 				reserved_byte[7] |= 0x80;
 
+			reserved_byte[7] |= 0x04;	//Fast Extension
+
 			packet.add(reserved_byte, 8);
 
 			packet.add(torrentHash, 20);
 			packet.add(clientHash, 20);
-
-			return packet.getBuffer();
 		}
 
-		DataBuffer createStateMessage(PeerMessageId id)
+		void writeStateMessage(PacketBuilder& packet, PeerMessageId id)
 		{
-			PacketBuilder packet(5);
 			packet.add32(1);
 			packet.add(id);
-
-			return packet.getBuffer();
 		}
 
-		DataBuffer createBlockRequest(PieceBlockInfo& block)
+		void writeBlockMessage(PacketBuilder& packet, PeerMessageId id, PieceBlockInfo& block)
 		{
-			PacketBuilder packet(17);
 			packet.add32(13);
-			packet.add(Request);
+			packet.add(id);
 			packet.add32(block.index);
 			packet.add32(block.begin);
 			packet.add32(block.length);
-
-			return packet.getBuffer();
 		}
 
-		DataBuffer createHave(uint32_t idx)
+		void writeHave(PacketBuilder& packet, uint32_t idx)
 		{
-			PacketBuilder packet(9);
 			packet.add32(5);
 			packet.add(Have);
 			packet.add32(idx);
-
-			return packet.getBuffer();
 		}
 
-		DataBuffer createPort(uint16_t port)
+		void writePort(PacketBuilder& packet, uint16_t port)
 		{
-			PacketBuilder packet(9);
 			packet.add32(3);
 			packet.add(Port);
 			packet.add16(port);
-
-			return packet.getBuffer();
 		}
 
-		DataBuffer createBitfield(DataBuffer& bitfield)
+		void writeBitfield(PacketBuilder& packet, DataBuffer& bitfield)
 		{
-			PacketBuilder packet(5 + (uint32_t)bitfield.size());
 			packet.add32(1 + (uint32_t)bitfield.size());
 			packet.add(Bitfield);
 			packet.add(bitfield.data(), bitfield.size());
-
-			return packet.getBuffer();
 		}
 
-		DataBuffer createPiece(PieceBlock& block)
+		void writePieceHeader(PacketBuilder& packet, PieceBlockInfo& info, size_t dataSize)
 		{
-			uint32_t dataSize = 1 + 8 + (uint32_t)block.data.size();
-			PacketBuilder packet(4 + dataSize);
-			packet.add32(dataSize);
+			packet.add32(1 + 8 + (uint32_t)dataSize);
 			packet.add(Piece);
-			packet.add32(block.info.index);
-			packet.add32(block.info.begin);
-			packet.add(block.data.data(), block.data.size());
+			packet.add32(info.index);
+			packet.add32(info.begin);
+		}
 
-			return packet.getBuffer();
+		void writePiece(PacketBuilder& packet, PieceBlock& block)
+		{
+			writePieceHeader(packet, block.info, block.data.size());
+			packet.add(block.data.data(), block.data.size());
 		}
 	}
 }
@@ -113,6 +102,16 @@ bool mtt::PeerInfo::supportsDht()
 	return (protocol[7] & 0x80) != 0;
 }
 
+bool mtt::PeerInfo::supportsFastExtension()
+{
+	return (protocol[7] & 0x04) != 0;
+}
+
+bool mtt::PeerInfo::isAllowedFast(uint32_t index)
+{
+	return std::find(allowedFast.begin(), allowedFast.end(), index) != allowedFast.end();
+}
+
 PeerCommunication::PeerCommunication(TorrentInfo& t, IPeerListener& l) : torrent(t), listener(l)
 {
 }
@@ -122,6 +121,10 @@ PeerCommunication::PeerCommunication(TorrentInfo& t, IPeerListener& l, asio::io_
 	stream = std::make_shared<TcpAsyncStream>(io_service);
 }
 
+PeerCommunication::PeerCommunication(TorrentInfo& t, IPeerListener& l, std::shared_ptr<TcpAsyncStream> s) : torrent(t), listener(l), stream(s)
+{
+}
+
 void mtt::PeerCommunication::setStream(std::shared_ptr<TcpAsyncStream> s)
 {
 	stream = s;
@@ -170,7 +173,7 @@ void mtt::PeerCommunication::sendHandshake()
 	{
 		LOG_MGS("Handshake");
 		state.action = PeerCommunicationState::Handshake;
-		stream->write(mtt::bt::createHandshake(torrent.hash, mtt::config::getInternal().hashId));
+		stream->writeMessage([this](PacketBuilder& packet) { mtt::bt::writeHandshake(packet, torrent.hash, mtt::config::getInternal().hashId); });
 	}
 }
 
@@ -263,7 +266,7 @@ void mtt::PeerCommunication::setInterested(bool enabled)
 	addLogEvent(Want, 0);
 
 	state.amInterested = enabled;
-	stream->write(mtt::bt::createStateMessage(enabled ? Interested : NotInterested));
+	stream->writeMessage([enabled](PacketBuilder& packet) { mtt::bt::writeStateMessage(packet, enabled ? Interested : NotInterested); });
 }
 
 void mtt::PeerCommunication::setChoke(bool enabled)
@@ -277,7 +280,7 @@ void mtt::PeerCommunication::setChoke(bool enabled)
 	addLogEvent(Want, 1);
 	LOG_MGS("Choke");
 	state.amChoking = enabled;
-	stream->write(mtt::bt::createStateMessage(enabled ? Choke : Unchoke));
+	stream->writeMessage([enabled](PacketBuilder& packet) { mtt::bt::writeStateMessage(packet, enabled ? Choke : Unchoke); });
 }
 
 void mtt::PeerCommunication::requestPieceBlock(PieceBlockInfo& pieceInfo)
@@ -288,7 +291,16 @@ void mtt::PeerCommunication::requestPieceBlock(PieceBlockInfo& pieceInfo)
 	addLogEvent(Request, (uint16_t)pieceInfo.index, (char)((float)pieceInfo.begin / (16 * 1024.f)));
 
 	LOG_MGS("Request");
-	stream->write(mtt::bt::createBlockRequest(pieceInfo));
+	stream->writeMessage([&pieceInfo](PacketBuilder& packet) { mtt::bt::writeBlockMessage(packet, PeerMessageId::Request, pieceInfo); });
+}
+
+void mtt::PeerCommunication::sendCancel(PieceBlockInfo& pieceInfo)
+{
+	if (!isEstablished())
+		return;
+
+	LOG_MGS("Cancel");
+	stream->writeMessage([&pieceInfo](PacketBuilder& packet) { mtt::bt::writeBlockMessage(packet, Cancel, pieceInfo); });
 }
 
 bool mtt::PeerCommunication::isEstablished()
@@ -302,7 +314,7 @@ void mtt::PeerCommunication::sendKeepAlive()
 		return;
 
 	LOG_MGS("KeepAlive");
-	stream->write(DataBuffer(4, 0));
+	stream->writeMessage([](PacketBuilder& packet) { packet.add32(0); });
 }
 
 void mtt::PeerCommunication::sendHave(uint32_t pieceIdx)
@@ -311,7 +323,7 @@ void mtt::PeerCommunication::sendHave(uint32_t pieceIdx)
 		return;
 
 	LOG_MGS("Have");
-	stream->write(mtt::bt::createHave(pieceIdx));
+	stream->writeMessage([pieceIdx](PacketBuilder& packet) { mtt::bt::writeHave(packet, pieceIdx); });
 }
 
 void mtt::PeerCommunication::sendPieceBlock(PieceBlock& block)
@@ -320,7 +332,16 @@ void mtt::PeerCommunication::sendPieceBlock(PieceBlock& block)
 		return;
 
 	LOG_MGS("Piece");
-	stream->write(mtt::bt::createPiece(block));
+	stream->writeMessage([&block](PacketBuilder& packet) { mtt::bt::writePiece(packet, block); });
+}
+
+void mtt::PeerCommunication::sendPieceBlock(PieceBlockInfo& info, const BufferView& data, std::shared_ptr<void> dataOwner)
+{
+	if (!isEstablished())
+		return;
+
+	LOG_MGS("Piece");
+	stream->writeMessage([&](PacketBuilder& packet) { mtt::bt::writePieceHeader(packet, info, data.size()); }, data, std::move(dataOwner));
 }
 
 void mtt::PeerCommunication::sendBitfield(DataBuffer& bitfield)
@@ -329,7 +350,34 @@ void mtt::PeerCommunication::sendBitfield(DataBuffer& bitfield)
 		return;
 
 	LOG_MGS("Bitfield");
-	stream->write(mtt::bt::createBitfield(bitfield));
+	stream->writeMessage([&bitfield](PacketBuilder& packet) { mtt::bt::writeBitfield(packet, bitfield); });
+}
+
+void mtt::PeerCommunication::sendHaveAll()
+{
+	if (!isEstablished() || !info.supportsFastExtension())
+		return;
+
+	LOG_MGS("HaveAll");
+	stream->writeMessage([](PacketBuilder& packet) { mtt::bt::writeStateMessage(packet, HaveAll); });
+}
+
+void mtt::PeerCommunication::sendHaveNone()
+{
+	if (!isEstablished() || !info.supportsFastExtension())
+		return;
+
+	LOG_MGS("HaveNone");
+	stream->writeMessage([](PacketBuilder& packet) { mtt::bt::writeStateMessage(packet, HaveNone); });
+}
+
+void mtt::PeerCommunication::sendReject(PieceBlockInfo& block)
+{
+	if (!isEstablished() || !info.supportsFastExtension())
+		return;
+
+	LOG_MGS("Reject");
+	stream->writeMessage([&block](PacketBuilder& packet) { mtt::bt::writeBlockMessage(packet, Reject, block); });
 }
 
 void mtt::PeerCommunication::resetState()
@@ -344,7 +392,7 @@ void mtt::PeerCommunication::sendPort(uint16_t port)
 		return;
 
 	LOG_MGS("Port");
-	stream->write(mtt::bt::createPort(port));
+	stream->writeMessage([port](PacketBuilder& packet) { mtt::bt::writePort(packet, port); });
 }
 
 void mtt::PeerCommunication::handleMessage(PeerMessage& message)
@@ -375,6 +423,31 @@ void mtt::PeerCommunication::handleMessage(PeerMessage& message)
 		LOG_MGS("Received progress: " << info.pieces.getPercentage());
 		listener.progressUpdated(this, message.havePieceIndex);
 	}
+	else if ((message.id == HaveAll || message.id == HaveNone) && info.supportsFastExtension())
+	{
+		info.pieces.fromAll(message.id == HaveAll);
+
+		BT_LOG("new percentage: " << std::to_string(info.pieces.getPercentage()));
+		listener.progressUpdated(this, -1);
+	}
+	else if (message.id == AllowedFast && info.supportsFastExtension())
+	{
+		if (message.havePieceIndex < torrent.pieces.size() && !info.isAllowedFast(message.havePieceIndex) && info.allowedFast.size() < MaxAllowedFastPieces)
+			info.allowedFast.push_back(message.havePieceIndex);
+	}
+	else if (message.id == Suggest && info.supportsFastExtension())
+	{
+		if (message.havePieceIndex < torrent.pieces.size())
+		{
+			auto& suggested = info.suggestedPieces;
+			suggested.erase(std::remove(suggested.begin(), suggested.end(), message.havePieceIndex), suggested.end());
+
+			if (suggested.size() >= MaxSuggestedPieces)
+				suggested.erase(suggested.begin());
+
+			suggested.push_back(message.havePieceIndex);
+		}
+	}
 	else if (message.id == Unchoke)
 	{
 		state.peerChoking = false;
@@ -408,7 +481,7 @@ void mtt::PeerCommunication::handleMessage(PeerMessage& message)
 			if (!state.finishedHandshake)
 			{
 				if(state.action == PeerCommunicationState::Connected)
-					stream->write(mtt::bt::createHandshake(torrent.hash, mtt::config::getInternal().hashId));
+					stream->writeMessage([this](PacketBuilder& packet) { mtt::bt::writeHandshake(packet, torrent.hash, mtt::config::getInternal().hashId); });
 
 				state.action = PeerCommunicationState::Established;
 				state.finishedHandshake = true;
@@ -39,6 +39,13 @@ namespace mtt
 
 		bool supportsExtensions();
 		bool supportsDht();
+		bool supportsFastExtension();
+
+		//pieces which can be requested while choked
+		std::vector<uint32_t> allowedFast;
+		bool isAllowedFast(uint32_t index);
+		//pieces the peer prefers to upload
+		std::vector<uint32_t> suggestedPieces;
 	};
 
 	class PeerCommunication : public std::enable_shared_from_this<PeerCommunication>
@@ -47,6 +54,8 @@ namespace mtt
 
 		PeerCommunication(TorrentInfo& torrent, IPeerListener& listener, asio::io_service& io_service);
 		PeerCommunication(TorrentInfo& torrent, IPeerListener& listener);
+		//outgoing connection using provided stream
+		PeerCommunication(TorrentInfo& torrent, IPeerListener& listener, std::shared_ptr<TcpAsyncStream> stream);
 		~PeerCommunication();
 
 		void setStream(std::shared_ptr<TcpAsyncStream> stream);
@@ -61,12 +70,20 @@ namespace mtt
 		void setChoke(bool enabled);
 
 		void requestPieceBlock(PieceBlockInfo& pieceInfo);
+		void sendCancel(PieceBlockInfo& pieceInfo);
 		bool isEstablished();
 
 		void sendKeepAlive();
 		void sendBitfield(DataBuffer& bitfield);
 		void sendHave(uint32_t pieceIdx);
 		void sendPieceBlock(PieceBlock& block);
+		//data are written directly from memory kept by dataOwner
+		void sendPieceBlock(PieceBlockInfo& info, const BufferView& data, std::shared_ptr<void> dataOwner);
+
+		//fast extension, ignored if not supported by peer
+		void sendHaveAll();
+		void sendHaveNone();
+		void sendReject(PieceBlockInfo& block);
 
 		void sendPort(uint16_t port);
 
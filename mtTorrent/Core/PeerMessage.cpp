@@ -3,7 +3,7 @@
 
 using namespace mtt;
 
-PeerMessage::PeerMessage(DataBuffer& data)
+PeerMessage::PeerMessage(const BufferView& data)
 {
 	if (data.size() < 4)
 	{
@@ -26,7 +26,7 @@ PeerMessage::PeerMessage(DataBuffer& data)
 		}
 	}
 
-	PacketReader reader(data);
+	PacketReader reader(data.data(), data.size());
 
 	auto size = reader.pop32();
 	messageSize = size + 4;
@@ -43,13 +43,13 @@ PeerMessage::PeerMessage(DataBuffer& data)
 	{
 		id = PeerMessageId(reader.pop());
 
-		if (id == Have && size == 5)
+		if ((id == Have || id == Suggest || id == AllowedFast) && size == 5)
 		{
 			havePieceIndex = reader.pop32();
 		}
 		else if (id == Bitfield)
 		{
-			bitfield = reader.popBuffer(size - 1);
+			bitfield = BufferView(reader.popRaw(size - 1), size - 1);
 		}
 		else if (id == Request && size == 13)
 		{
@@ -61,10 +61,10 @@ PeerMessage::PeerMessage(DataBuffer& data)
 		{
 			piece.info.index = reader.pop32();
 			piece.info.begin = reader.pop32();
-			piece.data = reader.popBuffer(size - 9);
+			piece.data = BufferView(reader.popRaw(size - 9), size - 9);
 			piece.info.length = static_cast<uint32_t>(piece.data.size());
 		}
-		else if (id == Cancel && size == 13)
+		else if ((id == Cancel || id == Reject) && size == 13)
 		{
 			request.index = reader.pop32();
 			request.begin = reader.pop32();
@@ -77,7 +77,7 @@ PeerMessage::PeerMessage(DataBuffer& data)
 		else if (id == Extended && size > 2)
 		{
 			extended.id = reader.pop();
-			extended.data = reader.popBuffer(size - 2);
+			extended.data = BufferView(reader.popRaw(size - 2), size - 2);
 		}
 	}
 
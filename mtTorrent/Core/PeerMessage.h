@@ -16,18 +16,25 @@ namespace mtt
 		Piece,
 		Cancel,
 		Port,
+		Suggest = 13,
+		HaveAll,
+		HaveNone,
+		Reject,
+		AllowedFast,
 		Extended = 20,
 		Handshake,
 		KeepAlive,
 		Invalid
 	};
 
+	//payloads point into parsed data, valid only while the message is handled
 	struct PeerMessage
 	{
 		PeerMessageId id = Invalid;
 
+		//Have, Suggest and AllowedFast
 		uint32_t havePieceIndex;
-		DataBuffer bitfield;
+		BufferView bitfield;
 
 		struct  
 		{
@@ -37,18 +44,19 @@ namespace mtt
 		}
 		handshake;
 
+		//Request, Cancel and Reject
 		PieceBlockInfo request;
-		PieceBlock piece;
+		PieceBlockView piece;
 
 		uint16_t port;
 		uint16_t messageSize = 0;
 
-		PeerMessage(DataBuffer& data);
+		PeerMessage(const BufferView& data);
 
 		struct
 		{
 			uint8_t id;
-			DataBuffer data;
+			BufferView data;
 		}
 		extended;	
 	};
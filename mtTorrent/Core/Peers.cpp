@@ -5,6 +5,7 @@
 #include "Dht/Communication.h"
 #include "Uploader.h"
 #include "LogFile.h"
+#include "utils/UtpManager.h"
 #include <fstream>
 
 mtt::Peers::Peers(TorrentPtr t) : torrent(t), trackers(t), dht(*this, t)
@@ -201,7 +202,9 @@ void mtt::Peers::add(std::shared_ptr<TcpAsyncStream> stream)
 		addLogEvent(RemoteConnect, p.address, 0);
 	}
 
-	peer.comm->setStream(stream);
+	//already received handshake is parsed on torrent strand with following data
+	stream->setCallbackStrand(torrent->strand);
+	torrent->strand->post([comm = peer.comm, stream]() { comm->setStream(stream); });
 }
 
 std::shared_ptr<mtt::PeerCommunication> mtt::Peers::disconnect(PeerCommunication* p)
@@ -216,7 +219,16 @@ std::shared_ptr<mtt::PeerCommunication> mtt::Peers::disconnect(PeerCommunication
 			auto& peer = knownPeers[it->idx];
 
 			if (!p->state.finishedHandshake)
-				peer.lastQuality = Peers::PeerQuality::Offline;
+			{
+				//try again with tcp
+				if (it->utp && !peer.utpFailed)
+				{
+					peer.utpFailed = true;
+					peer.lastQuality = Peers::PeerQuality::Unknown;
+				}
+				else
+					peer.lastQuality = Peers::PeerQuality::Offline;
+			}
 			else
 			{
 				p->stop();
@@ -286,13 +298,23 @@ std::vector<std::shared_ptr<mtt::PeerCommunication>> mtt::Peers::getActivePeers(
 
 void mtt::Peers::reloadTorrentInfo()
 {
-	std::lock_guard<std::mutex> guard(peersMutex);
-
-	for (auto& peer : activeConnections)
+	std::vector<std::shared_ptr<PeerCommunication>> peers;
 	{
-		if (peer.comm->state.finishedHandshake)
-			peer.comm->info.pieces.resize(torrent->infoFile.info.pieces.size());
+		std::lock_guard<std::mutex> guard(peersMutex);
+
+		for (auto& peer : activeConnections)
+			peers.push_back(peer.comm);
 	}
+
+	//peer messages updating pieces are parsed on torrent strand
+	torrent->strand->post([peers, piecesCount = torrent->infoFile.info.pieces.size()]()
+		{
+			for (auto& comm : peers)
+			{
+				if (comm->state.finishedHandshake)
+					comm->info.pieces.resize(piecesCount);
+			}
+		});
 }
 
 uint32_t mtt::Peers::updateKnownPeers(const std::vector<Addr>& peers, PeerSource source)
@@ -370,7 +392,17 @@ std::shared_ptr<mtt::PeerCommunication> mtt::Peers::connect(uint32_t idx)
 		knownPeer.lastQuality = PeerQuality::Connecting;
 
 	ActivePeer peer;
-	peer.comm = std::make_shared<PeerCommunication>(torrent->infoFile.info, *peersListener, torrent->service.io);
+	std::shared_ptr<TcpAsyncStream> stream;
+	if (mtt::config::getExternal().connection.enableUtp && !knownPeer.utpFailed)
+	{
+		stream = std::make_shared<UtpStream>(torrent->service.io, UtpManager::Get());
+		peer.utp = true;
+	}
+	else
+		stream = std::make_shared<TcpAsyncStream>(torrent->service.io);
+
+	stream->setCallbackStrand(torrent->strand);
+	peer.comm = std::make_shared<PeerCommunication>(torrent->infoFile.info, *peersListener, stream);
 	peer.comm->sendHandshake(knownPeer.address);
 	peer.idx = idx;
 	activeConnections.push_back(peer);
@@ -93,6 +93,7 @@ namespace mtt
 			PeerQuality lastQuality = PeerQuality::Unknown;
 			uint32_t lastConnectionTime = 0;
 			uint32_t connectionAttempts = 0;
+			bool utpFailed = false;
 		};
 
 		uint32_t updateKnownPeers(const std::vector<Addr>& peers, PeerSource source);
@@ -106,6 +107,7 @@ namespace mtt
 		{
 			std::shared_ptr<PeerCommunication> comm;
 			uint32_t idx;
+			bool utp = false;
 		};
 		std::vector<ActivePeer> activeConnections;
 		mtt::Peers::KnownPeer* mtt::Peers::getKnownPeer(PeerCommunication* p);
@@ -0,0 +1,91 @@
+#include "PieceRequestsTable.h"
+
+void mtt::PieceRequestsTable::init(size_t piecesCount)
+{
+	requests.clear();
+	positions.assign(piecesCount, NotRequested);
+}
+
+void mtt::PieceRequestsTable::clear()
+{
+	requests.clear();
+	std::fill(positions.begin(), positions.end(), NotRequested);
+}
+
+mtt::PieceRequest* mtt::PieceRequestsTable::find(uint32_t pieceIdx)
+{
+	if (pieceIdx < positions.size() && positions[pieceIdx] < requests.size())
+		return &requests[positions[pieceIdx]];
+
+	return nullptr;
+}
+
+mtt::PieceRequest* mtt::PieceRequestsTable::add(uint32_t pieceIdx, uint16_t blocksCount)
+{
+	if (pieceIdx >= positions.size())
+		positions.resize(pieceIdx + 1, NotRequested);
+
+	if (auto r = find(pieceIdx))
+		return r;
+
+	positions[pieceIdx] = (uint32_t)requests.size();
+	requests.emplace_back();
+
+	auto& r = requests.back();
+	r.pieceIdx = pieceIdx;
+	r.blocksCount = blocksCount;
+	r.blockRequests.resize(blocksCount);
+
+	return &r;
+}
+
+void mtt::PieceRequestsTable::remove(uint32_t pieceIdx)
+{
+	if (!find(pieceIdx))
+		return;
+
+	//last request takes place of removed one
+	auto pos = positions[pieceIdx];
+	if (pos != requests.size() - 1)
+	{
+		requests[pos] = std::move(requests.back());
+		positions[requests[pos].pieceIdx] = pos;
+	}
+
+	requests.pop_back();
+	positions[pieceIdx] = NotRequested;
+}
+
+void mtt::PieceRequestsTable::setVerifying(uint32_t pieceIdx)
+{
+	remove(pieceIdx);
+
+	if (pieceIdx < positions.size())
+		positions[pieceIdx] = Verifying;
+}
+
+void mtt::PieceRequestsTable::verified(uint32_t pieceIdx)
+{
+	if (pieceIdx < positions.size() && positions[pieceIdx] == Verifying)
+		positions[pieceIdx] = NotRequested;
+}
+
+bool mtt::PieceRequestsTable::isActive(uint32_t pieceIdx)
+{
+	return pieceIdx < positions.size() && positions[pieceIdx] != NotRequested;
+}
+
+size_t mtt::PieceRequestsTable::size()
+{
+	return requests.size();
+}
+
+std::vector<mtt::PieceRequest>::iterator mtt::PieceRequestsTable::begin()
+{
+	return requests.begin();
+}
+
+std::vector<mtt::PieceRequest>::iterator mtt::PieceRequestsTable::end()
+{
+	return requests.end();
+}
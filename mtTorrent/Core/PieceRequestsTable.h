@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Interface.h"
+
+namespace mtt
+{
+	//piece being downloaded
+	struct PieceRequest
+	{
+		uint32_t pieceIdx = 0;
+		std::shared_ptr<DownloadedPiece> piece;
+		uint16_t nextBlockRequestIdx = 0;
+		uint16_t blocksCount = 0;
+		uint32_t receivedSize = 0;
+		//peers with outstanding request of each block
+		std::vector<uint8_t> blockRequests;
+	};
+
+	//in flight pieces found by piece index in constant time
+	class PieceRequestsTable
+	{
+	public:
+
+		void init(size_t piecesCount);
+		void clear();
+
+		PieceRequest* find(uint32_t pieceIdx);
+		PieceRequest* add(uint32_t pieceIdx, uint16_t blocksCount);
+		//pointers returned before are not valid after removal
+		void remove(uint32_t pieceIdx);
+
+		//finished piece waiting for hash check, removed from requests
+		void setVerifying(uint32_t pieceIdx);
+		void verified(uint32_t pieceIdx);
+		//requested or verifying
+		bool isActive(uint32_t pieceIdx);
+
+		size_t size();
+		std::vector<PieceRequest>::iterator begin();
+		std::vector<PieceRequest>::iterator end();
+
+	private:
+
+		std::vector<PieceRequest> requests;
+
+		//position in requests of each piece or its state
+		std::vector<uint32_t> positions;
+		static constexpr uint32_t NotRequested = (uint32_t)-1;
+		static constexpr uint32_t Verifying = (uint32_t)-2;
+	};
+}
@@ -0,0 +1,166 @@
+#include "PiecesPicker.h"
+#include <random>
+
+void mtt::PiecesPicker::init(size_t piecesCount)
+{
+	availability.assign(piecesCount, 0);
+	pieceRank.assign(piecesCount, NotWanted);
+	position.assign(piecesCount, 0);
+
+	for (auto& rank : ranks)
+		rank = {};
+}
+
+uint8_t mtt::PiecesPicker::getRank(Priority p)
+{
+	if (p >= Priority::High)
+		return 0;
+	if (p >= Priority::Normal)
+		return 1;
+
+	return 2;
+}
+
+void mtt::PiecesPicker::setPriority(const std::vector<Priority>& priority, PiecesProgress& progress)
+{
+	uint32_t maxAvailability = 0;
+	for (auto a : availability)
+		maxAvailability = std::max(maxAvailability, a);
+
+	for (auto& rank : ranks)
+		rank.pieces.clear();
+
+	for (uint32_t i = 0; i < (uint32_t)availability.size(); i++)
+	{
+		pieceRank[i] = (i < priority.size() && progress.wantedPiece(i)) ? getRank(priority[i]) : NotWanted;
+
+		if (pieceRank[i] != NotWanted)
+			ranks[pieceRank[i]].pieces.push_back(i);
+	}
+
+	auto rng = std::default_random_engine{};
+
+	for (auto& rank : ranks)
+	{
+		//random order of pieces with same availability
+		std::shuffle(rank.pieces.begin(), rank.pieces.end(), rng);
+
+		//counting sort by availability
+		rank.bucketStart.assign(maxAvailability + 2, 0);
+		for (auto idx : rank.pieces)
+			rank.bucketStart[availability[idx] + 1]++;
+		for (size_t b = 1; b < rank.bucketStart.size(); b++)
+			rank.bucketStart[b] += rank.bucketStart[b - 1];
+
+		auto next = rank.bucketStart;
+		std::vector<uint32_t> sorted(rank.pieces.size());
+		for (auto idx : rank.pieces)
+		{
+			auto pos = next[availability[idx]]++;
+			sorted[pos] = idx;
+			position[idx] = pos;
+		}
+
+		rank.pieces = std::move(sorted);
+	}
+}
+
+void mtt::PiecesPicker::removePiece(uint32_t idx)
+{
+	if (idx >= pieceRank.size() || pieceRank[idx] == NotWanted)
+		return;
+
+	auto& rank = ranks[pieceRank[idx]];
+	auto& start = rank.bucketStart;
+	size_t buckets = start.size() - 1;
+
+	//move through following buckets to the end
+	uint32_t pos = position[idx];
+	for (size_t b = availability[idx]; b < buckets; b++)
+	{
+		uint32_t last = start[b + 1] - 1;
+		swapPositions(rank, pos, last);
+		pos = last;
+		start[b + 1]--;
+	}
+
+	rank.pieces.pop_back();
+	pieceRank[idx] = NotWanted;
+}
+
+void mtt::PiecesPicker::addAvailability(uint32_t idx)
+{
+	if (idx < availability.size())
+		increase(idx);
+}
+
+void mtt::PiecesPicker::addAvailability(const PiecesProgress& peerPieces)
+{
+	peerPieces.forEachReceived([this](uint32_t idx)
+		{
+			if (idx < availability.size())
+				increase(idx);
+		});
+}
+
+void mtt::PiecesPicker::removeAvailability(const PiecesProgress& peerPieces)
+{
+	peerPieces.forEachReceived([this](uint32_t idx)
+		{
+			if (idx < availability.size())
+				decrease(idx);
+		});
+}
+
+uint32_t mtt::PiecesPicker::getAvailability(uint32_t idx)
+{
+	return idx < availability.size() ? availability[idx] : 0;
+}
+
+void mtt::PiecesPicker::increase(uint32_t idx)
+{
+	auto a = availability[idx]++;
+
+	if (pieceRank[idx] == NotWanted)
+		return;
+
+	auto& rank = ranks[pieceRank[idx]];
+	auto& start = rank.bucketStart;
+
+	if (start.size() < a + 3)
+		start.resize(a + 3, (uint32_t)rank.pieces.size());
+
+	//last of its bucket becomes first of next one
+	uint32_t last = start[a + 1] - 1;
+	swapPositions(rank, position[idx], last);
+	start[a + 1]--;
+}
+
+void mtt::PiecesPicker::decrease(uint32_t idx)
+{
+	if (availability[idx] == 0)
+		return;
+
+	auto a = availability[idx]--;
+
+	if (pieceRank[idx] == NotWanted)
+		return;
+
+	auto& rank = ranks[pieceRank[idx]];
+	auto& start = rank.bucketStart;
+
+	//first of its bucket becomes last of previous one
+	uint32_t first = start[a];
+	swapPositions(rank, position[idx], first);
+	start[a]++;
+}
+
+void mtt::PiecesPicker::swapPositions(Rank& rank, uint32_t pos1, uint32_t pos2)
+{
+	if (pos1 == pos2)
+		return;
+
+	std::swap(rank.pieces[pos1], rank.pieces[pos2]);
+	position[rank.pieces[pos1]] = pos1;
+	position[rank.pieces[pos2]] = pos2;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "PiecesProgress.h"
+
+namespace mtt
+{
+	//wanted pieces kept in buckets by priority and availability, rarest pieces of highest priority come first
+	class PiecesPicker
+	{
+	public:
+
+		void init(size_t piecesCount);
+
+		//reorder all wanted pieces, others are not picked
+		void setPriority(const std::vector<Priority>& priority, PiecesProgress& progress);
+		//piece was received and is not wanted anymore
+		void removePiece(uint32_t idx);
+
+		//availability of pieces of connected peers
+		void addAvailability(uint32_t idx);
+		void addAvailability(const PiecesProgress& peerPieces);
+		void removeAvailability(const PiecesProgress& peerPieces);
+		uint32_t getAvailability(uint32_t idx);
+
+		//visit wanted pieces in picking order while f returns true, pieces nobody has are visited last
+		template<typename F>
+		void forEach(F f)
+		{
+			for (auto& rank : ranks)
+			{
+				size_t buckets = rank.bucketStart.size() - 1;
+
+				for (size_t b = 1; b <= buckets; b++)
+				{
+					//bucket 0 at the end
+					size_t bucket = b % buckets;
+
+					for (uint32_t i = rank.bucketStart[bucket]; i < rank.bucketStart[bucket + 1]; i++)
+						if (!f(rank.pieces[i]))
+							return;
+				}
+			}
+		}
+
+	private:
+
+		static constexpr uint8_t RanksCount = 3;
+		static constexpr uint8_t NotWanted = 0xFF;
+		static uint8_t getRank(Priority);
+
+		struct Rank
+		{
+			//pieces sorted by availability
+			std::vector<uint32_t> pieces;
+			//first position of each availability in pieces, last is end of pieces
+			std::vector<uint32_t> bucketStart = { 0, 0 };
+		};
+		Rank ranks[RanksCount];
+
+		std::vector<uint32_t> availability;
+		std::vector<uint8_t> pieceRank;
+		//position in pieces of rank
+		std::vector<uint32_t> position;
+
+		void increase(uint32_t idx);
+		void decrease(uint32_t idx);
+		void swapPositions(Rank&, uint32_t pos1, uint32_t pos2);
+	};
+}
@@ -1,17 +1,67 @@
 #include "PiecesProgress.h"
 
-const uint8_t ReadyValue = 0;
+#if defined(_M_X64) || defined(__x86_64__)
+#include <emmintrin.h>
+#define PIECES_SSE2
+#endif
+
+//flags of saved state
 const uint8_t HasFlag = 1;
 const uint8_t UnselectedFlag = 8;
 
-bool mtt::PiecesProgress::empty()
+static size_t wordsCount(size_t pieces)
+{
+	return (pieces + 63) / 64;
+}
+
+static size_t popcount(uint64_t word)
+{
+#ifdef _MSC_VER
+	word = word - ((word >> 1) & 0x5555555555555555ull);
+	word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+	word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+	return (size_t)((word * 0x0101010101010101ull) >> 56);
+#else
+	return (size_t)__builtin_popcountll(word);
+#endif
+}
+
+static size_t popcount(const std::vector<uint64_t>& words)
+{
+	size_t count = 0;
+	for (auto w : words)
+		count += popcount(w);
+
+	return count;
+}
+
+//bitfield has first piece in highest bit of byte, words in lowest
+static uint8_t reverseBits(uint8_t b)
+{
+	b = (uint8_t)((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+	b = (uint8_t)((b & 0xCC) >> 2 | (b & 0x33) << 2);
+	b = (uint8_t)((b & 0xAA) >> 1 | (b & 0x55) << 1);
+	return b;
+}
+
+bool mtt::PiecesProgress::empty() const
 {
-	return receivedPiecesCount == 0;
+	return !allReceived && receivedPiecesCount == 0;
 }
 
-float mtt::PiecesProgress::getPercentage()
+bool mtt::PiecesProgress::hasAll() const
 {
-	return pieces.empty() ? 0 : (receivedPiecesCount / (float)pieces.size());
+	return allReceived || (piecesCount != 0 && receivedPiecesCount == piecesCount);
+}
+
+size_t mtt::PiecesProgress::size() const
+{
+	return piecesCount;
+}
+
+float mtt::PiecesProgress::getPercentage() const
+{
+	return piecesCount == 0 ? 0 : (receivedPiecesCount / (float)piecesCount);
 }
 
 float mtt::PiecesProgress::getSelectedPercentage()
@@ -21,22 +71,27 @@ float mtt::PiecesProgress::getSelectedPercentage()
 
 void mtt::PiecesProgress::recheckPieces()
 {
+	size_t unselectedCount = popcount(unselected);
+	selectedPieces = piecesCount - unselectedCount;
+
+	if (allReceived)
+	{
+		receivedPiecesCount = piecesCount;
+		selectedReceivedPiecesCount = selectedPieces;
+		return;
+	}
+
 	receivedPiecesCount = 0;
 	selectedReceivedPiecesCount = 0;
-	selectedPieces = 0;
 
-	for (auto& p : pieces)
+	for (size_t w = 0; w < received.size(); w++)
 	{
-		if (p & HasFlag)
-			receivedPiecesCount++;
-
-		if (!(p & UnselectedFlag))
-		{
-			selectedPieces++;
+		receivedPiecesCount += popcount(received[w]);
 
-			if (p & HasFlag)
-				selectedReceivedPiecesCount++;
-		}
+		if (w < unselected.size())
+			selectedReceivedPiecesCount += popcount(received[w] & ~unselected[w]);
+		else
+			selectedReceivedPiecesCount += popcount(received[w]);
 	}
 }
 
@@ -46,22 +101,35 @@ void mtt::PiecesProgress::init(size_t size)
 	selectedReceivedPiecesCount = 0;
 	selectedPieces = size;
 
-	if (pieces.size() < size)
+	if (allReceived)
 	{
-		pieces.resize(size, 0);
+		received.assign(wordsCount(piecesCount), ~0ull);
+		allReceived = false;
+		clearUnusedBits();
+	}
+
+	if (piecesCount < size)
+	{
+		piecesCount = size;
+		received.resize(wordsCount(size), 0);
+
+		if (!unselected.empty())
+			unselected.resize(wordsCount(size), 0);
 	}
 }
 
 void mtt::PiecesProgress::resize(size_t size)
 {
-	if (pieces.size() != size)
+	if (piecesCount != size)
 	{
-		auto previous = std::move(pieces);
-		pieces.clear();
-		pieces.resize(size);
+		//have all stays valid with any size, also when received before metadata
+		piecesCount = size;
 
-		if(!previous.empty())
-			memcpy(pieces.data(), previous.data(), std::min(size, previous.size()));
+		if (!allReceived)
+			received.resize(wordsCount(size), 0);
+		if (!unselected.empty())
+			unselected.resize(wordsCount(size), 0);
+		clearUnusedBits();
 
 		recheckPieces();
 	}
@@ -72,10 +140,8 @@ void mtt::PiecesProgress::removeReceived()
 	receivedPiecesCount = 0;
 	selectedReceivedPiecesCount = 0;
 
-	for (auto& p : pieces)
-	{
-		p &= ~HasFlag;
-	}
+	allReceived = false;
+	received.assign(wordsCount(piecesCount), 0);
 }
 
 void mtt::PiecesProgress::select(DownloadSelection& selection)
@@ -83,6 +149,8 @@ void mtt::PiecesProgress::select(DownloadSelection& selection)
 	init(selection.files.back().info.endPieceIndex + 1);
 	selectedPieces = 0;
 
+	unselected.resize(received.size(), 0);
+
 	uint32_t lastWantedPiece = -1;
 	for (auto& f : selection.files)
 	{
@@ -92,21 +160,23 @@ void mtt::PiecesProgress::select(DownloadSelection& selection)
 
 		for (; i <= f.info.endPieceIndex; i++)
 		{
-			if (pieces[i] & HasFlag)
+			uint64_t bit = 1ull << (i % 64);
+
+			if (received[i / 64] & bit)
 			{
 				receivedPiecesCount++;
 
 				if (f.selected)
 					selectedReceivedPiecesCount++;
 			}
-				
+
 			if (f.selected)
 			{
 				selectedPieces++;
-				pieces[i] &= ~UnselectedFlag;
+				unselected[i / 64] &= ~bit;
 			}
 			else
-				pieces[i] |= UnselectedFlag;
+				unselected[i / 64] |= bit;
 		}
 
 		if(f.selected)
@@ -116,7 +186,7 @@ void mtt::PiecesProgress::select(DownloadSelection& selection)
 
 void mtt::PiecesProgress::addPiece(uint32_t index)
 {
-	if (index >= pieces.size())
+	if (index >= piecesCount)
 		resize(index + 1);
 
 	if (!hasPiece(index))
@@ -124,32 +194,45 @@ void mtt::PiecesProgress::addPiece(uint32_t index)
 		if (wantedPiece(index))
 			selectedReceivedPiecesCount++;
 
-		pieces[index] |= HasFlag;
+		received[index / 64] |= 1ull << (index % 64);
 		receivedPiecesCount++;
 	}
 }
 
 bool mtt::PiecesProgress::hasPiece(uint32_t index)
 {
-	return pieces[index] & HasFlag;
+	if (allReceived)
+		return true;
+
+	return hasBit(received, index);
 }
 
 bool mtt::PiecesProgress::selectedPiece(uint32_t index)
 {
-	return (pieces[index] & UnselectedFlag) == 0;
+	return !hasBit(unselected, index);
 }
 
 bool mtt::PiecesProgress::wantedPiece(uint32_t index)
 {
-	return pieces[index] == 0;
+	return !hasPiece(index) && selectedPiece(index);
 }
 
 uint32_t mtt::PiecesProgress::firstEmptyPiece()
 {
-	for (uint32_t id = 0; id < pieces.size(); id++)
+	if (allReceived)
+		return -1;
+
+	for (size_t w = 0; w < received.size(); w++)
 	{
-		if (!pieces[id])
-			return id;
+		uint64_t empty = ~received[w];
+		if (w < unselected.size())
+			empty &= ~unselected[w];
+
+		if (empty)
+		{
+			size_t id = w * 64 + countTrailingZeros(empty);
+			return id < piecesCount ? (uint32_t)id : -1;
+		}
 	}
 
 	return -1;
@@ -160,22 +243,116 @@ size_t mtt::PiecesProgress::getReceivedPiecesCount()
 	return receivedPiecesCount;
 }
 
-void mtt::PiecesProgress::fromBitfield(DataBuffer& bitfield)
+size_t mtt::PiecesProgress::getSelectedReceivedPiecesCount()
 {
-	size_t maxPiecesCount = pieces.empty() ? bitfield.size() * 8 : pieces.size();
+	return selectedReceivedPiecesCount;
+}
 
-	init(maxPiecesCount);
+uint64_t mtt::PiecesProgress::receivedWord(size_t w) const
+{
+	if (allReceived)
+		return ~0ull;
+
+	return w < received.size() ? received[w] : 0;
+}
+
+size_t mtt::PiecesProgress::getWantedFrom(const PiecesProgress& source, std::vector<uint64_t>& wanted)
+{
+	size_t words = wordsCount(piecesCount);
+	wanted.resize(words);
 
-	for (int i = 0; i < maxPiecesCount; i++)
+	if (allReceived)
 	{
-		size_t idx = static_cast<size_t>(i / 8.0f);
-		unsigned char bitmask = 128 >> i % 8;
+		std::fill(wanted.begin(), wanted.end(), 0);
+		return 0;
+	}
 
-		bool value = (bitfield[idx] & bitmask) != 0;
+	size_t w = 0;
 
-		pieces[i] = value ? HasFlag : ReadyValue;
-		receivedPiecesCount += value;
+	//source bits and not (received or unselected)
+#ifdef PIECES_SSE2
+	if (!source.allReceived && source.received.size() >= words && unselected.size() >= words)
+	{
+		for (; w + 2 <= words; w += 2)
+		{
+			auto has = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source.received.data() + w));
+			auto excluded = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(received.data() + w)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(unselected.data() + w)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(wanted.data() + w), _mm_andnot_si128(excluded, has));
+		}
 	}
+#endif
+
+	for (; w < words; w++)
+	{
+		uint64_t excluded = received[w];
+		if (w < unselected.size())
+			excluded |= unselected[w];
+
+		wanted[w] = source.receivedWord(w) & ~excluded;
+	}
+
+	if (piecesCount % 64 && words)
+		wanted.back() &= (1ull << (piecesCount % 64)) - 1;
+
+	return popcount(wanted);
+}
+
+bool mtt::PiecesProgress::wantsAnyFrom(const PiecesProgress& source)
+{
+	if (allReceived || source.empty())
+		return false;
+
+	size_t words = wordsCount(piecesCount);
+
+	for (size_t w = 0; w < words; w++)
+	{
+		uint64_t excluded = received[w];
+		if (w < unselected.size())
+			excluded |= unselected[w];
+
+		uint64_t wanted = source.receivedWord(w) & ~excluded;
+
+		if (w == words - 1 && piecesCount % 64)
+			wanted &= (1ull << (piecesCount % 64)) - 1;
+
+		if (wanted)
+			return true;
+	}
+
+	return false;
+}
+
+void mtt::PiecesProgress::clearUnusedBits()
+{
+	if (piecesCount % 64 == 0)
+		return;
+
+	uint64_t mask = (1ull << (piecesCount % 64)) - 1;
+
+	if (!received.empty() && received.size() == wordsCount(piecesCount))
+		received.back() &= mask;
+	if (!unselected.empty() && unselected.size() == wordsCount(piecesCount))
+		unselected.back() &= mask;
+}
+
+void mtt::PiecesProgress::fromBitfield(const BufferView& bitfield)
+{
+	size_t maxPiecesCount = piecesCount == 0 ? bitfield.size() * 8 : piecesCount;
+
+	init(maxPiecesCount);
+	unselected.clear();
+
+	size_t bytes = std::min(bitfield.size(), (maxPiecesCount + 7) / 8);
+	std::fill(received.begin(), received.end(), 0);
+
+	for (size_t i = 0; i < bytes; i++)
+		received[i / 8] |= (uint64_t)reverseBits(bitfield[i]) << (8 * (i % 8));
+
+	clearUnusedBits();
+
+	receivedPiecesCount = popcount(received);
+	selectedReceivedPiecesCount = receivedPiecesCount;
+	selectedPieces = piecesCount;
 }
 
 void mtt::PiecesProgress::fromList(std::vector<uint8_t>& piecesList)
@@ -183,16 +360,36 @@ void mtt::PiecesProgress::fromList(std::vector<uint8_t>& piecesList)
 	init(piecesList.size());
 
 	for (uint32_t i = 0; i < piecesList.size(); i++)
+	{
+		uint64_t bit = 1ull << (i % 64);
+
 		if (piecesList[i])
 		{
-			pieces[i] |= HasFlag;
+			received[i / 64] |= bit;
 			receivedPiecesCount++;
 
 			if (selectedPiece(i))
 				selectedReceivedPiecesCount++;
 		}
 		else
-			pieces[i] &= ~HasFlag;
+			received[i / 64] &= ~bit;
+	}
+}
+
+void mtt::PiecesProgress::fromAll(bool hasAll)
+{
+	init(piecesCount);
+	unselected.clear();
+
+	if (hasAll)
+	{
+		std::vector<uint64_t>().swap(received);
+		allReceived = true;
+	}
+	else
+		std::fill(received.begin(), received.end(), 0);
+
+	receivedPiecesCount = selectedReceivedPiecesCount = hasAll ? piecesCount : 0;
 }
 
 DataBuffer mtt::PiecesProgress::toBitfield()
@@ -206,30 +403,53 @@ DataBuffer mtt::PiecesProgress::toBitfield()
 
 bool mtt::PiecesProgress::toBitfield(uint8_t* dataBitfield, size_t dataSize)
 {
-	if (dataSize < getBitfieldSize())
+	auto bitfieldSize = getBitfieldSize();
+
+	if (dataSize < bitfieldSize)
 		return false;
 
-	for (int i = 0; i < pieces.size(); i++)
-	{
-		if (!hasPiece(i))
-			continue;
+	for (size_t i = 0; i < bitfieldSize; i++)
+		dataBitfield[i] |= reverseBits((uint8_t)(receivedWord(i / 8) >> (8 * (i % 8))));
 
-		size_t idx = static_cast<size_t>(i / 8.0f);
-		unsigned char bitmask = 128 >> i % 8;
-		dataBitfield[idx] |= bitmask;
-	}
+	//spare bits of last byte stay clear
+	if (allReceived && piecesCount % 8)
+		dataBitfield[bitfieldSize - 1] &= (uint8_t)(0xFF00 >> (piecesCount % 8));
 
 	return true;
 }
 
 void mtt::PiecesProgress::toBitfield(DataBuffer& buffer)
 {
-	buffer.resize(getBitfieldSize());
+	buffer.assign(getBitfieldSize(), 0);
 
 	toBitfield(buffer.data(), buffer.size());
 }
 
 size_t mtt::PiecesProgress::getBitfieldSize()
 {
-	return (size_t)ceil(pieces.size() / 8.0f);
+	return (piecesCount + 7) / 8;
+}
+
+void mtt::PiecesProgress::fromState(const std::vector<uint8_t>& state)
+{
+	allReceived = false;
+	piecesCount = state.size();
+	received.assign(wordsCount(piecesCount), 0);
+	unselected.assign(wordsCount(piecesCount), 0);
+
+	for (size_t i = 0; i < state.size(); i++)
+	{
+		if (state[i] & HasFlag)
+			received[i / 64] |= 1ull << (i % 64);
+		if (state[i] & UnselectedFlag)
+			unselected[i / 64] |= 1ull << (i % 64);
+	}
+}
+
+void mtt::PiecesProgress::toState(std::vector<uint8_t>& state)
+{
+	state.resize(piecesCount);
+
+	for (uint32_t i = 0; i < piecesCount; i++)
+		state[i] = (hasPiece(i) ? HasFlag : 0) | (selectedPiece(i) ? 0 : UnselectedFlag);
 }
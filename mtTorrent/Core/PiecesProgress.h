@@ -1,8 +1,13 @@
 #pragma once
 #include "Interface.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace mtt
 {
+	//pieces state packed in bits, 64 pieces per word
 	struct PiecesProgress
 	{
 		void recheckPieces();
@@ -11,15 +16,23 @@ namespace mtt
 		void removeReceived();
 
 		void select(DownloadSelection& selection);
-		void fromBitfield(DataBuffer& bitfield);
+		void fromBitfield(const BufferView& bitfield);
 		void fromList(std::vector<uint8_t>& pieces);
+		//fast extension HaveAll/HaveNone, size from init, have all is kept through resize
+		void fromAll(bool hasAll);
 		DataBuffer toBitfield();
 		void toBitfield(DataBuffer&);
 		bool toBitfield(uint8_t* dataBitfield, size_t dataSize);
 		size_t getBitfieldSize();
 
-		bool empty();
-		float getPercentage();
+		//byte per piece with received and unselected flags, as kept in saved torrent state
+		void fromState(const std::vector<uint8_t>& state);
+		void toState(std::vector<uint8_t>& state);
+
+		bool empty() const;
+		bool hasAll() const;
+		size_t size() const;
+		float getPercentage() const;
 		float getSelectedPercentage();
 
 		void addPiece(uint32_t index);
@@ -28,12 +41,62 @@ namespace mtt
 		bool wantedPiece(uint32_t index);
 		uint32_t firstEmptyPiece();
 		size_t getReceivedPiecesCount();
+		size_t getSelectedReceivedPiecesCount();
+
+		//bits of pieces received by source and wanted here, returns their count
+		size_t getWantedFrom(const PiecesProgress& source, std::vector<uint64_t>& wanted);
+		bool wantsAnyFrom(const PiecesProgress& source);
+		static bool hasBit(const std::vector<uint64_t>& bits, uint32_t index)
+		{
+			return (index / 64) < bits.size() && (bits[index / 64] >> (index % 64)) & 1;
+		}
+
+		template<typename F>
+		void forEachReceived(F f) const
+		{
+			if (allReceived)
+			{
+				for (uint32_t i = 0; i < piecesCount; i++)
+					f(i);
+				return;
+			}
+
+			for (size_t w = 0; w < received.size(); w++)
+			{
+				uint64_t word = received[w];
+				while (word)
+				{
+					f((uint32_t)(w * 64 + countTrailingZeros(word)));
+					word &= word - 1;
+				}
+			}
+		}
 
-		std::vector<uint8_t> pieces;
 		size_t selectedPieces = 0;
 
 	private:
 
+		static uint32_t countTrailingZeros(uint64_t word)
+		{
+#ifdef _MSC_VER
+			unsigned long idx;
+			_BitScanForward64(&idx, word);
+			return idx;
+#else
+			return (uint32_t)__builtin_ctzll(word);
+#endif
+		}
+
+		uint64_t receivedWord(size_t w) const;
+		void clearUnusedBits();
+
+		std::vector<uint64_t> received;
+		//empty when all pieces are selected
+		std::vector<uint64_t> unselected;
+		size_t piecesCount = 0;
+		//compact state of seeds, received bits are not allocated
+		bool allReceived = false;
+
 		size_t receivedPiecesCount = 0;
 		size_t selectedReceivedPiecesCount = 0;
 
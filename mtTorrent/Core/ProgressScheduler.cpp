@@ -116,7 +116,7 @@ mtt::PieceDownloadInfo mtt::ProgressScheduler::getNextPieceDownload(PiecesProgre
 }
 
 uint32_t downloaded = 0;
-void mtt::ProgressScheduler::addDownloadedPiece(DownloadedPiece& piece)
+void mtt::ProgressScheduler::addDownloadedPiece(DownloadedPiece&& piece)
 {
 	std::lock_guard<std::mutex> guard(schedule_mutex);
 
@@ -126,7 +126,7 @@ void mtt::ProgressScheduler::addDownloadedPiece(DownloadedPiece& piece)
 	piecesTodo.removePiece(piece.index);
 	scheduleTodo.removePiece(piece.index);
 
-	storage.storePiece(piece);
+	storage.storePiece(std::move(piece));
 }
 
 bool mtt::ProgressScheduler::finished()
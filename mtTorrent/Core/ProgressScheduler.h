@@ -15,7 +15,7 @@ namespace mtt
 		void selectFiles(std::vector<File> selection);
 
 		PieceDownloadInfo getNextPieceDownload(PiecesProgress& source);
-		void addDownloadedPiece(DownloadedPiece& piece);
+		void addDownloadedPiece(DownloadedPiece&& piece);
 
 		bool finished();
 		float getPercentage();
@@ -1,8 +1,22 @@
 #include "Storage.h"
 #include <fstream>
 #include <iostream>
+#include <thread>
+#include <map>
 #include "utils/ServiceThreadpool.h"
 #include "utils/SHA.h"
+#include "Configuration.h"
+#include "utils/FileHandleCache.h"
+#include "utils/BufferPool.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+static ServiceThreadpool& getDiskService()
+{
+	static ServiceThreadpool diskService(1);
+	return diskService;
+}
 
 mtt::Storage::Storage(TorrentInfo& info)
 {
@@ -12,13 +26,22 @@ mtt::Storage::Storage(TorrentInfo& info)
 mtt::Storage::~Storage()
 {
 	flush();
+
+	for (auto& f : files)
+		FileHandleCache::Get().close(getFullpath(f));
 }
 
 void mtt::Storage::init(TorrentInfo& info, const std::string& locationPath)
 {
+	{
+		std::lock_guard<std::mutex> guard(cacheMutex);
+		closeMappedFiles();
+	}
+
 	pieceSize = info.pieceSize;
 	files = info.files;
 	path = locationPath;
+	mappedStorage = mtt::config::getExternal().files.mappedStorage;
 
 	if (!path.empty() && path.back() != '\\')
 		path += '\\';
@@ -31,8 +54,15 @@ mtt::Status mtt::Storage::setPath(std::string p, bool moveFiles)
 
 	if (path != p)
 	{
+		std::lock_guard<std::mutex> writeGuard(writeMutex);
+		std::lock_guard<std::mutex> cacheGuard(cacheMutex);
+		closeMappedFiles();
+
 		std::lock_guard<std::mutex> guard(storageMutex);
 
+		for (auto& f : files)
+			FileHandleCache::Get().close(getFullpath(f));
+
 		if (files.size() >= 1)
 		{
 			std::error_code ec;
@@ -83,14 +113,17 @@ std::string mtt::Storage::getPath()
 	return path;
 }
 
-void mtt::Storage::storePiece(DownloadedPiece& piece)
+void mtt::Storage::storePiece(DownloadedPiece&& piece)
 {
 	std::lock_guard<std::mutex> guard(storageMutex);
 
-	unsavedPieces.getNext() = piece;
+	if (unsavedPieces.empty())
+		unsavedStartTime = std::chrono::steady_clock::now();
+
+	unsavedSize += piece.data.size();
+	unsavedPieces.push_back(std::move(piece));
 
-	if (unsavedPieces.count == unsavedPieces.data.size())
-		flushAllFiles();
+	scheduleWrite();
 }
 
 mtt::PieceBlock mtt::Storage::getPieceBlock(PieceBlockInfo& block)
@@ -98,41 +131,91 @@ mtt::PieceBlock mtt::Storage::getPieceBlock(PieceBlockInfo& block)
 	PieceBlock out;
 	out.info = block;
 
+	if (!isValidBlock(block))
+		return out;
+
+	out.data = BufferPool::Blocks().get(block.length);
+
 	std::lock_guard<std::mutex> guard(cacheMutex);
 
-	auto& piece = loadPiece(block.index);
+	if (mappedStorage && loadMappedBlock(block, out.data))
+		return out;
+
+	auto piece = loadPiece(block.index);
 
-	if (piece.data.size() >= block.begin + block.length)
+	if (piece && piece->data.size() >= block.begin + block.length)
 	{
 		out.data.resize(block.length);
-		memcpy(out.data.data(), piece.data.data() + block.begin, block.length);
+		memcpy(out.data.data(), piece->data.data() + block.begin, block.length);
 	}
+	else
+		BufferPool::Blocks().release(out.data);
 
 	return out;
 }
 
-mtt::Storage::CachedPiece& mtt::Storage::loadPiece(uint32_t pieceId)
+bool mtt::Storage::getMappedBlock(PieceBlockInfo& block, BufferView& data, std::shared_ptr<void>& owner)
 {
+	if (!mappedStorage || !isValidBlock(block))
+		return false;
+
 	{
 		std::lock_guard<std::mutex> guard(storageMutex);
 
-		for (uint32_t i = 0; i < unsavedPieces.count; i++)
-		{
-			auto& p = unsavedPieces.data[i];
+		if (findUnsavedPiece(block.index))
+			return false;
+	}
 
-			if (p.index == pieceId)
-			{
-				auto& c = cachedPieces.getNext();
-				c.data = p.data;
-				c.index = p.index;
-			}
+	uint64_t blockStart = block.index * (uint64_t)pieceSize + block.begin;
+	uint64_t blockEnd = blockStart + block.length;
+
+	std::lock_guard<std::mutex> guard(cacheMutex);
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		uint64_t fileStart = getFileOffset(files[i]);
+		uint64_t fileEnd = fileStart + files[i].size;
+
+		if (fileEnd <= blockStart)
+			continue;
+
+		//blocks across files are copied with getPieceBlock
+		if (fileStart > blockStart || fileEnd < blockEnd)
+			return false;
+
+		auto mapping = getMappedFile(i);
+		if (!mapping)
+			return false;
+
+		auto fileData = mapping->map(blockStart - fileStart, block.length, owner);
+		if (!fileData)
+			return false;
+
+		data = BufferView(fileData, block.length);
+		return true;
+	}
+
+	return false;
+}
+
+mtt::Storage::CachedPiece* mtt::Storage::loadPiece(uint32_t pieceId)
+{
+	{
+		std::lock_guard<std::mutex> guard(storageMutex);
+
+		if (auto p = findUnsavedPiece(pieceId))
+		{
+			auto& c = cachedPieces.getNext();
+			c.data = p->data;
+			c.index = p->index;
+			return &c;
 		}
 	}
 
 	for (uint32_t i = 0; i < cachedPieces.count; i++)
 	{
 		if (cachedPieces.data[i].index == pieceId)
-			return cachedPieces.data[i];
+			return &cachedPieces.data[i];
 	}
 
 	auto& piece = cachedPieces.getNext();
@@ -143,17 +226,22 @@ mtt::Storage::CachedPiece& mtt::Storage::loadPiece(uint32_t pieceId)
 	{
 		if (f.startPieceIndex <= piece.index && f.endPieceIndex >= piece.index)
 		{
-			loadPiece(f, piece);
+			if (!loadPiece(f, piece))
+			{
+				//dont keep partially read piece in cache
+				piece.index = (uint32_t)-1;
+				return nullptr;
+			}
 		}
 	}
 
 	if(files.back().endPieceIndex == pieceId)
 		piece.data.resize(files.back().endPiecePos);
 
-	return piece;
+	return &piece;
 }
 
-void mtt::Storage::loadPiece(File& file, CachedPiece& piece)
+bool mtt::Storage::loadPiece(File& file, CachedPiece& piece)
 {
 	size_t fileDataPos = (piece.index == file.startPieceIndex) ? 0 : pieceSize - file.startPiecePos;
 	if (piece.index > file.startPieceIndex + 1)
@@ -169,17 +257,27 @@ void mtt::Storage::loadPiece(File& file, CachedPiece& piece)
 
 	if (dataSize > 0)
 	{
-		auto path = getFullpath(file);
-		std::ifstream fileOut(path, std::ios_base::binary | std::ios_base::in);
+		auto handle = FileHandleCache::Get().open(getFullpath(file));
+		if (!handle)
+			return false;
+
+		std::lock_guard<std::mutex> guard(handle->mutex);
 
-		fileOut.seekg(fileDataPos);
-		fileOut.read((char*)piece.data.data() + bufferDataPos, dataSize);
+		handle->stream.clear();
+		handle->stream.seekg(fileDataPos);
+		handle->stream.read((char*)piece.data.data() + bufferDataPos, dataSize);
+
+		if (!handle->stream || handle->stream.gcount() != (std::streamsize)dataSize)
+			return false;
 	}
+
+	return true;
 }
 
 mtt::Status mtt::Storage::preallocateSelection(DownloadSelection& selection)
 {
 	{
+		std::lock_guard<std::mutex> writeGuard(writeMutex);
 		std::lock_guard<std::mutex> guard(storageMutex);
 
 		auto s = validatePath(selection);
@@ -201,26 +299,57 @@ mtt::Status mtt::Storage::preallocateSelection(DownloadSelection& selection)
 		std::lock_guard<std::mutex> guard(cacheMutex);
 
 		cachedPieces.reset();
+		closeMappedFiles();
 	}
 
 	return Status::Success;
 }
 
 void mtt::Storage::flush()
+{
+	{
+		std::unique_lock<std::mutex> guard(storageMutex);
+		writeFinished.wait(guard, [this]() { return !writeScheduled; });
+	}
+
+	writeUnsavedPieces();
+}
+
+bool mtt::Storage::isWriteQueueFull()
 {
 	std::lock_guard<std::mutex> guard(storageMutex);
 
-	flushAllFiles();
+	return unsavedSize > mtt::config::getInternal().maxWriteQueueSize;
+}
+
+mtt::WriteQueueInfo mtt::Storage::getWriteQueueInfo()
+{
+	WriteQueueInfo info;
+
+	std::lock_guard<std::mutex> guard(storageMutex);
+
+	info.queuedPieces = (uint32_t)(unsavedPieces.size() + writtenPieces.size());
+	info.queuedSize = unsavedSize;
+	info.lastWriteLatency = lastWriteLatency;
+	info.averageWriteLatency = averageWriteLatency;
+
+	return info;
 }
 
 mtt::Status mtt::Storage::deleteAll()
 {
+	std::lock_guard<std::mutex> writeGuard(writeMutex);
+	std::lock_guard<std::mutex> cacheGuard(cacheMutex);
+	closeMappedFiles();
+
 	std::lock_guard<std::mutex> guard(storageMutex);
 
 	std::error_code ec;
 	for (auto& f : files)
 	{
-		std::filesystem::remove(getFullpath(f), ec);
+		auto fullpath = getFullpath(f);
+		FileHandleCache::Get().close(fullpath);
+		std::filesystem::remove(fullpath, ec);
 	}
 
 	if (files.size() > 1)
@@ -250,55 +379,137 @@ int64_t mtt::Storage::getLastModifiedTime()
 	return time;
 }
 
-void mtt::Storage::flushAllFiles()
+void mtt::Storage::scheduleWrite()
 {
-	for (auto& f : files)
+	if (writeScheduled)
+		return;
+
+	writeScheduled = true;
+
+	getDiskService().io.post([this]()
+		{
+			writeUnsavedPieces();
+
+			std::lock_guard<std::mutex> guard(storageMutex);
+			writeScheduled = false;
+
+			if (unsavedPieces.empty())
+				writeFinished.notify_all();
+			else
+				scheduleWrite();
+		});
+}
+
+void mtt::Storage::writeUnsavedPieces()
+{
+	std::lock_guard<std::mutex> writeGuard(writeMutex);
+
+	std::chrono::steady_clock::time_point queuedTime;
 	{
-		flush(f);
+		std::lock_guard<std::mutex> guard(storageMutex);
+
+		if (unsavedPieces.empty())
+			return;
+
+		writtenPieces.swap(unsavedPieces);
+		queuedTime = unsavedStartTime;
 	}
 
-	unsavedPieces.reset();
+	writePieces(writtenPieces);
+
+	auto latency = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - queuedTime).count();
+
+	std::lock_guard<std::mutex> guard(storageMutex);
+
+	for (auto& p : writtenPieces)
+		unsavedSize -= p.data.size();
+
+	writtenPieces.clear();
+
+	lastWriteLatency = latency;
+	averageWriteLatency = averageWriteLatency ? (averageWriteLatency * 7 + latency) / 8 : latency;
 }
 
-void mtt::Storage::flush(File& file)
+void mtt::Storage::writePieces(std::vector<DownloadedPiece>& pieces)
 {
+	std::vector<DownloadedPiece*> sortedPieces;
+	for (auto& p : pieces)
+		sortedPieces.push_back(&p);
+
+	std::sort(sortedPieces.begin(), sortedPieces.end(), [](DownloadedPiece* l, DownloadedPiece* r) { return l->index < r->index; });
+
 	std::vector<DownloadedPiece*> filePieces;
-	for (uint32_t i = 0; i < unsavedPieces.count; i++)
+	for (auto& f : files)
 	{
-		auto& piece = unsavedPieces.data[i];
-		if (file.startPieceIndex <= piece.index && file.endPieceIndex >= piece.index)
-			filePieces.push_back(&piece);
+		filePieces.clear();
+
+		for (auto p : sortedPieces)
+		{
+			if (f.startPieceIndex <= p->index && f.endPieceIndex >= p->index)
+				filePieces.push_back(p);
+		}
+
+		if (!filePieces.empty())
+			flush(f, filePieces);
 	}
+}
 
-	if (filePieces.empty())
-		return;
+mtt::DownloadedPiece* mtt::Storage::findUnsavedPiece(uint32_t index)
+{
+	for (auto& p : unsavedPieces)
+		if (p.index == index)
+			return &p;
 
-	auto path = getFullpath(file);
-	createPath(path);
+	for (auto& p : writtenPieces)
+		if (p.index == index)
+			return &p;
 
-	bool fileExists = std::filesystem::exists(path);
-	size_t existingSize = fileExists ? std::filesystem::file_size(path) : 0;
+	return nullptr;
+}
 
-	if (fileExists && existingSize == file.size)
+void mtt::Storage::flush(File& file, std::vector<DownloadedPiece*>& filePieces)
+{
+
+	auto path = getFullpath(file);
+	auto handle = FileHandleCache::Get().open(path);
+
+	if (handle && !handle->readOnly && handle->size == file.size)
 	{
-		std::ofstream fileOut(path, std::ios_base::binary | std::ios_base::in);
+		std::lock_guard<std::mutex> guard(handle->mutex);
+		auto& fileOut = handle->stream;
+		fileOut.clear();
 
-		if (fileOut)
-			for (auto& p : filePieces)
-			{
-				auto pieceDataPos = file.startPieceIndex == p->index ? file.startPiecePos : 0;
-				auto fileDataPos = file.startPieceIndex == p->index ? 0 : (pieceSize - file.startPiecePos + (p->index - file.startPieceIndex - 1) * pieceSize);
-				auto pieceDataSize = std::min(file.size, p->data.size() - pieceDataPos);
+		size_t writePos = -1;
+
+		for (auto& p : filePieces)
+		{
+			auto pieceDataPos = file.startPieceIndex == p->index ? file.startPiecePos : 0;
+			auto fileDataPos = file.startPieceIndex == p->index ? 0 : (pieceSize - file.startPiecePos + (p->index - file.startPieceIndex - 1) * (size_t)pieceSize);
+			auto pieceDataSize = std::min(file.size, p->data.size() - pieceDataPos);
 
-				if (file.endPieceIndex == p->index)
-					pieceDataSize = std::min(pieceDataSize, (size_t)file.endPiecePos);
+			if (file.endPieceIndex == p->index)
+				pieceDataSize = std::min(pieceDataSize, (size_t)file.endPiecePos);
 
+			//sorted pieces following each other are written as one sequence
+			if (writePos != fileDataPos)
 				fileOut.seekp(fileDataPos);
-				fileOut.write((const char*)p->data.data() + pieceDataPos, pieceDataSize);
-			}
+
+			fileOut.write((const char*)p->data.data() + pieceDataPos, pieceDataSize);
+			writePos = fileDataPos + pieceDataSize;
+		}
+
+		fileOut.flush();
 	}
 	else
 	{
+		//partially stored file, keep it out of cache
+		if (handle)
+			FileHandleCache::Get().close(path);
+
+		createPath(path);
+
+		bool fileExists = std::filesystem::exists(path);
+
 		std::ofstream tempFileOut(path, fileExists ? (std::ios_base::binary | std::ios_base::in) : std::ios_base::binary);
 
 		if(tempFileOut)
@@ -328,90 +539,498 @@ DataBuffer mtt::Storage::checkStoredPieces(std::vector<PieceInfo>& piecesInfo)
 void mtt::Storage::checkStoredPieces(PiecesCheck& checkState, const std::vector<PieceInfo>& piecesInfo)
 {
 	checkState.pieces.resize(piecesInfo.size());
-	size_t currentPieceIdx = 0;
 
-	if (files.empty())
+	if (files.empty() || piecesInfo.empty())
 		return;
 
-	auto currentFile = &files.front();
-	auto lastFile = &files.back();
-	
-	std::ifstream fileIn;
-	DataBuffer readBuffer(pieceSize);
-	uint8_t shaBuffer[20] = { 0 };
+	auto layout = getFilesLayout();
+
+	uint32_t workers = mtt::config::getInternal().checkThreads;
+	if (workers == 0)
+		workers = std::max(1u, std::thread::hardware_concurrency());
+
+	const uint32_t MinPiecesPerWorker = 16;
+	uint32_t piecesCount = (uint32_t)piecesInfo.size();
+	workers = std::max(1u, std::min(workers, piecesCount / MinPiecesPerWorker));
+
+	//each worker reads into one buffer while hashing other, batches of pieces when sha can hash multiple buffers at once
+	//mapped pieces are hashed in place, buffers are needed only for pieces spanning files
+	size_t maxBufferSize = mtt::config::getInternal().maxCheckBufferSize;
+	size_t workerBufferPieces = maxBufferSize / (2 * (size_t)pieceSize);
+	if (!mappedStorage)
+		workers = (uint32_t)std::max<size_t>(1, std::min<size_t>(workers, workerBufferPieces));
+	uint32_t batchSize = (uint32_t)std::max<size_t>(1, std::min(Sha1::getBatchSize(), mappedStorage ? workerBufferPieces : workerBufferPieces / workers));
+
+	uint32_t rangeSize = piecesCount / workers;
+	std::vector<std::thread> threads;
+
+	for (uint32_t i = 1; i < workers; i++)
+	{
+		uint32_t first = i * rangeSize;
+		uint32_t last = (i + 1 == workers) ? piecesCount : first + rangeSize;
+
+		threads.emplace_back([&, first, last]() { checkPiecesRange(checkState, piecesInfo, layout, first, last, batchSize); });
+	}
+
+	checkPiecesRange(checkState, piecesInfo, layout, 0, rangeSize, batchSize);
+
+	for (auto& t : threads)
+		t.join();
+}
+
+std::vector<mtt::Storage::FileLayout> mtt::Storage::getFilesLayout()
+{
+	std::vector<FileLayout> layout;
+
+	for (auto& f : files)
+	{
+		std::error_code ec;
+		auto fullpath = getFullpath(f);
+		auto existingSize = std::filesystem::file_size(fullpath, ec);
+
+		if (ec)
+			layout.push_back(FileLayout::Missing);
+		else if (existingSize == f.size)
+			layout.push_back(FileLayout::Full);
+		else if (existingSize == pieceSize - f.startPiecePos)
+			layout.push_back(FileLayout::StartPiece);
+		else if (existingSize == pieceSize - f.startPiecePos + f.endPiecePos)
+			layout.push_back(FileLayout::StartEndPieces);
+		else
+			layout.push_back(FileLayout::Missing);
+	}
+
+	return layout;
+}
 
-	while (currentPieceIdx < piecesInfo.size())
+namespace
+{
+	struct DeviceReadLimit
 	{
-		auto fullpath = getFullpath(*currentFile);
+		std::mutex mtx;
+		std::condition_variable cv;
+		uint32_t active = 0;
+
+		void acquire(uint32_t max)
+		{
+			if (!max)
+				return;
+
+			std::unique_lock<std::mutex> guard(mtx);
+			cv.wait(guard, [&]() { return active < max; });
+			active++;
+		}
+
+		void release(uint32_t max)
+		{
+			if (!max)
+				return;
 
+			std::lock_guard<std::mutex> guard(mtx);
+			active--;
+			cv.notify_one();
+		}
+	};
+
+	std::string getDeviceId(const std::filesystem::path& path)
+	{
 		std::error_code ec;
-		if (std::filesystem::exists(fullpath, ec))
+		auto fullpath = std::filesystem::absolute(path, ec);
+		if (ec)
+			fullpath = path;
+
+#ifdef _WIN32
+		return fullpath.root_name().u8string();
+#else
+		//closest existing parent if location isnt created yet
+		struct stat info;
+		while (stat(fullpath.c_str(), &info) != 0)
+		{
+			auto parent = fullpath.parent_path();
+			if (parent.empty() || parent == fullpath)
+				return {};
+
+			fullpath = parent;
+		}
+
+		return std::to_string(info.st_dev);
+#endif
+	}
+
+	//buffers of all running checks share memory limit
+	struct CheckMemoryLimit
+	{
+		std::mutex mtx;
+		std::condition_variable cv;
+		size_t used = 0;
+
+		void acquire(size_t size, size_t max)
+		{
+			std::unique_lock<std::mutex> guard(mtx);
+			//buffers larger than limit are allowed when nothing else is checked
+			cv.wait(guard, [&]() { return used == 0 || used + size <= max; });
+			used += size;
+		}
+
+		void release(size_t size)
+		{
+			std::lock_guard<std::mutex> guard(mtx);
+			used -= size;
+			cv.notify_all();
+		}
+	};
+
+	CheckMemoryLimit& getCheckMemoryLimit()
+	{
+		static CheckMemoryLimit limit;
+		return limit;
+	}
+
+	//fault in mapped piece by reader thread, so disk reads stay under device limit and overlap with hashing
+	void touchMappedPages(const uint8_t* data, size_t size)
+	{
+		const size_t PageSize = 4096;
+		volatile uint8_t sum = 0;
+
+		for (size_t i = 0; i < size; i += PageSize)
+			sum = sum + data[i];
+	}
+
+	DeviceReadLimit& getDeviceReadLimit(const std::filesystem::path& path)
+	{
+		auto id = getDeviceId(path);
+
+		static std::mutex devicesMutex;
+		static std::map<std::string, DeviceReadLimit> devices;
+
+		std::lock_guard<std::mutex> guard(devicesMutex);
+		return devices[id];
+	}
+}
+
+void mtt::Storage::checkPiecesRange(PiecesCheck& checkState, const std::vector<PieceInfo>& piecesInfo, const std::vector<FileLayout>& layout, uint32_t first, uint32_t last, uint32_t batchSize)
+{
+	//allocated with first piece which cant be hashed from mapped file
+	size_t buffersSize = 0;
+	auto& memoryLimit = getCheckMemoryLimit();
+
+	//reader fills one buffer while the other is hashed
+	struct
+	{
+		DataBuffer data;
+		std::vector<const uint8_t*> pieces;
+		std::vector<std::shared_ptr<void>> mappedOwners;
+		std::vector<uint32_t> sizes;
+		std::vector<bool> valid;
+		bool ready = false;
+	}
+	buffers[2];
+
+	for (auto& buffer : buffers)
+	{
+		buffer.pieces.resize(batchSize);
+		buffer.mappedOwners.resize(batchSize);
+		buffer.sizes.resize(batchSize);
+		buffer.valid.resize(batchSize);
+	}
+
+	bool readerFinished = false;
+	bool hasherFinished = false;
+	std::mutex mtx;
+	std::condition_variable cv;
+
+	auto maxDeviceReads = mtt::config::getInternal().checkReadsPerDevice;
+	auto& deviceLimit = getDeviceReadLimit(std::filesystem::u8path(path));
+
+	uint32_t batchesCount = (last - first + batchSize - 1) / batchSize;
+
+	std::thread reader([&]()
 		{
-			fileIn.open(fullpath, std::ios_base::binary);
+			PieceReadState state;
 
-			if (fileIn)
+			for (uint32_t b = 0; b < batchesCount && !checkState.rejected; b++)
 			{
-				size_t existingSize = std::filesystem::file_size(fullpath);
+				auto& buffer = buffers[b % 2];
 
-				if (existingSize == currentFile->size)
 				{
-					auto readSize = pieceSize - currentFile->startPiecePos;
-					auto readBufferPos = currentFile->startPiecePos;
+					std::unique_lock<std::mutex> guard(mtx);
+					cv.wait(guard, [&]() { return !buffer.ready || hasherFinished; });
 
-					fileIn.read((char*)readBuffer.data() + readBufferPos, readSize);
+					if (hasherFinished)
+						break;
+				}
 
-					while (fileIn && !checkState.rejected && currentPieceIdx <= currentFile->endPieceIndex)
-					{
-						_SHA1(readBuffer.data(), pieceSize, shaBuffer);
-						checkState.pieces[currentPieceIdx] = memcmp(shaBuffer, piecesInfo[currentPieceIdx].hash, 20) == 0;
-						fileIn.read((char*)readBuffer.data(), pieceSize);
+				uint32_t batchFirst = first + b * batchSize;
+				uint32_t batchLast = std::min(last, batchFirst + batchSize);
+				bool copyNeeded = false;
 
-						checkState.piecesChecked = (uint32_t)++currentPieceIdx;
-					}
+				for (uint32_t i = batchFirst; i < batchLast; i++)
+				{
+					uint32_t pos = i - batchFirst;
+					buffer.pieces[pos] = mapPiece(i, buffer.sizes[pos], layout, state, buffer.mappedOwners[pos]);
+					copyNeeded |= !buffer.pieces[pos];
+				}
+
+				//memory is acquired before device limit, so waiting for it never holds reads of other checks
+				if (copyNeeded && !buffersSize)
+				{
+					buffersSize = 2 * (size_t)pieceSize * batchSize;
+					memoryLimit.acquire(buffersSize, mtt::config::getInternal().maxCheckBufferSize);
+
+					for (auto& buf : buffers)
+						buf.data.resize((size_t)pieceSize * batchSize);
+				}
 
-					if (currentPieceIdx == currentFile->endPieceIndex && currentFile == lastFile)
+				deviceLimit.acquire(maxDeviceReads);
+				for (uint32_t i = batchFirst; i < batchLast; i++)
+				{
+					uint32_t pos = i - batchFirst;
+
+					if (buffer.pieces[pos])
 					{
-						_SHA1(readBuffer.data(), currentFile->endPiecePos, shaBuffer);
-						checkState.pieces[currentPieceIdx] = memcmp(shaBuffer, piecesInfo[currentPieceIdx].hash, 20) == 0;
-						++currentPieceIdx;
+						touchMappedPages(buffer.pieces[pos], buffer.sizes[pos]);
+						buffer.valid[pos] = true;
+					}
+					else
+					{
+						buffer.pieces[pos] = buffer.data.data() + (size_t)pos * pieceSize;
+						buffer.valid[pos] = readPiece(i, buffer.data.data() + (size_t)pos * pieceSize, buffer.sizes[pos], layout, state);
 					}
 				}
-				else
+				deviceLimit.release(maxDeviceReads);
+
 				{
-					auto startPieceSize = pieceSize - currentFile->startPiecePos;
-					auto endPieceSize = currentFile->endPiecePos;
-					auto tempFileSize = startPieceSize + endPieceSize;
+					std::lock_guard<std::mutex> guard(mtx);
+					buffer.ready = true;
+				}
+				cv.notify_all();
+			}
 
-					if (existingSize == tempFileSize || existingSize == startPieceSize)
-					{
-						fileIn.read((char*)readBuffer.data() + currentFile->startPiecePos, startPieceSize);
+			{
+				std::lock_guard<std::mutex> guard(mtx);
+				readerFinished = true;
+			}
+			cv.notify_all();
+		});
 
-						_SHA1(readBuffer.data(), pieceSize, shaBuffer);
-						checkState.pieces[currentFile->startPieceIndex] = memcmp(shaBuffer, piecesInfo[currentFile->startPieceIndex].hash, 20) == 0;
+	std::vector<const uint8_t*> hashData;
+	std::vector<uint32_t> hashIndex;
+	std::vector<uint8_t> shaBuffer(batchSize * SHA_DIGEST_LENGTH);
 
-						if(existingSize == tempFileSize)
-							fileIn.read((char*)readBuffer.data(), endPieceSize);
-					}
-				}
+	for (uint32_t b = 0; b < batchesCount && !checkState.rejected; b++)
+	{
+		auto& buffer = buffers[b % 2];
+
+		{
+			std::unique_lock<std::mutex> guard(mtx);
+			cv.wait(guard, [&]() { return buffer.ready || readerFinished; });
+
+			if (!buffer.ready)
+				break;
+		}
+
+		uint32_t batchFirst = first + b * batchSize;
+		uint32_t batchLast = std::min(last, batchFirst + batchSize);
+
+		hashData.clear();
+		hashIndex.clear();
+
+		for (uint32_t i = batchFirst; i < batchLast; i++)
+		{
+			uint32_t pos = i - batchFirst;
+
+			if (!buffer.valid[pos])
+				continue;
+
+			const uint8_t* data = buffer.pieces[pos];
+
+			//only full pieces share size, last piece is hashed alone
+			if (buffer.sizes[pos] == pieceSize)
+			{
+				hashData.push_back(data);
+				hashIndex.push_back(i);
 			}
+			else
+			{
+				_SHA1(data, buffer.sizes[pos], shaBuffer.data());
+				checkState.pieces[i] = memcmp(shaBuffer.data(), piecesInfo[i].hash, SHA_DIGEST_LENGTH) == 0;
+			}
+		}
 
-			fileIn.close();
+		if (!hashData.empty())
+		{
+			Sha1::hashBatch(hashData.data(), hashData.size(), pieceSize, shaBuffer.data());
+
+			for (size_t h = 0; h < hashIndex.size(); h++)
+				checkState.pieces[hashIndex[h]] = memcmp(shaBuffer.data() + h * SHA_DIGEST_LENGTH, piecesInfo[hashIndex[h]].hash, SHA_DIGEST_LENGTH) == 0;
 		}
 
-		if (currentPieceIdx < currentFile->endPieceIndex)
-			currentPieceIdx = currentFile->endPieceIndex;
+		checkState.piecesChecked += batchLast - batchFirst;
 
-		if (currentFile == lastFile)
-			currentPieceIdx = currentFile->endPieceIndex + 1;
+		for (auto& owner : buffer.mappedOwners)
+			owner.reset();
 
-		checkState.piecesChecked = (uint32_t)currentPieceIdx;
+		{
+			std::lock_guard<std::mutex> guard(mtx);
+			buffer.ready = false;
+		}
+		cv.notify_all();
+	}
 
-		if (checkState.rejected)
-			return;
+	{
+		std::lock_guard<std::mutex> guard(mtx);
+		hasherFinished = true;
+	}
+	cv.notify_all();
+
+	reader.join();
+
+	for (auto& buffer : buffers)
+		DataBuffer().swap(buffer.data);
+	if (buffersSize)
+		memoryLimit.release(buffersSize);
+}
+
+bool mtt::Storage::readPiece(uint32_t index, uint8_t* buffer, uint32_t& dataSize, const std::vector<FileLayout>& layout, PieceReadState& state)
+{
+	uint64_t fullSize = getFileOffset(files.back()) + files.back().size;
+	uint64_t pieceStart = index * (uint64_t)pieceSize;
+	uint64_t pieceEnd = std::min(pieceStart + pieceSize, fullSize);
 
-		if(++currentFile > lastFile)
+	if (pieceStart >= pieceEnd)
+		return false;
+
+	dataSize = (uint32_t)(pieceEnd - pieceStart);
+
+	if (state.fileIdx >= files.size() || getFileOffset(files[state.fileIdx]) > pieceStart)
+		state.fileIdx = 0;
+
+	while (state.fileIdx < files.size() && getFileOffset(files[state.fileIdx]) + files[state.fileIdx].size <= pieceStart)
+		state.fileIdx++;
+
+	for (size_t i = state.fileIdx; i < files.size(); i++)
+	{
+		uint64_t fileStart = getFileOffset(files[i]);
+		uint64_t fileEnd = fileStart + files[i].size;
+
+		if (fileStart >= pieceEnd)
 			break;
+
+		if (fileStart == fileEnd)
+			continue;
+
+		uint64_t dataStart = std::max(fileStart, pieceStart);
+		uint64_t dataEnd = std::min(fileEnd, pieceEnd);
+
+		if (!readFileData(i, dataStart - fileStart, (size_t)(dataEnd - dataStart), buffer + (dataStart - pieceStart), layout[i], state))
+			return false;
+	}
+
+	return true;
+}
+
+const uint8_t* mtt::Storage::mapPiece(uint32_t index, uint32_t& dataSize, const std::vector<FileLayout>& layout, PieceReadState& state, std::shared_ptr<void>& owner)
+{
+	if (!mappedStorage)
+		return nullptr;
+
+	uint64_t fullSize = getFileOffset(files.back()) + files.back().size;
+	uint64_t pieceStart = index * (uint64_t)pieceSize;
+	uint64_t pieceEnd = std::min(pieceStart + pieceSize, fullSize);
+
+	if (pieceStart >= pieceEnd)
+		return nullptr;
+
+	if (state.fileIdx >= files.size() || getFileOffset(files[state.fileIdx]) > pieceStart)
+		state.fileIdx = 0;
+
+	while (state.fileIdx < files.size() && getFileOffset(files[state.fileIdx]) + files[state.fileIdx].size <= pieceStart)
+		state.fileIdx++;
+
+	if (state.fileIdx >= files.size())
+		return nullptr;
+
+	//pieces spanning files or in partial files are read into buffer
+	auto& file = files[state.fileIdx];
+	uint64_t fileStart = getFileOffset(file);
+	if (fileStart + file.size < pieceEnd || layout[state.fileIdx] != FileLayout::Full)
+		return nullptr;
+
+	auto mapping = getCheckMapping(state.fileIdx, state);
+	if (!mapping)
+		return nullptr;
+
+	dataSize = (uint32_t)(pieceEnd - pieceStart);
+	return mapping->map(pieceStart - fileStart, dataSize, owner);
+}
+
+FileMapping* mtt::Storage::getCheckMapping(size_t fileIdx, PieceReadState& state)
+{
+	if (state.mappings.size() != files.size())
+		state.mappings.resize(files.size());
+
+	auto& mapping = state.mappings[fileIdx];
+	if (!mapping)
+	{
+		mapping = std::make_unique<FileMapping>();
+
+		if (!mapping->open(getFullpath(files[fileIdx])) || mapping->size() != files[fileIdx].size)
+			mapping.reset();
 	}
+
+	return mapping.get();
+}
+
+bool mtt::Storage::readFileData(size_t fileIdx, uint64_t offset, size_t size, uint8_t* out, FileLayout layout, PieceReadState& state)
+{
+	auto& file = files[fileIdx];
+
+	if (layout == FileLayout::Missing)
+		return false;
+
+	//partial file contains only first and last piece data following each other
+	if (layout != FileLayout::Full)
+	{
+		uint64_t startPieceSize = pieceSize - file.startPiecePos;
+		uint64_t endPieceStart = file.size - file.endPiecePos;
+
+		if (offset + size > startPieceSize)
+		{
+			if (layout == FileLayout::StartEndPieces && offset >= endPieceStart)
+				offset = startPieceSize + (offset - endPieceStart);
+			else
+				return false;
+		}
+	}
+
+	if (mappedStorage && layout == FileLayout::Full)
+	{
+		//not mappable, read through streams instead
+		if (auto mapping = getCheckMapping(fileIdx, state))
+		{
+			if (auto data = mapping->map(offset, size))
+			{
+				memcpy(out, data, size);
+				return true;
+			}
+
+			return false;
+		}
+	}
+
+	if (state.streamFileIdx != fileIdx)
+	{
+		state.stream.close();
+		state.stream.clear();
+		state.stream.open(getFullpath(file), std::ios_base::binary);
+		state.streamFileIdx = fileIdx;
+	}
+
+	state.stream.clear();
+	state.stream.seekg(offset);
+	state.stream.read((char*)out, size);
+
+	return (size_t)state.stream.gcount() == size;
 }
 
 std::shared_ptr<mtt::PiecesCheck> mtt::Storage::checkStoredPiecesAsync(std::vector<PieceInfo>& piecesInfo, asio::io_service& io, std::function<void(std::shared_ptr<PiecesCheck>)> onFinish)
@@ -435,6 +1054,8 @@ mtt::Status mtt::Storage::preallocate(File& file)
 	createPath(fullpath);
 	if (!std::filesystem::exists(fullpath) || std::filesystem::file_size(fullpath) != file.size)
 	{
+		FileHandleCache::Get().close(fullpath);
+
 		std::error_code ec;
 		auto spaceInfo = std::filesystem::space(path, ec);
 		if (ec)
@@ -454,6 +1075,102 @@ mtt::Status mtt::Storage::preallocate(File& file)
 	return Status::Success;
 }
 
+FileMapping* mtt::Storage::getMappedFile(size_t fileIdx)
+{
+	if (mappedFiles.size() != files.size())
+	{
+		mappedFiles.clear();
+		mappedFiles.resize(files.size());
+	}
+
+	auto& mapping = mappedFiles[fileIdx];
+
+	if (!mapping)
+	{
+		mapping = std::make_unique<FileMapping>();
+
+		//map only fully allocated files, anything else goes through streams
+		if (!mapping->open(getFullpath(files[fileIdx])) || mapping->size() != files[fileIdx].size)
+		{
+			mapping.reset();
+			return nullptr;
+		}
+	}
+
+	return mapping.get();
+}
+
+void mtt::Storage::closeMappedFiles()
+{
+	mappedFiles.clear();
+}
+
+bool mtt::Storage::isValidBlock(const PieceBlockInfo& block)
+{
+	if (files.empty() || block.index > files.back().endPieceIndex || block.length == 0)
+		return false;
+
+	uint32_t size = (block.index == files.back().endPieceIndex) ? files.back().endPiecePos : pieceSize;
+
+	return (uint64_t)block.begin + block.length <= size;
+}
+
+bool mtt::Storage::loadMappedBlock(PieceBlockInfo& block, DataBuffer& out)
+{
+	{
+		std::lock_guard<std::mutex> guard(storageMutex);
+
+		if (findUnsavedPiece(block.index))
+			return false;
+	}
+
+	uint64_t blockStart = block.index * (uint64_t)pieceSize + block.begin;
+	uint64_t blockEnd = blockStart + block.length;
+
+	if (!isValidBlock(block) || blockEnd > getFileOffset(files.back()) + files.back().size)
+		return false;
+
+	out.resize(block.length);
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		uint64_t fileStart = getFileOffset(files[i]);
+		uint64_t fileEnd = fileStart + files[i].size;
+
+		if (fileStart >= blockEnd)
+			break;
+
+		if (fileEnd <= blockStart || fileStart == fileEnd)
+			continue;
+
+		auto mapping = getMappedFile(i);
+		if (!mapping)
+		{
+			out.clear();
+			return false;
+		}
+
+		uint64_t dataStart = std::max(fileStart, blockStart);
+		uint64_t dataEnd = std::min(fileEnd, blockEnd);
+
+		auto fileData = mapping->map(dataStart - fileStart, (size_t)(dataEnd - dataStart));
+		if (!fileData)
+		{
+			out.clear();
+			return false;
+		}
+
+		memcpy(out.data() + (dataStart - blockStart), fileData, (size_t)(dataEnd - dataStart));
+	}
+
+	return true;
+}
+
+uint64_t mtt::Storage::getFileOffset(File& file)
+{
+	return file.startPieceIndex * (uint64_t)pieceSize + file.startPiecePos;
+}
+
 std::filesystem::path mtt::Storage::getFullpath(File& file)
 {
 	std::string filePath;
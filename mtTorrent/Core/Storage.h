@@ -1,8 +1,11 @@
 #pragma once
 
 #include "Interface.h"
+#include "utils/FileMapping.h"
 #include <filesystem>
+#include <fstream>
 #include <mutex>
+#include <condition_variable>
 
 namespace mtt
 {
@@ -18,13 +21,17 @@ namespace mtt
 		Status setPath(std::string path, bool moveFiles = true);
 		std::string getPath();
 
-		void storePiece(DownloadedPiece& piece);
+		void storePiece(DownloadedPiece&& piece);
 		PieceBlock getPieceBlock(PieceBlockInfo& piece);
+		//block data in mapped file without copying, mapping is kept while owner exists
+		bool getMappedBlock(PieceBlockInfo& block, BufferView& data, std::shared_ptr<void>& owner);
 
 		Status preallocateSelection(DownloadSelection& files);
 		DataBuffer checkStoredPieces(std::vector<PieceInfo>& piecesInfo);
 		std::shared_ptr<PiecesCheck> checkStoredPiecesAsync(std::vector<PieceInfo>& piecesInfo, asio::io_service& io, std::function<void(std::shared_ptr<PiecesCheck>)> onFinish);
 		void flush();
+		bool isWriteQueueFull();
+		WriteQueueInfo getWriteQueueInfo();
 
 		Status deleteAll();
 		int64_t getLastModifiedTime();
@@ -33,13 +40,32 @@ namespace mtt
 
 		void checkStoredPieces(PiecesCheck& checkState, const std::vector<PieceInfo>& piecesInfo);
 
+		enum class FileLayout { Missing, Full, StartPiece, StartEndPieces };
+		std::vector<FileLayout> getFilesLayout();
+
+		struct PieceReadState
+		{
+			size_t fileIdx = 0;
+			std::ifstream stream;
+			size_t streamFileIdx = -1;
+			std::vector<std::unique_ptr<FileMapping>> mappings;
+		};
+		void checkPiecesRange(PiecesCheck& checkState, const std::vector<PieceInfo>& piecesInfo, const std::vector<FileLayout>& layout, uint32_t first, uint32_t last, uint32_t batchSize);
+		//piece data within one mapped file, null when it has to be read
+		const uint8_t* mapPiece(uint32_t index, uint32_t& dataSize, const std::vector<FileLayout>& layout, PieceReadState& state, std::shared_ptr<void>& owner);
+		FileMapping* getCheckMapping(size_t fileIdx, PieceReadState& state);
+		bool readPiece(uint32_t index, uint8_t* buffer, uint32_t& dataSize, const std::vector<FileLayout>& layout, PieceReadState& state);
+		bool readFileData(size_t fileIdx, uint64_t offset, size_t size, uint8_t* out, FileLayout layout, PieceReadState& state);
+
 		std::filesystem::path getFullpath(File& file);
 		void createPath(const std::filesystem::path& path);
 
 		mtt::Status validatePath(DownloadSelection& selection);
 
-		void flushAllFiles();
-		void flush(File& file);
+		void scheduleWrite();
+		void writeUnsavedPieces();
+		void writePieces(std::vector<DownloadedPiece>& pieces);
+		void flush(File& file, std::vector<DownloadedPiece*>& pieces);
 		Status preallocate(File& file);
 
 		std::string path;
@@ -65,9 +91,20 @@ namespace mtt
 			}
 		};
 
-		CachedData<DownloadedPiece, 6> unsavedPieces;
+		std::vector<DownloadedPiece> unsavedPieces;
+		std::vector<DownloadedPiece> writtenPieces;
+		DownloadedPiece* findUnsavedPiece(uint32_t index);
 		std::mutex storageMutex;
 
+		bool writeScheduled = false;
+		std::condition_variable writeFinished;
+		std::mutex writeMutex;
+
+		size_t unsavedSize = 0;
+		std::chrono::steady_clock::time_point unsavedStartTime;
+		uint32_t lastWriteLatency = 0;
+		uint32_t averageWriteLatency = 0;
+
 		struct CachedPiece
 		{
 			uint32_t index;
@@ -76,8 +113,19 @@ namespace mtt
 		CachedData<CachedPiece, 16> cachedPieces;
 		std::mutex cacheMutex;
 
-		CachedPiece& loadPiece(uint32_t pieceId);
-		void loadPiece(File& file, CachedPiece& piece);
+		//nullptr if piece data couldnt be read
+		CachedPiece* loadPiece(uint32_t pieceId);
+		bool loadPiece(File& file, CachedPiece& piece);
+
+		bool mappedStorage = false;
+		std::vector<std::unique_ptr<FileMapping>> mappedFiles;
+		FileMapping* getMappedFile(size_t fileIdx);
+		void closeMappedFiles();
+		bool loadMappedBlock(PieceBlockInfo& block, DataBuffer& out);
+
+		uint64_t getFileOffset(File& file);
+		//block range lies inside its piece
+		bool isValidBlock(const PieceBlockInfo& block);
 
 		std::vector<File> files;
 		uint32_t pieceSize;
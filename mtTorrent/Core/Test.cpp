@@ -14,6 +14,12 @@
 #include "MetadataDownload.h"
 #include "FileTransfer.h"
 #include "utils/HexEncoding.h"
+#include "utils/SHA.h"
+#include "utils/UtpManager.h"
+#include "utils/UdpAsyncReceiver.h"
+#include "utils/TimerWheel.h"
+#include "utils/BencodeWriter.h"
+#include <atomic>
 
 using namespace mtt;
 
@@ -103,7 +109,7 @@ void TorrentTest::connectionClosed(PeerCommunication*, int)
 void TorrentTest::testAsyncDhtGetPeers()
 {
 	ServiceThreadpool service;
-	mtt::dht::Communication dht;
+	mtt::dht::Communication dht(service);
 
 	//ZEF3LK3MCLY5HQGTIUVAJBFMDNQW6U3J	boku 26
 	//6QBN6XVGKV7CWOT5QXKDYWF3LIMUVK4I	owarimonogagtari batch
@@ -308,7 +314,7 @@ void TorrentTest::testStorageLoad()
 			memcpy(piece.data.data() + block.info.begin, block.data.data(), block.info.length);
 		}
 
-		outStorage.storePiece(piece);
+		outStorage.storePiece(std::move(piece));
 	}
 
 	outStorage.flush();
@@ -406,7 +412,7 @@ void TorrentTest::testDhtTable()
 
 	auto torrent = parseTorrentFile("D:\\hunter.torrent");
 
-	mtt::dht::Communication dhtComm;
+	mtt::dht::Communication dhtComm(ServiceThreadpool::session());
 	dhtComm.load();
 
 	//ZEF3LK3MCLY5HQGTIUVAJBFMDNQW6U3J	boku 26
@@ -455,6 +461,665 @@ void TorrentTest::testTorrentFileSerialization()
 	ok = memcmp(torrent.info.hash, torrentOut.info.hash, 20) == 0;
 }
 
+static const Sha1::Implementation shaImplementations[] = { Sha1::Implementation::Portable, Sha1::Implementation::Ssse3, Sha1::Implementation::Avx2, Sha1::Implementation::ShaNi };
+
+void TorrentTest::testSha()
+{
+	struct
+	{
+		std::string input;
+		size_t repeat;
+		const char* digest;
+	}
+	vectors[] =
+	{
+		{ "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+		{ "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+		{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1, "a49b2446a02c645bf419f995b67091253a04a259" },
+		{ "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" }
+	};
+
+	for (auto impl : shaImplementations)
+	{
+		if (!Sha1::isSupported(impl))
+		{
+			TEST_LOG(Sha1::getName(impl) << " not supported");
+			continue;
+		}
+
+		bool ok = true;
+
+		for (auto& v : vectors)
+		{
+			std::string input;
+			for (size_t i = 0; i < v.repeat; i++)
+				input += v.input;
+
+			uint8_t expected[SHA_DIGEST_LENGTH];
+			decodeHexa(v.digest, expected);
+
+			uint8_t md[SHA_DIGEST_LENGTH];
+			Sha1::hash(impl, (const uint8_t*)input.data(), input.size(), md);
+			ok &= memcmp(md, expected, SHA_DIGEST_LENGTH) == 0;
+		}
+
+		//all tail lengths against portable
+		DataBuffer data(1024);
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = (uint8_t)rand();
+
+		for (size_t size = 0; size <= data.size(); size++)
+		{
+			uint8_t md[SHA_DIGEST_LENGTH];
+			uint8_t mdPortable[SHA_DIGEST_LENGTH];
+			Sha1::hash(impl, data.data(), size, md);
+			Sha1::hash(Sha1::Implementation::Portable, data.data(), size, mdPortable);
+			ok &= memcmp(md, mdPortable, SHA_DIGEST_LENGTH) == 0;
+		}
+
+		//batch of buffers with same size, including count not divisible by lanes
+		const size_t batchCount = 11;
+		const size_t batchBufferSize = 1000;
+		std::vector<const uint8_t*> batchData;
+		for (size_t i = 0; i < batchCount; i++)
+			batchData.push_back(data.data() + i * 2);
+
+		DataBuffer batchMd(batchCount * SHA_DIGEST_LENGTH);
+		Sha1::hashBatch(impl, batchData.data(), batchCount, batchBufferSize, batchMd.data());
+
+		for (size_t i = 0; i < batchCount; i++)
+		{
+			uint8_t mdPortable[SHA_DIGEST_LENGTH];
+			Sha1::hash(Sha1::Implementation::Portable, batchData[i], batchBufferSize, mdPortable);
+			ok &= memcmp(batchMd.data() + i * SHA_DIGEST_LENGTH, mdPortable, SHA_DIGEST_LENGTH) == 0;
+		}
+
+		TEST_LOG(Sha1::getName(impl) << (ok ? " OK" : " FAILED"));
+	}
+}
+
+void TorrentTest::testPiecesProgress()
+{
+	const uint32_t piecesCount = 100;
+
+	PiecesProgress local;
+	local.init(piecesCount);
+
+	//HaveAll received before metadata, peer pieces are sized after
+	PiecesProgress seed;
+	seed.init(0);
+	seed.fromAll(true);
+	bool ok = seed.hasAll() && !seed.empty();
+
+	seed.resize(piecesCount);
+	ok &= seed.hasAll() && seed.getReceivedPiecesCount() == piecesCount && seed.hasPiece(piecesCount - 1);
+	ok &= local.wantsAnyFrom(seed);
+
+	std::vector<uint64_t> wanted;
+	ok &= local.getWantedFrom(seed, wanted) == piecesCount;
+
+	uint32_t receivedCount = 0;
+	seed.forEachReceived([&](uint32_t) { receivedCount++; });
+	ok &= receivedCount == piecesCount;
+
+	PiecesProgress leech;
+	leech.init(0);
+	leech.fromAll(false);
+	leech.resize(piecesCount);
+	ok &= leech.empty() && !local.wantsAnyFrom(leech);
+
+	TEST_LOG("Pieces progress" << (ok ? " OK" : " FAILED"));
+}
+
+void TorrentTest::benchmarkSha()
+{
+	const size_t pieceSize = 4 * 1024 * 1024;
+	const size_t piecesCount = 64;
+
+	DataBuffer data(pieceSize * piecesCount);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (uint8_t)i;
+
+	TEST_LOG("Active: " << Sha1::getName(Sha1::activeImplementation()) << ", batch: " << Sha1::getName(Sha1::batchImplementation()));
+
+	for (auto impl : shaImplementations)
+	{
+		if (!Sha1::isSupported(impl))
+			continue;
+
+		uint8_t md[SHA_DIGEST_LENGTH];
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < piecesCount; i++)
+			Sha1::hash(impl, data.data() + i * pieceSize, pieceSize, md);
+
+		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		TEST_LOG(Sha1::getName(impl) << ": " << data.size() / (1024.f * 1024) / std::max<float>(duration / 1000.f, 0.001f) << " MBps");
+
+		std::vector<const uint8_t*> batchData;
+		for (size_t i = 0; i < piecesCount; i++)
+			batchData.push_back(data.data() + i * pieceSize);
+
+		DataBuffer batchMd(piecesCount * SHA_DIGEST_LENGTH);
+		start = std::chrono::steady_clock::now();
+
+		Sha1::hashBatch(impl, batchData.data(), piecesCount, pieceSize, batchMd.data());
+
+		duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		TEST_LOG(Sha1::getName(impl) << " batch: " << data.size() / (1024.f * 1024) / std::max<float>(duration / 1000.f, 0.001f) << " MBps");
+	}
+}
+
+void TorrentTest::benchmarkPieceReceive()
+{
+	const uint32_t pieceSize = 4 * 1024 * 1024;
+	const uint32_t blocksCount = pieceSize / BlockRequestMaxSize;
+	const uint32_t piecesCount = 64;
+
+	DataBuffer blockData(BlockRequestMaxSize);
+	for (size_t i = 0; i < blockData.size(); i++)
+		blockData[i] = (uint8_t)i;
+
+	//received stream of all blocks of one piece
+	PacketBuilder stream((4 + 9 + BlockRequestMaxSize) * blocksCount);
+	for (uint32_t i = 0; i < blocksCount; i++)
+	{
+		stream.add32(9 + BlockRequestMaxSize);
+		stream.add(mtt::Piece);
+		stream.add32(0);
+		stream.add32(i * BlockRequestMaxSize);
+		stream.add(blockData.data(), blockData.size());
+	}
+	auto streamData = stream.getBuffer();
+
+	//socket reads fill all prepared receive space, messages are parsed same as in PeerCommunication
+	struct ReceiveStream : public TcpAsyncStream
+	{
+		ReceiveStream(asio::io_service& io) : TcpAsyncStream(io) {}
+
+		void read(BufferView& source)
+		{
+			size_t space;
+			auto target = prepareReceiveSpace(8 * 1024, space);
+			space = std::min(space, source.size());
+
+			memcpy(target, source.data(), space);
+			source = BufferView(source.data() + space, source.size() - space);
+
+			addReceivedData(space);
+		}
+	};
+
+	asio::io_service io;
+	auto receiveStream = std::make_shared<ReceiveStream>(io);
+
+	DownloadedPiece piece;
+	uint64_t storedSize = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t p = 0; p < piecesCount; p++)
+	{
+		piece.init(0, pieceSize, blocksCount);
+		BufferView source(streamData);
+
+		while (!source.empty())
+		{
+			receiveStream->read(source);
+
+			for (;;)
+			{
+				auto data = receiveStream->getReceivedData();
+				PeerMessage msg(data);
+				if (msg.id == mtt::Invalid)
+					break;
+
+				receiveStream->consumeData(msg.messageSize);
+
+				//only copy of received block
+				if (msg.id != mtt::Piece || !piece.addBlock(msg.piece))
+				{
+					TEST_LOG("Invalid piece message");
+					return;
+				}
+				storedSize += msg.piece.data.size();
+			}
+		}
+
+		if (piece.remainingBlocks != 0)
+		{
+			TEST_LOG("Piece incomplete");
+			return;
+		}
+	}
+
+	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	uint64_t downloadedSize = (uint64_t)pieceSize * piecesCount;
+	auto copiedSize = receiveStream->getReceiveCopiedCount() + storedSize;
+
+	TEST_LOG("Piece receive: " << downloadedSize / (1024.f * 1024) / std::max<float>(duration / 1000.f, 0.001f) << " MBps, "
+		<< copiedSize / (float)downloadedSize << " byte copies per downloaded byte after socket read");
+}
+
+void TorrentTest::benchmarkPieceRequests()
+{
+	const uint32_t piecesCount = 500000;
+	const uint32_t inFlightPieces = 4096;
+	const uint16_t blocksCount = 64;
+
+	//blocks of in flight pieces arrive interleaved, as from many peers
+	auto receiveAll = [&](auto find, auto add, auto remove)
+	{
+		for (uint32_t i = 0; i < inFlightPieces; i++)
+			add(i * (piecesCount / inFlightPieces));
+
+		for (uint16_t b = 0; b < blocksCount; b++)
+			for (uint32_t i = 0; i < inFlightPieces; i++)
+			{
+				uint32_t idx = i * (piecesCount / inFlightPieces);
+				auto r = find(idx);
+				r->blockRequests[b]--;
+				r->receivedSize += BlockRequestMaxSize;
+
+				if (b == blocksCount - 1)
+					remove(idx);
+			}
+	};
+
+	PieceRequestsTable table;
+	table.init(piecesCount);
+
+	auto start = std::chrono::steady_clock::now();
+
+	receiveAll([&](uint32_t idx) { return table.find(idx); },
+		[&](uint32_t idx) { table.add(idx, blocksCount)->blockRequests.assign(blocksCount, 1); },
+		[&](uint32_t idx) { table.setVerifying(idx); table.verified(idx); });
+
+	auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	TEST_LOG("Indexed requests: " << (uint64_t)inFlightPieces * blocksCount * 1000 / std::max<int64_t>(duration, 1) << " blocks per ms");
+
+	//previous linear scan of requests vector
+	std::vector<PieceRequest> requests;
+
+	start = std::chrono::steady_clock::now();
+
+	receiveAll([&](uint32_t idx)
+		{
+			for (auto& r : requests)
+				if (r.pieceIdx == idx)
+					return &r;
+			return (PieceRequest*)nullptr;
+		},
+		[&](uint32_t idx)
+		{
+			requests.emplace_back();
+			requests.back().pieceIdx = idx;
+			requests.back().blockRequests.assign(blocksCount, 1);
+		},
+		[&](uint32_t idx)
+		{
+			for (auto it = requests.begin(); it != requests.end(); it++)
+				if (it->pieceIdx == idx)
+				{
+					requests.erase(it);
+					break;
+				}
+		});
+
+	duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	TEST_LOG("Linear requests: " << (uint64_t)inFlightPieces * blocksCount * 1000 / std::max<int64_t>(duration, 1) << " blocks per ms");
+}
+
+void TorrentTest::benchmarkPeerEvents()
+{
+	const uint32_t torrentsCount = 8;
+	const uint32_t peersCount = 4;
+	const uint32_t pieceSize = 1024 * 1024;
+	const uint32_t piecesCount = 16;
+
+	//all torrents share content, names make their hashes differ
+	DataBuffer content((size_t)pieceSize * piecesCount);
+	for (size_t i = 0; i < content.size(); i++)
+		content[i] = (uint8_t)(i * 13 + i / 1000);
+
+	DataBuffer hashes(piecesCount * SHA_DIGEST_LENGTH);
+	for (uint32_t i = 0; i < piecesCount; i++)
+		_SHA1(content.data() + (size_t)i * pieceSize, pieceSize, hashes.data() + i * SHA_DIGEST_LENGTH);
+
+	//remote seed answers requests from memory, answers are received through same buffer and callbacks as socket reads
+	struct SeedStream : public TcpAsyncStream
+	{
+		SeedStream(asio::io_service& io, const DataBuffer& c, uint32_t size) : TcpAsyncStream(io), content(c), pieceSize(size)
+		{
+			state = Connected;
+			info.host = "seed";
+		}
+
+		//handshake read by incoming peers listener, followed by pieces and unchoke
+		void start(const uint8_t* hash)
+		{
+			PacketBuilder packet(128);
+			packet.add(19);
+			packet.add("BitTorrent protocol", 19);
+			uint8_t reserved[8] = {};
+			reserved[7] |= 0x04;
+			packet.add(reserved, 8);
+			packet.add(hash, 20);
+			uint8_t peerId[20] = {};
+			packet.add(peerId, 20);
+
+			packet.add32(1);
+			packet.add(mtt::HaveAll);
+			packet.add32(1);
+			packet.add(mtt::Unchoke);
+
+			{
+				std::lock_guard<std::mutex> guard(incomingMutex);
+				incoming.out = std::move(packet.out);
+			}
+			receive();
+		}
+
+		//called with write_mutex, answers of written requests are received later on io thread
+		virtual void startWrite() override
+		{
+			BufferView data(pendingWrite.out);
+
+			std::lock_guard<std::mutex> guard(incomingMutex);
+			size_t incomingSize = incoming.out.size();
+
+			for (;;)
+			{
+				PeerMessage msg(data);
+				if (msg.id == mtt::Invalid)
+					break;
+
+				data = BufferView(data.data() + msg.messageSize, data.size() - msg.messageSize);
+
+				if (msg.id == mtt::Request)
+				{
+					incoming.add32(9 + msg.request.length);
+					incoming.add(mtt::Piece);
+					incoming.add32(msg.request.index);
+					incoming.add32(msg.request.begin);
+					incoming.add(content.data() + (size_t)msg.request.index * pieceSize + msg.request.begin, msg.request.length);
+				}
+			}
+
+			pendingWrite.out.clear();
+			pendingPayloads.clear();
+			writing = false;
+
+			if (incoming.out.size() > incomingSize)
+				io_service.post([this, self = shared_from_this()]() { runCallback([this, self]() { receive(); }); });
+		}
+
+		void receive()
+		{
+			//one read at a time, as with socket
+			std::lock_guard<std::mutex> guard(receiveMutex);
+			{
+				std::lock_guard<std::mutex> guard(incomingMutex);
+
+				if (incoming.out.empty())
+					return;
+
+				size_t space;
+				auto target = prepareReceiveSpace(incoming.out.size(), space);
+				memcpy(target, incoming.out.data(), incoming.out.size());
+				addReceivedData(incoming.out.size());
+				incoming.out.clear();
+			}
+
+			notifyReceived();
+		}
+
+		const DataBuffer& content;
+		uint32_t pieceSize;
+
+		std::mutex incomingMutex;
+		PacketBuilder incoming;
+		std::mutex receiveMutex;
+	};
+
+	//only added seeds are used
+	auto dhtSettings = mtt::config::getExternal().dht;
+	auto benchmarkDhtSettings = dhtSettings;
+	benchmarkDhtSettings.enable = false;
+	mtt::config::setValues(benchmarkDhtSettings);
+
+	//session services as set up by core
+	auto& service = ServiceThreadpool::session();
+	service.setWorkersLimits(1, std::max(1u, std::thread::hardware_concurrency()));
+	mtt::dht::Communication dht(service);
+
+	std::vector<TorrentPtr> torrents;
+	for (uint32_t t = 0; t < torrentsCount; t++)
+	{
+		BencodeWriter writer;
+		writer.startMap();
+		writer.startRawMapItem("4:info");
+		writer.addRawItem("6:length", content.size());
+		writer.addRawItem("4:name", "peerEventsBenchmark" + std::to_string(t));
+		writer.addRawItem("12:piece length", pieceSize);
+		writer.addRawItemFromBuffer("6:pieces", (const char*)hashes.data(), hashes.size());
+		writer.endMap();
+		writer.endMap();
+
+		auto fileInfo = mtt::TorrentFileParser::parse((const uint8_t*)writer.data.data(), writer.data.size());
+		auto torrent = Torrent::fromFile(fileInfo);
+
+		if (!torrent || !torrent->start())
+		{
+			TEST_LOG("Peer events benchmark torrent failed");
+			break;
+		}
+
+		torrents.push_back(torrent);
+	}
+
+	if (torrents.size() == torrentsCount)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (auto& torrent : torrents)
+			for (uint32_t p = 0; p < peersCount; p++)
+			{
+				auto stream = std::make_shared<SeedStream>(torrent->service.io, content, pieceSize);
+				stream->start(torrent->hash());
+				torrent->peers->add(stream);
+			}
+
+		auto allFinished = [&]()
+		{
+			for (auto& torrent : torrents)
+				if (!torrent->finished())
+					return false;
+			return true;
+		};
+
+		WAITFOR(allFinished() || std::chrono::steady_clock::now() - start > std::chrono::seconds(120));
+
+		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		uint64_t downloadedSize = (uint64_t)content.size() * torrentsCount;
+
+		if (!allFinished())
+			TEST_LOG("Peer events benchmark didnt finish")
+		else
+			TEST_LOG("Peer events: " << torrentsCount << " torrents with " << peersCount << " peers, " << downloadedSize / (1024.f * 1024) / std::max<float>(duration / 1000.f, 0.001f) << " MBps, "
+				<< downloadedSize / BlockRequestMaxSize / std::max<int64_t>(duration, 1) << " blocks per ms");
+	}
+
+	for (auto& torrent : torrents)
+	{
+		torrent->stop();
+		torrent->files.storage.deleteAll();
+	}
+
+	mtt::config::setValues(dhtSettings);
+}
+
+void TorrentTest::benchmarkTimeouts()
+{
+	const uint32_t connectionsCount = 20000;
+	//each received packet restarts timeout of its connection
+	const uint32_t packetsPerConnection = 50;
+
+	ServiceThreadpool pool(1);
+
+	{
+		std::vector<std::unique_ptr<asio::steady_timer>> timers;
+		for (uint32_t i = 0; i < connectionsCount; i++)
+			timers.push_back(std::make_unique<asio::steady_timer>(pool.io));
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t p = 0; p < packetsPerConnection; p++)
+			for (auto& timer : timers)
+			{
+				timer->expires_from_now(std::chrono::seconds(60));
+				timer->async_wait([](const asio::error_code&) {});
+			}
+
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		TEST_LOG("Timer heap: " << (uint64_t)connectionsCount * packetsPerConnection * 1000 / std::max<int64_t>(duration, 1) << " restarts per ms");
+
+		for (auto& timer : timers)
+			timer->cancel();
+	}
+
+	{
+		TimerWheel wheel(pool.io);
+		std::vector<std::shared_ptr<TimerWheel::Timer>> timers;
+		for (uint32_t i = 0; i < connectionsCount; i++)
+			timers.push_back(wheel.create([]() {}));
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t p = 0; p < packetsPerConnection; p++)
+			for (auto& timer : timers)
+				timer->expireAfter(60 * 1000);
+
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		TEST_LOG("Timer wheel: " << (uint64_t)connectionsCount * packetsPerConnection * 1000 / std::max<int64_t>(duration, 1) << " restarts per ms");
+
+		for (auto& timer : timers)
+			timer->cancel();
+	}
+
+	pool.stop();
+}
+
+void TorrentTest::testUtpTransfer()
+{
+	//loopback link with one way delay, limited rate and packet loss
+	const uint32_t delayMs = 25;
+	const uint32_t linkRate = 2 * 1024 * 1024;
+	const uint32_t lossPerMille = 2;
+	const size_t dataSize = 16 * 1024 * 1024;
+
+	ServiceThreadpool pool(4);
+
+	struct Node
+	{
+		Node(ServiceThreadpool& pool) : manager(pool) {}
+
+		UtpManager manager;
+		std::shared_ptr<UdpAsyncReceiver> socket;
+		std::mutex linkMutex;
+		std::chrono::steady_clock::time_point linkFree;
+	}
+	nodes[2] = { pool, pool };
+
+	for (uint16_t i = 0; i < 2; i++)
+	{
+		auto& node = nodes[i];
+		node.socket = std::make_shared<UdpAsyncReceiver>(pool.io, 56001 + i, false);
+		node.socket->receiveCallback = [&node](udp::endpoint& source, DataBuffer& data) { node.manager.onUdpPacket(source, data); };
+		node.socket->listen();
+
+		node.manager.setTransport([&](const udp::endpoint& endpoint, const uint8_t* data, size_t size)
+			{
+				if ((uint32_t)rand() % 1000 < lossPerMille)
+					return;
+
+				//packets queue at bottleneck, which creates delay watched by LEDBAT
+				auto now = std::chrono::steady_clock::now();
+				std::chrono::steady_clock::time_point arrival;
+				{
+					std::lock_guard<std::mutex> guard(node.linkMutex);
+					node.linkFree = std::max(node.linkFree, now) + std::chrono::microseconds(size * 1000000ull / linkRate);
+					arrival = node.linkFree + std::chrono::milliseconds(delayMs);
+				}
+
+				auto packet = std::make_shared<DataBuffer>(data, data + size);
+				auto timer = std::make_shared<asio::steady_timer>(pool.io);
+				timer->expires_at(arrival);
+				timer->async_wait([&node, timer, packet, endpoint](const asio::error_code&)
+					{
+						node.socket->sendTo(endpoint, packet->data(), packet->size());
+					});
+			});
+	}
+
+	DataBuffer data(dataSize);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (uint8_t)(i * 13 + i / 1000);
+
+	std::atomic<size_t> received = 0;
+	std::atomic<bool> corrupted = false;
+	std::shared_ptr<UtpStream> accepted;
+
+	nodes[1].manager.listen(pool.io, [&](std::shared_ptr<UtpStream> stream)
+		{
+			accepted = stream;
+			auto s = stream.get();
+			s->onReceiveCallback = [&, s]()
+			{
+				auto d = s->getReceivedData();
+				if (received + d.size() > data.size() || memcmp(d.data(), data.data() + received, d.size()) != 0)
+					corrupted = true;
+
+				received += d.size();
+				s->consumeData(d.size());
+			};
+		});
+
+	auto stream = std::make_shared<UtpStream>(pool.io, nodes[0].manager);
+	stream->connect("127.0.0.1", 56002);
+	stream->write(data);
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t delaySum = 0;
+	uint32_t delaySamples = 0;
+
+	WAITFOR2(received == data.size() || corrupted || std::chrono::steady_clock::now() - start > std::chrono::seconds(60),
+		{
+			auto info = stream->getInfo();
+			delaySum += info.queuingDelay;
+			delaySamples++;
+		});
+
+	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	auto info = stream->getInfo();
+
+	if (corrupted || received != data.size())
+		TEST_LOG("uTP transfer failed, received " << received << " corrupted " << corrupted)
+	else
+		TEST_LOG("uTP transfer: " << dataSize / 1024.f / std::max<float>(duration / 1000.f, 0.001f) << " KBps of " << linkRate / 1024 << " KBps link, average queuing delay "
+			<< delaySum / std::max(delaySamples, 1u) / 1000 << " ms, retransmissions " << info.retransmissions);
+
+	stream->close();
+	if (accepted)
+		accepted->close();
+
+	nodes[0].manager.stop();
+	nodes[1].manager.stop();
+	nodes[0].socket->stop();
+	nodes[1].socket->stop();
+	pool.stop();
+}
+
 void TorrentTest::bigTestGetTorrentFileByLink()
 {
 	std::string link = "magnet:?xt=urn:btih:5AYWR2LK3ORHWRI2Y6BVBUX6QAUF2SDP&tr=http://nyaa.tracker.wf:7777/announce&tr=udp://tracker.coppersurfer.tk:6969/announce&tr=udp://tracker.internetwarriors.net:1337/announce&tr=udp://tracker.leechersparadise.org:6969/announce&tr=udp://tracker.opentrackr.org:1337/announce&tr=udp://open.stealth.si:80/announce&tr=udp://p4p.arenabg.com:1337/announce&tr=udp://mgtracker.org:6969/announce&tr=udp://tracker.tiny-vps.com:6969/announce&tr=udp://peerfect.org:6969/announce&tr=http://share.camoe.cn:8080/announce&tr=http://t.nyaatracker.com:80/announce&tr=https://open.kickasstracker.com:443/announce";//GetClipboardText();
@@ -530,8 +1195,8 @@ void TorrentTest::bigTestGetTorrentFileByLink()
 
 				if (pieceTodo.remainingBlocks == 0)
 				{
-					storage.storePiece(pieceTodo);
 					piecesTodo.addPiece(pieceTodo.index);
+					storage.storePiece(std::move(pieceTodo));
 					finished = true;
 					finishedPieces++;
 				}
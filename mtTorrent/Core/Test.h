@@ -54,6 +54,14 @@ public:
 	void testTorrentFileSerialization();
 	void bigTestGetTorrentFileByLink();
 	void idealMagnetLinkTest();
+	void testSha();
+	void testPiecesProgress();
+	void benchmarkSha();
+	void benchmarkPieceReceive();
+	void benchmarkPieceRequests();
+	void benchmarkPeerEvents();
+	void benchmarkTimeouts();
+	void testUtpTransfer();
 
 	void start();
 
@@ -9,6 +9,26 @@
 #include <filesystem>
 #include "AlertsManager.h"
 
+//blocking checks of stored files, kept off session executor
+//torrents are checked concurrently, reads are limited per device and buffers by shared check memory
+static ServiceThreadpool& getCheckService()
+{
+	static ServiceThreadpool checkService([]()
+		{
+			uint32_t threads = mtt::config::getInternal().checkThreads;
+			if (threads == 0)
+				threads = std::max(1u, std::thread::hardware_concurrency());
+
+			return std::min(threads, 20u);
+		}());
+
+	return checkService;
+}
+
+mtt::Torrent::Torrent() : service(ServiceThreadpool::session())
+{
+}
+
 mtt::TorrentPtr mtt::Torrent::fromFile(mtt::TorrentFileInfo& fileInfo)
 {
 	mtt::TorrentPtr torrent = std::make_shared<Torrent>();
@@ -45,9 +65,11 @@ mtt::TorrentPtr mtt::Torrent::fromSavedState(std::string name)
 
 	if (auto ptr = fromFile(mtt::TorrentFileParser::parse(buffer.data(), buffer.size())))
 	{
-		TorrentState state(ptr->files.progress.pieces);
+		std::vector<uint8_t> pieces;
+		TorrentState state(pieces);
 		if (state.load(name))
 		{
+			ptr->files.progress.fromState(pieces);
 			ptr->files.storage.init(ptr->infoFile.info, state.downloadPath);
 
 			if (ptr->files.selection.files.size() == state.files.size())
@@ -89,7 +111,9 @@ void mtt::Torrent::save()
 	if (!stateChanged)
 		return;
 
-	TorrentState saveState(files.progress.pieces);
+	std::vector<uint8_t> pieces;
+	files.progress.toState(pieces);
+	TorrentState saveState(pieces);
 	saveState.downloadPath = files.storage.getPath();
 	saveState.lastStateTime = lastStateTime = files.storage.getLastModifiedTime();
 	saveState.started = state == State::Started;
@@ -263,8 +287,6 @@ bool mtt::Torrent::start()
 	if (lastError != mtt::Status::Success)
 		return false;
 
-	service.start(2);
-
 	state = State::Started;
 	stateChanged = true;
 
@@ -301,8 +323,6 @@ void mtt::Torrent::stop()
 		fileTransfer->stop();
 	}
 
-	service.stop();
-
 	state = State::Stopped;
 	lastError = Status::Success;
 	stateChanged = true;
@@ -334,7 +354,10 @@ std::shared_ptr<mtt::PiecesCheck> mtt::Torrent::checkFiles(std::function<void(st
 
 	checking = true;
 	std::lock_guard<std::mutex> guard(checkStateMutex);
-	checkState = files.storage.checkStoredPiecesAsync(infoFile.info.pieces, service.io, checkFunc);
+	checkState = files.storage.checkStoredPiecesAsync(infoFile.info.pieces, getCheckService().io, [this, checkFunc](std::shared_ptr<PiecesCheck> check)
+		{
+			strand->post([checkFunc, check]() { checkFunc(check); });
+		});
 	return checkState;
 }
 
@@ -371,7 +394,10 @@ bool mtt::Torrent::selectFiles(const std::vector<bool>& s)
 		lastError = files.prepareSelection();
 
 		if (fileTransfer)
+		{
+			fileTransfer->updatePiecesPriority();
 			fileTransfer->reevaluate();
+		}
 
 		return lastError == Status::Success;
 	}
@@ -411,7 +437,7 @@ float mtt::Torrent::currentProgress()
 	if (fileTransfer && infoFile.info.pieceSize)
 	{
 		float unfinishedPieces = fileTransfer->getUnfinishedPiecesDownloadSize() / (float)infoFile.info.pieceSize;
-		progress += unfinishedPieces / files.progress.pieces.size();
+		progress += unfinishedPieces / files.progress.size();
 	}
 
 	return progress;
@@ -472,6 +498,24 @@ void mtt::Torrent::setFilesPriority(const std::vector<mtt::Priority>& priority)
 	stateChanged = true;
 }
 
+void mtt::Torrent::setReadCursor(uint32_t fileIdx, uint64_t offset, uint32_t bytesPerSecond)
+{
+	if (fileTransfer)
+		fileTransfer->setReadCursor(fileIdx, offset, bytesPerSecond);
+}
+
+void mtt::Torrent::setPieceDeadline(uint32_t pieceIdx, uint32_t ms)
+{
+	if (fileTransfer && pieceIdx < infoFile.info.pieces.size())
+		fileTransfer->setPieceDeadline(pieceIdx, ms);
+}
+
+void mtt::Torrent::clearPieceDeadlines()
+{
+	if (fileTransfer)
+		fileTransfer->clearPieceDeadlines();
+}
+
 mtt::Status mtt::Torrent::setLocationPath(const std::string& path)
 {
 	return files.storage.setPath(path, lastStateTime != 0);
@@ -16,6 +16,8 @@ namespace mtt
 	{
 	public:
 
+		Torrent();
+
 		State state = State::Stopped;
 		bool checking = false;
 		Status lastError = Status::Success;
@@ -26,6 +28,7 @@ namespace mtt
 		void downloadMetadata(std::function<void(Status, MetadataDownloadState&)> callback);
 
 		bool start();
+		//waits for transfer to finish on its strand, not to be called from session service handlers
 		void stop();
 
 		void checkFiles();
@@ -34,6 +37,9 @@ namespace mtt
 
 		bool selectFiles(const std::vector<bool>&);
 		void setFilesPriority(const std::vector<mtt::Priority>&);
+		void setReadCursor(uint32_t fileIdx, uint64_t offset, uint32_t bytesPerSecond);
+		void setPieceDeadline(uint32_t pieceIdx, uint32_t ms);
+		void clearPieceDeadlines();
 		mtt::Status setLocationPath(const std::string& path);
 
 		std::string name();
@@ -52,7 +58,11 @@ namespace mtt
 
 		Files files;
 		TorrentFileInfo infoFile;
-		ServiceThreadpool service;
+		//shared session service
+		ServiceThreadpool& service;
+		//peer events and transfer state are handled serialized on it, other torrents run in parallel
+		//shared with peer streams, which can outlive torrent until their last callbacks run
+		std::shared_ptr<asio::io_service::strand> strand = std::make_shared<asio::io_service::strand>(service.io);
 
 		std::shared_ptr<Peers> peers;
 		std::shared_ptr<FileTransfer> fileTransfer;
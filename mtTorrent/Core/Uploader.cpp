@@ -1,6 +1,7 @@
 #include "Uploader.h"
 #include "Torrent.h"
 #include "PeerCommunication.h"
+#include "utils/BufferPool.h"
 
 mtt::Uploader::Uploader(TorrentPtr t)
 {
@@ -14,8 +15,38 @@ void mtt::Uploader::isInterested(PeerCommunication* p)
 
 bool mtt::Uploader::pieceRequest(PeerCommunication* p, PieceBlockInfo& info)
 {
-	auto block = torrent->files.storage.getPieceBlock(info);
-	p->sendPieceBlock(block);
+	auto& progress = torrent->files.progress;
+
+	if (p->state.amChoking || info.index >= progress.size() || !progress.hasPiece(info.index)
+		|| info.length == 0 || info.length > BlockRequestMaxSize
+		|| (uint64_t)info.begin + info.length > torrent->infoFile.info.getPieceSize(info.index))
+	{
+		//without fast extension the request is silently dropped
+		p->sendReject(info);
+		return false;
+	}
+
+	BufferView mappedData;
+	std::shared_ptr<void> mappedOwner;
+
+	if (torrent->files.storage.getMappedBlock(info, mappedData, mappedOwner))
+	{
+		p->sendPieceBlock(info, mappedData, std::move(mappedOwner));
+	}
+	else
+	{
+		auto block = torrent->files.storage.getPieceBlock(info);
+
+		if (block.data.empty())
+		{
+			p->sendReject(info);
+			return false;
+		}
+
+		p->sendPieceBlock(block);
+		BufferPool::Blocks().release(block.data);
+	}
+
 	uploaded += info.length;
 
 	return true;
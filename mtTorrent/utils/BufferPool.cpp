@@ -0,0 +1,112 @@
+#include "BufferPool.h"
+
+const size_t ThreadCacheSize = 16;
+
+BufferPool::BufferPool(size_t size, size_t maxCachedCount) : bufferSize(size), maxCached(maxCachedCount)
+{
+}
+
+BufferPool& BufferPool::Blocks()
+{
+	static BufferPool pool(BlockSize, 1024);
+
+	return pool;
+}
+
+DataBuffer BufferPool::get(size_t size)
+{
+	DataBuffer buffer;
+
+	if (size > bufferSize)
+	{
+		buffer.resize(size);
+		return buffer;
+	}
+
+	requests++;
+
+	auto& local = getThreadCache();
+
+	if (!local.empty())
+	{
+		buffer = std::move(local.back());
+		local.pop_back();
+	}
+	else
+	{
+		std::lock_guard<std::mutex> guard(cacheMutex);
+
+		if (!cache.empty())
+		{
+			buffer = std::move(cache.back());
+			cache.pop_back();
+		}
+	}
+
+	if (buffer.capacity() >= bufferSize)
+		hits++;
+	else
+		buffer.reserve(bufferSize);
+
+	buffer.resize(size);
+
+	auto current = ++used;
+	auto peak = peakUsed.load();
+	while (current > peak && !peakUsed.compare_exchange_weak(peak, current));
+
+	return buffer;
+}
+
+void BufferPool::release(DataBuffer& buffer)
+{
+	if (buffer.capacity() != bufferSize)
+	{
+		DataBuffer().swap(buffer);
+		return;
+	}
+
+	used--;
+
+	auto& local = getThreadCache();
+
+	if (local.size() < ThreadCacheSize)
+	{
+		local.push_back(std::move(buffer));
+	}
+	else
+	{
+		std::lock_guard<std::mutex> guard(cacheMutex);
+
+		if (cache.size() < maxCached)
+			cache.push_back(std::move(buffer));
+	}
+
+	DataBuffer().swap(buffer);
+}
+
+BufferPool::Info BufferPool::getInfo()
+{
+	Info info;
+	info.requests = requests;
+	info.hits = hits;
+	info.used = used;
+	info.peakUsed = peakUsed;
+
+	std::lock_guard<std::mutex> guard(cacheMutex);
+	info.cached = (uint32_t)cache.size();
+
+	return info;
+}
+
+std::vector<DataBuffer>& BufferPool::getThreadCache()
+{
+	//few pools exist, linear search is enough
+	thread_local std::vector<std::pair<BufferPool*, std::vector<DataBuffer>>> threadCaches;
+
+	for (auto& c : threadCaches)
+		if (c.first == this)
+			return c.second;
+
+	threadCaches.emplace_back(this, std::vector<DataBuffer>());
+	return threadCaches.back().second;
+}
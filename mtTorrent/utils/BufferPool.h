@@ -0,0 +1,47 @@
+#pragma once
+
+#include "utils\Network.h"
+#include <mutex>
+#include <atomic>
+
+//reuses allocations of fixed size buffers, each thread keeps few released buffers to avoid locking
+class BufferPool
+{
+public:
+
+	BufferPool(size_t bufferSize, size_t maxCached);
+
+	//session wide pool of piece block sized buffers
+	static BufferPool& Blocks();
+	static const size_t BlockSize = 16 * 1024;
+
+	//buffer resized to size, only sizes up to bufferSize are pooled
+	DataBuffer get(size_t size);
+	//keep buffer for reuse, buffer is left empty
+	void release(DataBuffer& buffer);
+
+	struct Info
+	{
+		uint64_t requests = 0;
+		uint64_t hits = 0;
+		uint32_t used = 0;
+		uint32_t peakUsed = 0;
+		uint32_t cached = 0;
+	};
+	Info getInfo();
+
+private:
+
+	std::vector<DataBuffer>& getThreadCache();
+
+	const size_t bufferSize;
+	const size_t maxCached;
+
+	std::mutex cacheMutex;
+	std::vector<DataBuffer> cache;
+
+	std::atomic<uint64_t> requests = 0;
+	std::atomic<uint64_t> hits = 0;
+	std::atomic<uint32_t> used = 0;
+	std::atomic<uint32_t> peakUsed = 0;
+};
@@ -0,0 +1,92 @@
+#include "FileHandleCache.h"
+#include "Configuration.h"
+
+FileHandleCache& FileHandleCache::Get()
+{
+	static FileHandleCache cache;
+	return cache;
+}
+
+FileHandleCache::HandlePtr FileHandleCache::open(const std::filesystem::path& path)
+{
+	{
+		std::lock_guard<std::mutex> guard(cacheMutex);
+
+		auto it = handlesIndex.find(path);
+		if (it != handlesIndex.end())
+		{
+			handles.splice(handles.begin(), handles, it->second);
+			return it->second->second;
+		}
+	}
+
+	auto handle = std::make_shared<Handle>();
+	handle->stream.open(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+
+	if (!handle->stream)
+	{
+		handle->stream.clear();
+		handle->stream.open(path, std::ios_base::binary | std::ios_base::in);
+		handle->readOnly = true;
+
+		if (!handle->stream)
+			return nullptr;
+	}
+
+	handle->stream.seekg(0, std::ios_base::end);
+	handle->size = (uint64_t)handle->stream.tellg();
+
+	std::lock_guard<std::mutex> guard(cacheMutex);
+
+	//opened meanwhile from other thread
+	auto it = handlesIndex.find(path);
+	if (it != handlesIndex.end())
+	{
+		handles.splice(handles.begin(), handles, it->second);
+		return it->second->second;
+	}
+
+	handles.emplace_front(path, handle);
+	handlesIndex[path] = handles.begin();
+
+	evict(mtt::config::getInternal().maxOpenFiles);
+
+	return handle;
+}
+
+void FileHandleCache::close(const std::filesystem::path& path)
+{
+	HandlePtr handle;
+
+	{
+		std::lock_guard<std::mutex> guard(cacheMutex);
+
+		auto it = handlesIndex.find(path);
+		if (it == handlesIndex.end())
+			return;
+
+		handle = it->second->second;
+		handles.erase(it->second);
+		handlesIndex.erase(it);
+	}
+
+	std::lock_guard<std::mutex> guard(handle->mutex);
+	handle->stream.close();
+}
+
+void FileHandleCache::closeAll()
+{
+	std::lock_guard<std::mutex> guard(cacheMutex);
+
+	handles.clear();
+	handlesIndex.clear();
+}
+
+void FileHandleCache::evict(uint32_t maxHandles)
+{
+	while (handles.size() > std::max(maxHandles, 1u))
+	{
+		handlesIndex.erase(handles.back().first);
+		handles.pop_back();
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <memory>
+#include <list>
+#include <map>
+
+//session wide cache of opened files, least recently used are closed when limit is reached
+class FileHandleCache
+{
+public:
+
+	struct Handle
+	{
+		std::mutex mutex;
+		std::fstream stream;
+		uint64_t size = 0;
+		//no write access to file
+		bool readOnly = false;
+	};
+	using HandlePtr = std::shared_ptr<Handle>;
+
+	static FileHandleCache& Get();
+
+	//existing file opened for reading and writing, or only for reading if not writable
+	HandlePtr open(const std::filesystem::path& path);
+	void close(const std::filesystem::path& path);
+	void closeAll();
+
+private:
+
+	void evict(uint32_t maxHandles);
+
+	std::mutex cacheMutex;
+	std::list<std::pair<std::filesystem::path, HandlePtr>> handles;
+	std::map<std::filesystem::path, std::list<std::pair<std::filesystem::path, HandlePtr>>::iterator> handlesIndex;
+};
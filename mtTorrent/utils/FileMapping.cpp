@@ -0,0 +1,172 @@
+#include "FileMapping.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static uint64_t getMappingGranularity()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+FileMapping::FileMapping()
+{
+}
+
+FileMapping::~FileMapping()
+{
+	close();
+}
+
+bool FileMapping::open(const std::filesystem::path& path)
+{
+	close();
+
+#ifdef _WIN32
+	file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		file = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER sz;
+	if (!GetFileSizeEx(file, &sz) || sz.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	fileSize = (uint64_t)sz.QuadPart;
+
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!mapping)
+	{
+		close();
+		return false;
+	}
+#else
+	file = ::open(path.c_str(), O_RDONLY);
+
+	if (file < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(file, &st) != 0 || st.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	fileSize = (uint64_t)st.st_size;
+#endif
+
+	return true;
+}
+
+void FileMapping::close()
+{
+	unmapView();
+
+#ifdef _WIN32
+	if (mapping)
+		CloseHandle(mapping);
+	mapping = nullptr;
+
+	if (file)
+		CloseHandle(file);
+	file = nullptr;
+#else
+	if (file >= 0)
+		::close(file);
+	file = -1;
+#endif
+
+	fileSize = 0;
+}
+
+bool FileMapping::isOpen()
+{
+	return fileSize != 0;
+}
+
+const uint8_t* FileMapping::map(uint64_t offset, size_t length)
+{
+	if (!isOpen() || offset + length > fileSize)
+		return nullptr;
+
+	if (view && offset >= viewOffset && offset + length <= viewOffset + view->size)
+		return view->data + (offset - viewOffset);
+
+	unmapView();
+
+	static const uint64_t granularity = getMappingGranularity();
+
+	uint64_t alignedOffset = offset - offset % granularity;
+	uint64_t alignedSize = std::max(offset + length - alignedOffset, WindowSize);
+	alignedSize = std::min(alignedSize, fileSize - alignedOffset);
+
+#ifdef _WIN32
+	auto data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(alignedOffset >> 32), (DWORD)alignedOffset, (SIZE_T)alignedSize);
+#else
+	void* ptr = mmap(nullptr, (size_t)alignedSize, PROT_READ, MAP_SHARED, file, (off_t)alignedOffset);
+	auto data = (ptr == MAP_FAILED) ? nullptr : (uint8_t*)ptr;
+#endif
+
+	if (!data)
+		return nullptr;
+
+	view = std::make_shared<View>();
+	view->data = data;
+	view->size = alignedSize;
+	viewOffset = alignedOffset;
+
+	return view->data + (offset - viewOffset);
+}
+
+const uint8_t* FileMapping::map(uint64_t offset, size_t length, std::shared_ptr<void>& owner)
+{
+	auto data = map(offset, length);
+
+	if (data)
+		owner = view;
+
+	return data;
+}
+
+uint64_t FileMapping::size()
+{
+	return fileSize;
+}
+
+void FileMapping::unmapView()
+{
+	view.reset();
+	viewOffset = 0;
+}
+
+FileMapping::View::~View()
+{
+	if (data)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(data, (size_t)size);
+#endif
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+//read only view of file, mapped in windows of limited size
+class FileMapping
+{
+public:
+
+	FileMapping();
+	FileMapping(const FileMapping&) = delete;
+	~FileMapping();
+
+	bool open(const std::filesystem::path& path);
+	void close();
+	bool isOpen();
+
+	//pointer is valid until next map call or close
+	const uint8_t* map(uint64_t offset, size_t length);
+	//pointer stays valid while owner is kept, even after next map call or close
+	const uint8_t* map(uint64_t offset, size_t length, std::shared_ptr<void>& owner);
+
+	uint64_t size();
+
+	static constexpr uint64_t WindowSize = 32 * 1024 * 1024;
+
+private:
+
+	//unmapped when last user releases it
+	struct View
+	{
+		uint8_t* data = nullptr;
+		uint64_t size = 0;
+
+		~View();
+	};
+
+	void unmapView();
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+	std::shared_ptr<View> view;
+	uint64_t viewOffset = 0;
+
+	uint64_t fileSize = 0;
+};
@@ -48,7 +48,7 @@ std::vector<DataChunk> readChunkedData(const char* buffer, size_t bufferSize, si
 	return chunks;
 }
 
-HttpHeaderInfo HttpHeaderInfo::readFromBuffer(DataBuffer& buffer)
+HttpHeaderInfo HttpHeaderInfo::readFromBuffer(const BufferView& buffer)
 {
 	return HttpHeaderInfo::read((const char*)buffer.data(), buffer.size());
 }
@@ -10,6 +10,6 @@ struct HttpHeaderInfo
 
 	std::vector<std::pair<std::string, std::string>> headerParameters;
 
-	static HttpHeaderInfo readFromBuffer(DataBuffer& buffer);
+	static HttpHeaderInfo readFromBuffer(const BufferView& buffer);
 	static HttpHeaderInfo read(const char* buffer, size_t bufferSize);
 };
@@ -12,6 +12,25 @@ using asio::ip::udp;
 
 using DataBuffer = std::vector<uint8_t>;
 
+//non owning view of contiguous bytes
+struct BufferView
+{
+	BufferView() {}
+	BufferView(const uint8_t* data, size_t size) : ptr(data), length(size) {}
+	BufferView(const DataBuffer& buffer) : ptr(buffer.data()), length(buffer.size()) {}
+
+	const uint8_t* data() const { return ptr; }
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+
+	const uint8_t& operator[](size_t i) const { return ptr[i]; }
+
+private:
+
+	const uint8_t* ptr = nullptr;
+	size_t length = 0;
+};
+
 struct Addr
 {
 	Addr();
@@ -1,8 +1,11 @@
 //original source https://github.com/vog/sha1
 
 #include <utils/SHA.h>
+#include <utils/SHAAccelerated.h>
 
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -285,15 +288,314 @@ void SHA1_::final()
 	transform(digest, block, transforms);
 }
 
-void _SHA1(const unsigned char* d, size_t n, unsigned char* md)
+static void digestToBytes(const uint32_t digest[5], unsigned char* md)
+{
+	for (int i = 0; i < 5; i++)
+	{
+		auto bd = _byteswap_ulong(digest[i]);
+		memcpy(md + i*4, &bd, 4);
+	}
+}
+
+static void portableSHA1(const unsigned char* d, size_t n, unsigned char* md)
 {
 	SHA1_ sha;
 	sha.update((const char*)d, n);
 	sha.final();
 
-	for (int i = 0; i < 5; i++)
+	digestToBytes(sha.digest, md);
+}
+
+using TransformFunc = void(*)(uint32_t state[5], const uint8_t* data, size_t blocks);
+
+static void transformPortable(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	uint64_t transforms = 0;
+
+	for (; blocks; blocks--, data += BLOCK_BYTES)
 	{
-		auto bd = _byteswap_ulong(sha.digest[i]);
-		memcpy(md + i*4, &bd, 4);
+		uint32_t block[BLOCK_INTS];
+		for (size_t i = 0; i < BLOCK_INTS; i++)
+			block[i] = (uint32_t)data[4 * i + 3] | (uint32_t)data[4 * i + 2] << 8 | (uint32_t)data[4 * i + 1] << 16 | (uint32_t)data[4 * i] << 24;
+
+		transform(state, block, transforms);
 	}
 }
+
+//pad last partial block and append total size
+static void finalBlocks(TransformFunc transformBlocks, uint32_t state[5], const uint8_t* rest, size_t restSize, uint64_t totalSize, unsigned char* md)
+{
+	uint8_t tail[2 * BLOCK_BYTES] = {};
+	memcpy(tail, rest, restSize);
+	tail[restSize] = 0x80;
+
+	size_t tailBlocks = (restSize + 1 + 8 > BLOCK_BYTES) ? 2 : 1;
+	uint64_t totalBits = totalSize * 8;
+	for (size_t i = 0; i < 8; i++)
+		tail[tailBlocks * BLOCK_BYTES - 1 - i] = (uint8_t)(totalBits >> (8 * i));
+
+	transformBlocks(state, tail, tailBlocks);
+
+	digestToBytes(state, md);
+}
+
+/*
+ * Whole blocks go straight from input to transform, only the padded tail is copied.
+ */
+
+static void blocksSHA1(TransformFunc transformBlocks, const unsigned char* d, size_t n, unsigned char* md)
+{
+	uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+	size_t blocks = n / BLOCK_BYTES;
+	if (blocks)
+		transformBlocks(state, d, blocks);
+
+	finalBlocks(transformBlocks, state, d + blocks * BLOCK_BYTES, n - blocks * BLOCK_BYTES, n, md);
+}
+
+static TransformFunc getTransform(Sha1::Implementation impl)
+{
+#ifdef SHA_X86_ACCELERATION
+	if (impl == Sha1::Implementation::ShaNi)
+		return Sha1::transformShaNi;
+	if (impl == Sha1::Implementation::Avx2)
+		return Sha1::transformAvx2;
+	if (impl == Sha1::Implementation::Ssse3)
+		return Sha1::transformSsse3;
+#endif
+
+	return nullptr;
+}
+
+#ifdef SHA_X86_ACCELERATION
+
+using MultiTransformFunc = void(*)(uint32_t state[5][Sha1::MaxLanes], const uint8_t* const data[Sha1::MaxLanes], size_t blocks);
+
+/*
+ * Up to lanes buffers of same size, lanes without buffer repeat the first one and are ignored.
+ */
+
+static void multiBlocksSHA1(MultiTransformFunc transformBlocks, const unsigned char* const* d, size_t count, size_t n, unsigned char* md)
+{
+	const uint32_t initial[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	uint32_t state[5][Sha1::MaxLanes];
+	for (size_t i = 0; i < 5; i++)
+		for (size_t l = 0; l < Sha1::MaxLanes; l++)
+			state[i][l] = initial[i];
+
+	const uint8_t* data[Sha1::MaxLanes];
+	for (size_t l = 0; l < Sha1::MaxLanes; l++)
+		data[l] = d[l < count ? l : 0];
+
+	size_t blocks = n / BLOCK_BYTES;
+	if (blocks)
+		transformBlocks(state, data, blocks);
+
+	size_t rest = n - blocks * BLOCK_BYTES;
+	size_t tailBlocks = (rest + 1 + 8 > BLOCK_BYTES) ? 2 : 1;
+	uint64_t totalBits = (uint64_t)n * 8;
+
+	uint8_t tails[Sha1::MaxLanes][2 * BLOCK_BYTES] = {};
+	for (size_t l = 0; l < count; l++)
+	{
+		memcpy(tails[l], d[l] + blocks * BLOCK_BYTES, rest);
+		tails[l][rest] = 0x80;
+
+		for (size_t i = 0; i < 8; i++)
+			tails[l][tailBlocks * BLOCK_BYTES - 1 - i] = (uint8_t)(totalBits >> (8 * i));
+	}
+
+	for (size_t l = 0; l < Sha1::MaxLanes; l++)
+		data[l] = tails[l < count ? l : 0];
+
+	transformBlocks(state, data, tailBlocks);
+
+	for (size_t l = 0; l < count; l++)
+	{
+		uint32_t digest[5] = { state[0][l], state[1][l], state[2][l], state[3][l], state[4][l] };
+		digestToBytes(digest, md + l * SHA_DIGEST_LENGTH);
+	}
+}
+
+#endif
+
+static size_t getBatchLanes(Sha1::Implementation impl)
+{
+	if (impl == Sha1::Implementation::Avx2)
+		return 8;
+	if (impl == Sha1::Implementation::Ssse3)
+		return 4;
+
+	return 1;
+}
+
+bool Sha1::isSupported(Implementation impl)
+{
+	if (impl == Implementation::Portable)
+		return true;
+
+#ifdef SHA_X86_ACCELERATION
+	static const CpuFeatures features = detectCpuFeatures();
+
+	if (impl == Implementation::ShaNi)
+		return features.shaNi;
+	if (impl == Implementation::Avx2)
+		return features.avx2;
+	if (impl == Implementation::Ssse3)
+		return features.ssse3;
+#endif
+
+	return false;
+}
+
+Sha1::Implementation Sha1::activeImplementation()
+{
+	static const Implementation active = isSupported(Implementation::ShaNi) ? Implementation::ShaNi : Implementation::Portable;
+
+	return active;
+}
+
+Sha1::Implementation Sha1::batchImplementation()
+{
+	//8 AVX2 lanes outrun SHA-NI hashing buffers one by one, 4 SSSE3 lanes dont
+	static const Implementation active = []()
+	{
+		for (auto impl : { Implementation::Avx2, Implementation::ShaNi, Implementation::Ssse3 })
+			if (isSupported(impl))
+				return impl;
+
+		return Implementation::Portable;
+	}();
+
+	return active;
+}
+
+const char* Sha1::getName(Implementation impl)
+{
+	if (impl == Implementation::ShaNi)
+		return "SHA-NI";
+	if (impl == Implementation::Avx2)
+		return "AVX2";
+	if (impl == Implementation::Ssse3)
+		return "SSSE3";
+
+	return "Portable";
+}
+
+bool Sha1::hash(Implementation impl, const unsigned char* d, size_t n, unsigned char* md)
+{
+	if (!isSupported(impl))
+		return false;
+
+	if (auto transformBlocks = getTransform(impl))
+		blocksSHA1(transformBlocks, d, n, md);
+	else
+		portableSHA1(d, n, md);
+
+	return true;
+}
+
+size_t Sha1::getBatchSize()
+{
+	return getBatchLanes(batchImplementation());
+}
+
+bool Sha1::hashBatch(Implementation impl, const unsigned char* const* d, size_t count, size_t n, unsigned char* md)
+{
+	if (!isSupported(impl))
+		return false;
+
+	size_t lanes = getBatchLanes(impl);
+
+	for (size_t i = 0; i < count; i += lanes)
+	{
+		size_t batchCount = std::min(lanes, count - i);
+
+		if (batchCount == 1)
+		{
+			hash(impl, d[i], n, md + i * SHA_DIGEST_LENGTH);
+			continue;
+		}
+
+#ifdef SHA_X86_ACCELERATION
+		multiBlocksSHA1(impl == Implementation::Avx2 ? transformMultiAvx2 : transformMultiSsse3, d + i, batchCount, n, md + i * SHA_DIGEST_LENGTH);
+#endif
+	}
+
+	return true;
+}
+
+void Sha1::hashBatch(const unsigned char* const* d, size_t count, size_t n, unsigned char* md)
+{
+	hashBatch(batchImplementation(), d, count, n, md);
+}
+
+void _SHA1(const unsigned char* d, size_t n, unsigned char* md)
+{
+	static const TransformFunc transformBlocks = getTransform(Sha1::activeImplementation());
+
+	if (transformBlocks)
+		blocksSHA1(transformBlocks, d, n, md);
+	else
+		portableSHA1(d, n, md);
+}
+
+Sha1::Hasher::Hasher()
+{
+	reset();
+}
+
+void Sha1::Hasher::reset()
+{
+	const uint32_t initial[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	memcpy(state, initial, sizeof(state));
+	bufferSize = 0;
+	totalSize = 0;
+}
+
+static TransformFunc getHasherTransform()
+{
+	static const TransformFunc transformBlocks = getTransform(Sha1::activeImplementation());
+
+	return transformBlocks ? transformBlocks : transformPortable;
+}
+
+void Sha1::Hasher::update(const unsigned char* d, size_t n)
+{
+	auto transformBlocks = getHasherTransform();
+	totalSize += n;
+
+	if (bufferSize)
+	{
+		size_t fill = std::min(n, BLOCK_BYTES - bufferSize);
+		memcpy(buffer + bufferSize, d, fill);
+		bufferSize += fill;
+		d += fill;
+		n -= fill;
+
+		if (bufferSize < BLOCK_BYTES)
+			return;
+
+		transformBlocks(state, buffer, 1);
+		bufferSize = 0;
+	}
+
+	size_t blocks = n / BLOCK_BYTES;
+	if (blocks)
+		transformBlocks(state, d, blocks);
+
+	bufferSize = n - blocks * BLOCK_BYTES;
+	memcpy(buffer, d + blocks * BLOCK_BYTES, bufferSize);
+}
+
+void Sha1::Hasher::final(unsigned char* md)
+{
+	finalBlocks(getHasherTransform(), state, buffer, bufferSize, totalSize, md);
+	reset();
+}
+
+uint64_t Sha1::Hasher::size() const
+{
+	return totalSize;
+}
@@ -1,5 +1,61 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #define SHA_DIGEST_LENGTH 20
 
-void _SHA1(const unsigned char* d, size_t n, unsigned char* md);
\ No newline at end of file
+//uses fastest implementation supported by cpu
+void _SHA1(const unsigned char* d, size_t n, unsigned char* md);
+
+namespace Sha1
+{
+	enum class Implementation
+	{
+		Portable,
+		Ssse3,
+		Avx2,
+		ShaNi
+	};
+
+	//selected once at startup from cpuid, used for single buffers
+	//SIMD message schedule alone is slower than portable code, so only SHA-NI replaces it
+	Implementation activeImplementation();
+	//used by hashBatch, multiple buffers in SIMD lanes are faster than hashing them one by one
+	Implementation batchImplementation();
+	bool isSupported(Implementation);
+	const char* getName(Implementation);
+
+	//hash with chosen implementation, for tests and benchmarks
+	bool hash(Implementation, const unsigned char* d, size_t n, unsigned char* md);
+
+	//count of buffers worth passing to hashBatch at once, 1 when single buffer hashing is as fast
+	size_t getBatchSize();
+
+	//hash count buffers of same size n, md receives count digests one after another
+	void hashBatch(const unsigned char* const* d, size_t count, size_t n, unsigned char* md);
+	bool hashBatch(Implementation, const unsigned char* const* d, size_t count, size_t n, unsigned char* md);
+
+	//incremental hashing with active implementation, data can be passed in any chunks
+	class Hasher
+	{
+	public:
+
+		Hasher();
+
+		void update(const unsigned char* d, size_t n);
+		//writes digest and resets for new data
+		void final(unsigned char* md);
+		void reset();
+
+		//bytes passed since reset
+		uint64_t size() const;
+
+	private:
+
+		uint32_t state[5];
+		unsigned char buffer[64];
+		size_t bufferSize;
+		uint64_t totalSize;
+	};
+}
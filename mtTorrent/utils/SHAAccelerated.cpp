@@ -0,0 +1,463 @@
+#include "SHAAccelerated.h"
+
+#ifdef SHA_X86_ACCELERATION
+
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SHA_TARGET(x) __attribute__((target(x)))
+#else
+#define SHA_TARGET(x)
+#endif
+
+static void cpuid(int leaf, int subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex(info, leaf, subleaf);
+	for (int i = 0; i < 4; i++)
+		regs[i] = (uint32_t)info[i];
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+static uint64_t xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t a, d;
+	__asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((uint64_t)d << 32) | a;
+#endif
+}
+
+Sha1::CpuFeatures Sha1::detectCpuFeatures()
+{
+	CpuFeatures features;
+
+	uint32_t regs[4];
+	cpuid(0, 0, regs);
+	uint32_t maxLeaf = regs[0];
+
+	if (maxLeaf < 1)
+		return features;
+
+	cpuid(1, 0, regs);
+	features.ssse3 = (regs[2] & (1 << 9)) != 0;
+	bool sse41 = (regs[2] & (1 << 19)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+
+	if (maxLeaf < 7)
+		return features;
+
+	cpuid(7, 0, regs);
+	features.shaNi = features.ssse3 && sse41 && (regs[1] & (1 << 29)) != 0;
+
+	//ymm state has to be enabled by OS
+	if (avx && osxsave && (xgetbv0() & 6) == 6)
+		features.avx2 = (regs[1] & (1 << 5)) != 0;
+
+	return features;
+}
+
+static inline uint32_t rol(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+//80 rounds with precomputed W+K
+static void transformRounds(uint32_t state[5], const uint32_t wk[80])
+{
+	uint32_t a = state[0];
+	uint32_t b = state[1];
+	uint32_t c = state[2];
+	uint32_t d = state[3];
+	uint32_t e = state[4];
+
+	auto round = [&](uint32_t f, uint32_t w)
+	{
+		uint32_t t = rol(a, 5) + f + e + w;
+		e = d;
+		d = c;
+		c = rol(b, 30);
+		b = a;
+		a = t;
+	};
+
+	for (int i = 0; i < 20; i++)
+		round((b & (c ^ d)) ^ d, wk[i]);
+	for (int i = 20; i < 40; i++)
+		round(b ^ c ^ d, wk[i]);
+	for (int i = 40; i < 60; i++)
+		round(((b | c) & d) | (b & c), wk[i]);
+	for (int i = 60; i < 80; i++)
+		round(b ^ c ^ d, wk[i]);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static const uint32_t RoundConstants[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+
+/*
+ * W[t..t+3] computed together, W[t+3] depends on W[t] so its lane is computed without it and fixed afterwards:
+ * W[t+3] = rol1(x ^ W[t]) = rol1(x) ^ rol2(v[t])
+ */
+
+SHA_TARGET("ssse3")
+static inline __m128i nextSchedule(__m128i w16, __m128i w12, __m128i w8, __m128i w4)
+{
+	__m128i v = _mm_xor_si128(_mm_xor_si128(w16, _mm_alignr_epi8(w12, w16, 8)), _mm_xor_si128(w8, _mm_srli_si128(w4, 4)));
+	__m128i r = _mm_or_si128(_mm_slli_epi32(v, 1), _mm_srli_epi32(v, 31));
+	__m128i fix = _mm_slli_si128(v, 12);
+	return _mm_xor_si128(r, _mm_or_si128(_mm_slli_epi32(fix, 2), _mm_srli_epi32(fix, 30)));
+}
+
+SHA_TARGET("ssse3")
+void Sha1::transformSsse3(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	const __m128i byteSwap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	alignas(16) uint32_t wk[80];
+
+	for (; blocks; blocks--, data += 64)
+	{
+		__m128i w[4];
+		for (int i = 0; i < 4; i++)
+		{
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), byteSwap);
+			_mm_store_si128((__m128i*)(wk + i * 4), _mm_add_epi32(w[i], _mm_set1_epi32((int)RoundConstants[0])));
+		}
+
+		for (int t = 16; t < 80; t += 4)
+		{
+			__m128i next = nextSchedule(w[0], w[1], w[2], w[3]);
+			w[0] = w[1];
+			w[1] = w[2];
+			w[2] = w[3];
+			w[3] = next;
+			_mm_store_si128((__m128i*)(wk + t), _mm_add_epi32(next, _mm_set1_epi32((int)RoundConstants[t / 20])));
+		}
+
+		transformRounds(state, wk);
+	}
+}
+
+SHA_TARGET("avx2")
+static inline __m256i nextSchedule(__m256i w16, __m256i w12, __m256i w8, __m256i w4)
+{
+	__m256i v = _mm256_xor_si256(_mm256_xor_si256(w16, _mm256_alignr_epi8(w12, w16, 8)), _mm256_xor_si256(w8, _mm256_srli_si256(w4, 4)));
+	__m256i r = _mm256_or_si256(_mm256_slli_epi32(v, 1), _mm256_srli_epi32(v, 31));
+	__m256i fix = _mm256_slli_si256(v, 12);
+	return _mm256_xor_si256(r, _mm256_or_si256(_mm256_slli_epi32(fix, 2), _mm256_srli_epi32(fix, 30)));
+}
+
+SHA_TARGET("avx2")
+void Sha1::transformAvx2(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	const __m256i byteSwap = _mm256_set_epi8(
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	alignas(32) uint32_t wk[2][80];
+
+	for (; blocks >= 2; blocks -= 2, data += 128)
+	{
+		__m256i w[4];
+		for (int i = 0; i < 4; i++)
+		{
+			__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(data + i * 16))), _mm_loadu_si128((const __m128i*)(data + 64 + i * 16)), 1);
+			w[i] = _mm256_shuffle_epi8(in, byteSwap);
+			__m256i k = _mm256_add_epi32(w[i], _mm256_set1_epi32((int)RoundConstants[0]));
+			_mm_store_si128((__m128i*)(wk[0] + i * 4), _mm256_castsi256_si128(k));
+			_mm_store_si128((__m128i*)(wk[1] + i * 4), _mm256_extracti128_si256(k, 1));
+		}
+
+		for (int t = 16; t < 80; t += 4)
+		{
+			__m256i next = nextSchedule(w[0], w[1], w[2], w[3]);
+			w[0] = w[1];
+			w[1] = w[2];
+			w[2] = w[3];
+			w[3] = next;
+			__m256i k = _mm256_add_epi32(next, _mm256_set1_epi32((int)RoundConstants[t / 20]));
+			_mm_store_si128((__m128i*)(wk[0] + t), _mm256_castsi256_si128(k));
+			_mm_store_si128((__m128i*)(wk[1] + t), _mm256_extracti128_si256(k, 1));
+		}
+
+		transformRounds(state, wk[0]);
+		transformRounds(state, wk[1]);
+	}
+
+	if (blocks)
+		transformSsse3(state, data, blocks);
+}
+
+/*
+ * Multi buffer, one buffer per 32bit lane. Each round is the scalar round done on all lanes,
+ * input words are transposed so that vector i holds word i of every buffer.
+ */
+
+template<int Bits>
+SHA_TARGET("ssse3")
+static inline __m128i rol(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi32(v, Bits), _mm_srli_epi32(v, 32 - Bits));
+}
+
+SHA_TARGET("ssse3")
+static inline __m128i nextWord(__m128i w[16], int t)
+{
+	__m128i v = _mm_xor_si128(_mm_xor_si128(w[(t + 13) & 15], w[(t + 8) & 15]), _mm_xor_si128(w[(t + 2) & 15], w[t & 15]));
+	return w[t & 15] = rol<1>(v);
+}
+
+SHA_TARGET("ssse3")
+static inline void multiRound(__m128i& a, __m128i& b, __m128i& c, __m128i& d, __m128i& e, __m128i f, __m128i wk)
+{
+	__m128i t = _mm_add_epi32(_mm_add_epi32(rol<5>(a), f), _mm_add_epi32(e, wk));
+	e = d;
+	d = c;
+	c = rol<30>(b);
+	b = a;
+	a = t;
+}
+
+SHA_TARGET("ssse3")
+void Sha1::transformMultiSsse3(uint32_t state[5][MaxLanes], const uint8_t* const data[MaxLanes], size_t blocks)
+{
+	const __m128i byteSwap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m128i k[4];
+	for (int i = 0; i < 4; i++)
+		k[i] = _mm_set1_epi32((int)RoundConstants[i]);
+
+	__m128i s[5];
+	for (int i = 0; i < 5; i++)
+		s[i] = _mm_loadu_si128((const __m128i*)state[i]);
+
+	for (size_t offset = 0; blocks; blocks--, offset += 64)
+	{
+		__m128i w[16];
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i r0 = _mm_loadu_si128((const __m128i*)(data[0] + offset + i * 16));
+			__m128i r1 = _mm_loadu_si128((const __m128i*)(data[1] + offset + i * 16));
+			__m128i r2 = _mm_loadu_si128((const __m128i*)(data[2] + offset + i * 16));
+			__m128i r3 = _mm_loadu_si128((const __m128i*)(data[3] + offset + i * 16));
+
+			__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+			__m128i t1 = _mm_unpackhi_epi32(r0, r1);
+			__m128i t2 = _mm_unpacklo_epi32(r2, r3);
+			__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+			w[i * 4 + 0] = _mm_shuffle_epi8(_mm_unpacklo_epi64(t0, t2), byteSwap);
+			w[i * 4 + 1] = _mm_shuffle_epi8(_mm_unpackhi_epi64(t0, t2), byteSwap);
+			w[i * 4 + 2] = _mm_shuffle_epi8(_mm_unpacklo_epi64(t1, t3), byteSwap);
+			w[i * 4 + 3] = _mm_shuffle_epi8(_mm_unpackhi_epi64(t1, t3), byteSwap);
+		}
+
+		__m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+
+		for (int t = 0; t < 16; t++)
+			multiRound(a, b, c, d, e, _mm_xor_si128(_mm_and_si128(b, _mm_xor_si128(c, d)), d), _mm_add_epi32(w[t], k[0]));
+		for (int t = 16; t < 20; t++)
+			multiRound(a, b, c, d, e, _mm_xor_si128(_mm_and_si128(b, _mm_xor_si128(c, d)), d), _mm_add_epi32(nextWord(w, t), k[0]));
+		for (int t = 20; t < 40; t++)
+			multiRound(a, b, c, d, e, _mm_xor_si128(_mm_xor_si128(b, c), d), _mm_add_epi32(nextWord(w, t), k[1]));
+		for (int t = 40; t < 60; t++)
+			multiRound(a, b, c, d, e, _mm_or_si128(_mm_and_si128(_mm_or_si128(b, c), d), _mm_and_si128(b, c)), _mm_add_epi32(nextWord(w, t), k[2]));
+		for (int t = 60; t < 80; t++)
+			multiRound(a, b, c, d, e, _mm_xor_si128(_mm_xor_si128(b, c), d), _mm_add_epi32(nextWord(w, t), k[3]));
+
+		s[0] = _mm_add_epi32(s[0], a);
+		s[1] = _mm_add_epi32(s[1], b);
+		s[2] = _mm_add_epi32(s[2], c);
+		s[3] = _mm_add_epi32(s[3], d);
+		s[4] = _mm_add_epi32(s[4], e);
+	}
+
+	for (int i = 0; i < 5; i++)
+		_mm_storeu_si128((__m128i*)state[i], s[i]);
+}
+
+template<int Bits>
+SHA_TARGET("avx2")
+static inline __m256i rol(__m256i v)
+{
+	return _mm256_or_si256(_mm256_slli_epi32(v, Bits), _mm256_srli_epi32(v, 32 - Bits));
+}
+
+SHA_TARGET("avx2")
+static inline __m256i nextWord(__m256i w[16], int t)
+{
+	__m256i v = _mm256_xor_si256(_mm256_xor_si256(w[(t + 13) & 15], w[(t + 8) & 15]), _mm256_xor_si256(w[(t + 2) & 15], w[t & 15]));
+	return w[t & 15] = rol<1>(v);
+}
+
+SHA_TARGET("avx2")
+static inline void multiRound(__m256i& a, __m256i& b, __m256i& c, __m256i& d, __m256i& e, __m256i f, __m256i wk)
+{
+	__m256i t = _mm256_add_epi32(_mm256_add_epi32(rol<5>(a), f), _mm256_add_epi32(e, wk));
+	e = d;
+	d = c;
+	c = rol<30>(b);
+	b = a;
+	a = t;
+}
+
+SHA_TARGET("avx2")
+void Sha1::transformMultiAvx2(uint32_t state[5][MaxLanes], const uint8_t* const data[MaxLanes], size_t blocks)
+{
+	const __m256i byteSwap = _mm256_set_epi8(
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i k[4];
+	for (int i = 0; i < 4; i++)
+		k[i] = _mm256_set1_epi32((int)RoundConstants[i]);
+
+	__m256i s[5];
+	for (int i = 0; i < 5; i++)
+		s[i] = _mm256_loadu_si256((const __m256i*)state[i]);
+
+	for (size_t offset = 0; blocks; blocks--, offset += 64)
+	{
+		__m256i w[16];
+		for (int i = 0; i < 2; i++)
+		{
+			__m256i r[8];
+			for (int l = 0; l < 8; l++)
+				r[l] = _mm256_loadu_si256((const __m256i*)(data[l] + offset + i * 32));
+
+			//8x8 transpose, 128bit halves hold words 0-3 and 4-7
+			__m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+			__m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+			__m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+			__m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+			__m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+			__m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+			__m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+			__m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+			__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+			__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+			__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+			__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+			__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+			__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+			__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+			__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+			__m256i* out = w + i * 8;
+			out[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x20), byteSwap);
+			out[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x20), byteSwap);
+			out[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x20), byteSwap);
+			out[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x20), byteSwap);
+			out[4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x31), byteSwap);
+			out[5] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x31), byteSwap);
+			out[6] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x31), byteSwap);
+			out[7] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x31), byteSwap);
+		}
+
+		__m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+
+		for (int t = 0; t < 16; t++)
+			multiRound(a, b, c, d, e, _mm256_xor_si256(_mm256_and_si256(b, _mm256_xor_si256(c, d)), d), _mm256_add_epi32(w[t], k[0]));
+		for (int t = 16; t < 20; t++)
+			multiRound(a, b, c, d, e, _mm256_xor_si256(_mm256_and_si256(b, _mm256_xor_si256(c, d)), d), _mm256_add_epi32(nextWord(w, t), k[0]));
+		for (int t = 20; t < 40; t++)
+			multiRound(a, b, c, d, e, _mm256_xor_si256(_mm256_xor_si256(b, c), d), _mm256_add_epi32(nextWord(w, t), k[1]));
+		for (int t = 40; t < 60; t++)
+			multiRound(a, b, c, d, e, _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(b, c), d), _mm256_and_si256(b, c)), _mm256_add_epi32(nextWord(w, t), k[2]));
+		for (int t = 60; t < 80; t++)
+			multiRound(a, b, c, d, e, _mm256_xor_si256(_mm256_xor_si256(b, c), d), _mm256_add_epi32(nextWord(w, t), k[3]));
+
+		s[0] = _mm256_add_epi32(s[0], a);
+		s[1] = _mm256_add_epi32(s[1], b);
+		s[2] = _mm256_add_epi32(s[2], c);
+		s[3] = _mm256_add_epi32(s[3], d);
+		s[4] = _mm256_add_epi32(s[4], e);
+	}
+
+	for (int i = 0; i < 5; i++)
+		_mm256_storeu_si256((__m256i*)state[i], s[i]);
+}
+
+/*
+ * SHA extensions, 4 rounds per instruction. Message words for group G are started with msg1 in group G-3,
+ * xored in G-2 and finished with msg2 in G-1. E alternates between 2 registers.
+ */
+
+template<int G>
+SHA_TARGET("sha,sse4.1")
+static inline void shaNiRounds(__m128i& abcd, __m128i e[2], __m128i msg[4], const uint8_t* data, __m128i byteSwap)
+{
+	__m128i& m = msg[G % 4];
+
+	if constexpr (G < 4)
+		m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + G * 16)), byteSwap);
+
+	if constexpr (G == 0)
+		e[0] = _mm_add_epi32(e[0], m);
+	else
+		e[G % 2] = _mm_sha1nexte_epu32(e[G % 2], m);
+
+	e[(G + 1) % 2] = abcd;
+
+	if constexpr (G >= 3 && G <= 18)
+		msg[(G + 1) % 4] = _mm_sha1msg2_epu32(msg[(G + 1) % 4], m);
+
+	abcd = _mm_sha1rnds4_epu32(abcd, e[G % 2], G / 5);
+
+	if constexpr (G >= 1 && G <= 16)
+		msg[(G + 3) % 4] = _mm_sha1msg1_epu32(msg[(G + 3) % 4], m);
+
+	if constexpr (G >= 2 && G <= 17)
+		msg[(G + 2) % 4] = _mm_xor_si128(msg[(G + 2) % 4], m);
+}
+
+template<int... G>
+SHA_TARGET("sha,sse4.1")
+static inline void shaNiBlock(std::integer_sequence<int, G...>, __m128i& abcd, __m128i e[2], __m128i msg[4], const uint8_t* data, __m128i byteSwap)
+{
+	(shaNiRounds<G>(abcd, e, msg, data, byteSwap), ...);
+}
+
+SHA_TARGET("sha,sse4.1")
+void Sha1::transformShaNi(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+	__m128i e[2];
+	e[0] = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	for (; blocks; blocks--, data += 64)
+	{
+		__m128i abcdSave = abcd;
+		__m128i eSave = e[0];
+		__m128i msg[4];
+
+		shaNiBlock(std::make_integer_sequence<int, 20>{}, abcd, e, msg, data, byteSwap);
+
+		e[0] = _mm_sha1nexte_epu32(e[0], eSave);
+		abcd = _mm_add_epi32(abcd, abcdSave);
+	}
+
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = (uint32_t)_mm_extract_epi32(e[0], 3);
+}
+
+#endif
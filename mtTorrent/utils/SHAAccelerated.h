@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SHA_X86_ACCELERATION
+#endif
+
+#ifdef SHA_X86_ACCELERATION
+
+//SHA1 block transforms using x86 extensions, state is in host order and data are whole 64 byte blocks
+namespace Sha1
+{
+	struct CpuFeatures
+	{
+		bool ssse3 = false;
+		bool avx2 = false;
+		bool shaNi = false;
+	};
+
+	CpuFeatures detectCpuFeatures();
+
+	void transformShaNi(uint32_t state[5], const uint8_t* data, size_t blocks);
+	//vectorized message schedule, scalar rounds
+	void transformSsse3(uint32_t state[5], const uint8_t* data, size_t blocks);
+	//message schedule of 2 blocks at once in 128bit lanes
+	void transformAvx2(uint32_t state[5], const uint8_t* data, size_t blocks);
+
+	const size_t MaxLanes = 8;
+
+	//independent buffers hashed in vector lanes, state[word][lane], blocks are read at same offset from each data pointer
+	void transformMultiSsse3(uint32_t state[5][MaxLanes], const uint8_t* const data[MaxLanes], size_t blocks);
+	void transformMultiAvx2(uint32_t state[5][MaxLanes], const uint8_t* const data[MaxLanes], size_t blocks);
+}
+
+#endif
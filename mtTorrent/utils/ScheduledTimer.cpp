@@ -1,8 +1,7 @@
 #include "ScheduledTimer.h"
 
-ScheduledTimer::ScheduledTimer(asio::io_service& io, std::function<void()> callback) : func(callback)
+ScheduledTimer::ScheduledTimer(asio::io_service& service, std::function<void()> callback) : func(callback), io(service)
 {
-	timer = std::make_unique<asio::steady_timer>(io);
 }
 
 ScheduledTimer::~ScheduledTimer()
@@ -15,10 +14,7 @@ void ScheduledTimer::schedule(uint32_t secondsOffset)
 	std::lock_guard<std::mutex> guard(mtx);
 
 	if (timer)
-	{
-		timer->expires_from_now(std::chrono::seconds(secondsOffset));
-		timer->async_wait(std::bind(&ScheduledTimer::checkTimer, shared_from_this(), std::placeholders::_1));
-	}
+		timer->expireAfter(secondsOffset * 1000);
 }
 
 void ScheduledTimer::disable()
@@ -27,8 +23,7 @@ void ScheduledTimer::disable()
 
 	if (timer)
 	{
-		std::error_code ec;
-		timer->cancel(ec);
+		timer->cancel();
 		timer.reset();
 	}
 
@@ -37,29 +32,22 @@ void ScheduledTimer::disable()
 
 uint32_t ScheduledTimer::getSecondsTillNextUpdate()
 {
+	std::lock_guard<std::mutex> guard(mtx);
+
 	if (!timer)
 		return 0;
 	else
-	{
-		auto now = std::chrono::steady_clock::now();
-		auto expTime = timer->expires_at();
-
-		if (expTime < now)
-			return 0;
-		else
-
-			return std::chrono::duration_cast<std::chrono::duration<uint32_t>>(expTime - now).count();
-	}
+		return timer->remaining() / 1000;
 }
 
-void ScheduledTimer::checkTimer(const asio::error_code& error)
+void ScheduledTimer::checkTimer()
 {
 	std::function<void()> runFunc;
 
 	{
 		std::lock_guard<std::mutex> guard(mtx);
 
-		if (!error && timer)
+		if (timer)
 		{
 			runFunc = func;
 		}
@@ -71,5 +59,14 @@ void ScheduledTimer::checkTimer(const asio::error_code& error)
 
 std::shared_ptr<ScheduledTimer> ScheduledTimer::create(asio::io_service& io, std::function<void()> callback)
 {
-	return std::make_shared<ScheduledTimer>(io, callback);
+	auto t = std::make_shared<ScheduledTimer>(io, callback);
+
+	//expired wheel timer only posts check to io of owner
+	t->timer = TimerWheel::session().create([weak = std::weak_ptr<ScheduledTimer>(t)]()
+		{
+			if (auto ptr = weak.lock())
+				ptr->io.post(std::bind(&ScheduledTimer::checkTimer, ptr));
+		});
+
+	return t;
 }
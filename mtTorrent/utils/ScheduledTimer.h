@@ -1,7 +1,9 @@
 #pragma once
 #include <asio.hpp>
 #include <functional>
+#include "TimerWheel.h"
 
+//callback posted to io after scheduled seconds, time is kept by session timer wheel
 struct ScheduledTimer : public std::enable_shared_from_this<ScheduledTimer>
 {
 	static std::shared_ptr<ScheduledTimer> create(asio::io_service& io, std::function<void()> callback);
@@ -15,8 +17,9 @@ struct ScheduledTimer : public std::enable_shared_from_this<ScheduledTimer>
 
 private:
 
-	void checkTimer(const asio::error_code& error);
+	void checkTimer();
 	std::function<void()> func;
-	std::unique_ptr<asio::steady_timer> timer;
+	asio::io_service& io;
+	std::shared_ptr<TimerWheel::Timer> timer;
 	std::mutex mtx;
-};
\ No newline at end of file
+};
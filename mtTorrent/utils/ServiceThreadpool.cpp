@@ -1,5 +1,18 @@
 #include "ServiceThreadpool.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+//posted work waiting longer needs another worker
+const int64_t BusyWaitUs = 2000;
+//workers are not needed when posted work waits shorter
+const int64_t IdleWaitUs = 200;
+//consecutive idle measures before worker is removed
+const uint32_t IdleProbesToRetire = 10;
+
 ServiceThreadpool::ServiceThreadpool()
 {
 	start(1);
@@ -13,22 +26,31 @@ ServiceThreadpool::ServiceThreadpool(uint32_t startWorkers)
 
 ServiceThreadpool::~ServiceThreadpool()
 {
+	stopAdjusting();
 	stop();
 }
 
+ServiceThreadpool& ServiceThreadpool::session()
+{
+	static ServiceThreadpool service(1);
+	return service;
+}
+
 void ServiceThreadpool::start(uint32_t startWorkers, bool finishAfterWork)
 {
 	if(!finishAfterWork && !work)
 		work = std::make_shared<asio::io_service::work>(io);
 
+	std::lock_guard<std::mutex> guard(workersMutex);
+
 	if (workers >= startWorkers)
 		return;
 
 	startWorkers = std::min(startWorkers, (uint32_t)_countof(myThreads));
 
-	for (size_t i = workers; i < startWorkers; i++)
+	for (uint32_t i = workers; i < startWorkers; i++)
 	{
-		myThreads[i] = std::thread([this]() { io.run(); });
+		startWorker(i);
 	}
 
 	workers = std::max(startWorkers, workers);
@@ -36,23 +58,190 @@ void ServiceThreadpool::start(uint32_t startWorkers, bool finishAfterWork)
 
 void ServiceThreadpool::stop()
 {
+	{
+		std::lock_guard<std::mutex> guard(workersMutex);
+		workers = 0;
+		probePending = false;
+	}
+
 	if (work)
 		work = nullptr;
 
 	io.stop();
 
-	for (size_t i = 0; i < workers; i++)
+	for (auto& worker : myThreads)
 	{
-		myThreads[i].join();
+		if (worker.thread.joinable())
+			worker.thread.join();
 	}
 
 	io.reset();
+}
+
+void ServiceThreadpool::setWorkersLimits(uint32_t minCount, uint32_t maxCount)
+{
+	std::lock_guard<std::mutex> guard(workersMutex);
+	maxWorkers = std::min(maxCount, (uint32_t)_countof(myThreads));
+	minWorkers = std::min(std::max(minCount, 1u), maxWorkers);
+
+	if (!adjusting)
+	{
+		adjusting = true;
+		adjustThread = std::thread([this]()
+			{
+				std::unique_lock<std::mutex> lock(workersMutex);
 
-	workers = 0;
+				while (adjusting)
+				{
+					adjustSignal.wait_for(lock, std::chrono::seconds(1));
+
+					if (adjusting)
+					{
+						lock.unlock();
+						adjust();
+						lock.lock();
+					}
+				}
+			});
+	}
 }
 
-void ServiceThreadpool::adjust(uint32_t estimatedWork)
+void ServiceThreadpool::stopAdjusting()
 {
-	uint32_t workers = ((uint32_t)(estimatedWork*0.26f)) + 2;
-	start(workers);
+	{
+		std::lock_guard<std::mutex> guard(workersMutex);
+		adjusting = false;
+	}
+
+	adjustSignal.notify_all();
+
+	if (adjustThread.joinable())
+		adjustThread.join();
+}
+
+void ServiceThreadpool::adjust()
+{
+	std::lock_guard<std::mutex> guard(workersMutex);
+
+	//stopped
+	if (workers == 0)
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+
+	//last posted work still waits, all workers are busy
+	if (probePending)
+	{
+		if (std::chrono::duration_cast<std::chrono::microseconds>(now - probePosted).count() > BusyWaitUs && workers < maxWorkers)
+		{
+			idleProbes = 0;
+			startWorker(workers++);
+		}
+
+		return;
+	}
+
+	if (probeWait > BusyWaitUs && workers < maxWorkers)
+	{
+		idleProbes = 0;
+		startWorker(workers++);
+	}
+	else if (probeWait < IdleWaitUs && workers > minWorkers)
+	{
+		if (++idleProbes >= IdleProbesToRetire)
+		{
+			idleProbes = 0;
+			myThreads[--workers].retire = true;
+
+			//retired worker exits after next handler it runs
+			io.post([]() {});
+		}
+	}
+	else
+		idleProbes = 0;
+
+	probePending = true;
+	probePosted = now;
+
+	io.post([this, now]()
+		{
+			std::lock_guard<std::mutex> guard(workersMutex);
+			probeWait = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
+			probePending = false;
+		});
+}
+
+void ServiceThreadpool::setCpuPinning(bool enabled)
+{
+	std::lock_guard<std::mutex> guard(workersMutex);
+
+	cpuPinning = enabled;
+
+	if (cpuPinning)
+	{
+		for (uint32_t i = 0; i < workers; i++)
+			pinWorker(i);
+	}
+}
+
+void ServiceThreadpool::startWorker(uint32_t idx)
+{
+	auto& worker = myThreads[idx];
+
+	//retiring worker didnt exit yet
+	if (worker.running)
+	{
+		worker.retire = false;
+		return;
+	}
+
+	if (worker.thread.joinable())
+		worker.thread.join();
+
+	worker.retire = false;
+	worker.running = true;
+	worker.thread = std::thread([this, idx]() { runWorker(idx); });
+
+	if (cpuPinning)
+		pinWorker(idx);
+}
+
+void ServiceThreadpool::runWorker(uint32_t idx)
+{
+	auto& worker = myThreads[idx];
+
+	for (;;)
+	{
+		if (worker.retire)
+		{
+			std::lock_guard<std::mutex> guard(workersMutex);
+
+			if (worker.retire)
+			{
+				worker.running = false;
+				return;
+			}
+		}
+
+		//stopped or out of work
+		if (!io.run_one())
+			break;
+	}
+
+	std::lock_guard<std::mutex> guard(workersMutex);
+	worker.running = false;
+}
+
+void ServiceThreadpool::pinWorker(uint32_t idx)
+{
+	auto core = idx % std::max(1u, std::thread::hardware_concurrency());
+
+#ifdef _WIN32
+	SetThreadAffinityMask(myThreads[idx].thread.native_handle(), (DWORD_PTR)1 << core);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(myThreads[idx].thread.native_handle(), sizeof(set), &set);
+#endif
 }
@@ -3,6 +3,9 @@
 #include <asio.hpp>
 #include <memory>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 class ServiceThreadpool
 {
@@ -17,12 +20,48 @@ public:
 	void start(uint32_t startWorkers, bool finishAfterWork = false);
 	void stop();
 
-	void adjust(uint32_t estimatedWork);
+	//workers are adjusted every second by load within limits
+	void setWorkersLimits(uint32_t minWorkers, uint32_t maxWorkers);
+	//add worker when posted work waits too long, remove one after being idle for a while
+	void adjust();
+
+	//each worker bound to its own cpu core
+	void setCpuPinning(bool enabled);
+
+	//session wide pool running io of torrents and network services, grows with load within limits
+	static ServiceThreadpool& session();
 
 private:
 
 	std::shared_ptr<asio::io_service::work> work;
 
-	std::thread myThreads[20];
+	struct Worker
+	{
+		std::thread thread;
+		//exits after current handler, confirmed with workersMutex
+		std::atomic<bool> retire{ false };
+		bool running = false;
+	};
+	Worker myThreads[64];
 	uint32_t workers = 0;
-};
\ No newline at end of file
+	std::mutex workersMutex;
+
+	void startWorker(uint32_t idx);
+	void runWorker(uint32_t idx);
+	void pinWorker(uint32_t idx);
+	bool cpuPinning = false;
+
+	uint32_t minWorkers = 1;
+	uint32_t maxWorkers = 0;
+	//measures load also when all workers are busy
+	std::thread adjustThread;
+	std::condition_variable adjustSignal;
+	bool adjusting = false;
+	void stopAdjusting();
+
+	//time posted work waited for worker, guarded by workersMutex
+	std::chrono::steady_clock::time_point probePosted;
+	int64_t probeWait = 0;
+	bool probePending = false;
+	uint32_t idleProbes = 0;
+};
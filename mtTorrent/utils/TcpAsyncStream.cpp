@@ -3,7 +3,12 @@
 
 #define TCP_LOG(x) WRITE_LOG(LogTypeTcp, getHostname() << " " << x)
 
-TcpAsyncStream::TcpAsyncStream(asio::io_service& io) : io_service(io), socket(io), timeoutTimer(io)
+//partial message at buffer end is moved to its start, larger buffer moves it less often per received byte
+const size_t ReceiveBufferSize = 128 * 1024;
+const size_t MinReceiveSpace = 8 * 1024;
+const size_t MaxKeptSendBufferSize = 256 * 1024;
+
+TcpAsyncStream::TcpAsyncStream(asio::io_service& io) : io_service(io), socket(io)
 {
 }
 
@@ -38,8 +43,7 @@ void TcpAsyncStream::connect(const uint8_t* ip, uint16_t port, bool ipv6)
 	info.host = info.endpoint.address().to_string();
 	info.port = port;
 
-	timeoutTimer.expires_from_now(std::chrono::seconds(10));
-	timeoutTimer.async_wait(std::bind(&TcpAsyncStream::checkTimeout, shared_from_this(), std::placeholders::_1));
+	setTimeout(10);
 
 	connectEndpoint();
 }
@@ -75,21 +79,24 @@ void TcpAsyncStream::close(bool immediate)
 
 void TcpAsyncStream::write(const DataBuffer& data)
 {
-	io_service.post(std::bind(&TcpAsyncStream::do_write, shared_from_this(), data));
+	std::lock_guard<std::mutex> guard(write_mutex);
+
+	pendingWrite.add(data.data(), data.size());
+	scheduleWrite();
 }
 
-DataBuffer TcpAsyncStream::getReceivedData()
+BufferView TcpAsyncStream::getReceivedData()
 {
 	std::lock_guard<std::mutex> guard(receiveBuffer_mutex);
 
-	return receiveBuffer;
+	return BufferView(receiveBuffer.data() + receiveStart, receiveEnd - receiveStart);
 }
 
 void TcpAsyncStream::consumeData(size_t size)
 {
 	std::lock_guard<std::mutex> guard(receiveBuffer_mutex);
 
-	receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + size);
+	receiveStart = std::min(receiveStart + size, receiveEnd);
 }
 
 uint16_t TcpAsyncStream::getPort()
@@ -107,11 +114,28 @@ tcp::endpoint& TcpAsyncStream::getEndpoint()
 	return info.endpoint;
 }
 
+void TcpAsyncStream::setCallbackStrand(std::shared_ptr<asio::io_service::strand> strand)
+{
+	std::lock_guard<std::mutex> guard(strandMutex);
+	callbackStrand = std::move(strand);
+}
+
+std::shared_ptr<asio::io_service::strand> TcpAsyncStream::getCallbackStrand()
+{
+	std::lock_guard<std::mutex> guard(strandMutex);
+	return callbackStrand;
+}
+
 size_t TcpAsyncStream::getReceivedDataCount()
 {
 	return receivedCounter;
 }
 
+size_t TcpAsyncStream::getReceiveCopiedCount()
+{
+	return receiveCopiedCounter;
+}
+
 void TcpAsyncStream::connectByHostname()
 {
 	state = Connecting;
@@ -135,18 +159,36 @@ void TcpAsyncStream::setAsConnected()
 {
 	TCP_LOG("connected");
 
-	state = Connected;
 	info.endpoint = socket.remote_endpoint();
 	info.endpointInitialized = true;
 
-	socket.async_receive(asio::buffer(recv_buffer), std::bind(&TcpAsyncStream::handle_receive, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+	connectionEstablished();
+}
+
+void TcpAsyncStream::connectionEstablished()
+{
+	state = Connected;
+
+	startReceive();
 
 	{
-		std::lock_guard<std::mutex> guard(callbackMutex);
+		std::lock_guard<std::mutex> guard(write_mutex);
 
-		if (onConnectCallback)
-			onConnectCallback();
+		//data written while connecting
+		if (!writing && (!pendingWrite.out.empty() || !pendingPayloads.empty()))
+		{
+			writing = true;
+			startWrite();
+		}
 	}
+
+	runCallback([this, self = shared_from_this()]()
+		{
+			std::lock_guard<std::mutex> guard(callbackMutex);
+
+			if (onConnectCallback)
+				onConnectCallback();
+		});
 }
 
 void TcpAsyncStream::postFail(std::string place, const std::error_code& error)
@@ -169,18 +211,20 @@ void TcpAsyncStream::postFail(std::string place, const std::error_code& error)
 		TCP_LOG("end on " << place);
 
 	state = Disconnected;
-	timeoutTimer.cancel();
+	if (timeoutTimer)
+		timeoutTimer->cancel();
 
-	{
-		std::lock_guard<std::mutex> guard(callbackMutex);
+	runCallback([this, self = shared_from_this(), code = error.value()]()
+		{
+			std::lock_guard<std::mutex> guard(callbackMutex);
 
-		if (onCloseCallback)
-			onCloseCallback(error.value());
+			if (onCloseCallback)
+				onCloseCallback(code);
 
-		onConnectCallback = nullptr;
-		onCloseCallback = nullptr;
-		onReceiveCallback = nullptr;
-	}
+			onConnectCallback = nullptr;
+			onCloseCallback = nullptr;
+			onReceiveCallback = nullptr;
+		});
 }
 
 void TcpAsyncStream::handle_resolve(const std::error_code& error, tcp::resolver::iterator iterator, std::shared_ptr<tcp::resolver> resolver)
@@ -233,26 +277,30 @@ void TcpAsyncStream::do_close()
 	postFail("Close", std::error_code());
 }
 
-void TcpAsyncStream::do_write(DataBuffer data)
+void TcpAsyncStream::scheduleWrite()
 {
-	std::lock_guard<std::mutex> guard(write_msgs_mutex);
+	//messages added before posted write runs are sent with it
+	if (!writing)
+	{
+		writing = true;
+		io_service.post(std::bind(&TcpAsyncStream::do_write, shared_from_this()));
+	}
+}
 
-	write_msgs.push_back(data);
+void TcpAsyncStream::do_write()
+{
+	std::lock_guard<std::mutex> guard(write_mutex);
 
 	if (state == Connected)
 	{
-		TCP_LOG("writing " << data.size() << " bytes");
+		startWrite();
+		return;
+	}
 
-		bool write_in_progress = write_msgs.size() > 1;
+	//sent after connection
+	writing = false;
 
-		if (!write_in_progress)
-		{
-			asio::async_write(socket,
-				asio::buffer(write_msgs.front().data(), write_msgs.front().size()),
-				std::bind(&TcpAsyncStream::handle_write, shared_from_this(), std::placeholders::_1));
-		}
-	}
-	else if (state != Connecting)
+	if (state != Connecting)
 	{
 		if (info.endpointInitialized)
 		{
@@ -265,23 +313,62 @@ void TcpAsyncStream::do_write(DataBuffer data)
 	}
 }
 
+void TcpAsyncStream::startWrite()
+{
+	if (pendingWrite.out.empty() && pendingPayloads.empty())
+	{
+		writing = false;
+		return;
+	}
+
+	sendBuffer.swap(pendingWrite.out);
+	pendingWrite.out.clear();
+	sendPayloads.swap(pendingPayloads);
+	pendingPayloads.clear();
+
+	sendBuffers.clear();
+	size_t position = 0;
+	for (auto& p : sendPayloads)
+	{
+		if (p.offset > position)
+			sendBuffers.push_back(asio::buffer(sendBuffer.data() + position, p.offset - position));
+
+		sendBuffers.push_back(asio::buffer(p.data.data(), p.data.size()));
+		position = p.offset;
+	}
+	if (position < sendBuffer.size())
+		sendBuffers.push_back(asio::buffer(sendBuffer.data() + position, sendBuffer.size() - position));
+
+	TCP_LOG("writing " << asio::buffer_size(sendBuffers) << " bytes");
+
+	asio::async_write(socket,
+		sendBuffers,
+		std::bind(&TcpAsyncStream::handle_write, shared_from_this(), std::placeholders::_1));
+}
+
 void TcpAsyncStream::handle_write(const std::error_code& error)
 {
 	if (!error)
 	{
-		std::lock_guard<std::mutex> guard(write_msgs_mutex);
+		std::lock_guard<std::mutex> guard(write_mutex);
 
-		write_msgs.pop_front();
+		if (sendBuffer.capacity() > MaxKeptSendBufferSize)
+			DataBuffer().swap(sendBuffer);
+		else
+			sendBuffer.clear();
 
-		if (!write_msgs.empty())
-		{
-			asio::async_write(socket,
-				asio::buffer(write_msgs.front().data(), write_msgs.front().size()),
-				std::bind(&TcpAsyncStream::handle_write, shared_from_this(), std::placeholders::_1));
-		}
+		sendPayloads.clear();
+
+		startWrite();
 	}
 	else
 	{
+		{
+			std::lock_guard<std::mutex> guard(write_mutex);
+			sendPayloads.clear();
+			writing = false;
+		}
+
 		postFail("Write", error);
 	}
 }
@@ -292,20 +379,13 @@ void TcpAsyncStream::handle_receive(const std::error_code& error, std::size_t by
 
 	if (!error)
 	{
-		appendData(recv_buffer.data(), bytes_transferred);
-
-		timeoutTimer.expires_from_now(std::chrono::seconds(60));
-		timeoutTimer.async_wait(std::bind(&TcpAsyncStream::checkTimeout, shared_from_this(), std::placeholders::_1));
+		runCallback([this, self = shared_from_this(), bytes_transferred]()
+			{
+				onDataReceived(bytes_transferred);
 
-		socket.async_receive(asio::buffer(recv_buffer),
-			std::bind(&TcpAsyncStream::handle_receive, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
-
-		{
-			std::lock_guard<std::mutex> guard(callbackMutex);
-
-			if (onReceiveCallback)
-				onReceiveCallback();
-		}
+				//next read starts after received data were parsed, buffer may move only now
+				startReceive();
+			});
 	}
 	else
 	{
@@ -313,17 +393,88 @@ void TcpAsyncStream::handle_receive(const std::error_code& error, std::size_t by
 	}
 }
 
-void TcpAsyncStream::appendData(char* data, size_t size)
+void TcpAsyncStream::onDataReceived(size_t size)
+{
+	addReceivedData(size);
+	notifyReceived();
+}
+
+void TcpAsyncStream::addReceivedData(size_t size)
+{
+	{
+		std::lock_guard<std::mutex> guard(receiveBuffer_mutex);
+		receiveEnd += size;
+		receivedCounter += size;
+	}
+
+	setTimeout(60);
+}
+
+void TcpAsyncStream::notifyReceived()
+{
+	std::lock_guard<std::mutex> guard(callbackMutex);
+
+	if (onReceiveCallback)
+		onReceiveCallback();
+}
+
+uint8_t* TcpAsyncStream::prepareReceiveSpace(size_t minSize, size_t& spaceSize)
 {
 	std::lock_guard<std::mutex> guard(receiveBuffer_mutex);
 
-	receivedCounter += size;
-	receiveBuffer.insert(receiveBuffer.end(), data, data + size);
+	if (receiveStart == receiveEnd)
+	{
+		receiveStart = receiveEnd = 0;
+	}
+	else if (receiveBuffer.size() - receiveEnd < minSize && receiveStart > 0)
+	{
+		memmove(receiveBuffer.data(), receiveBuffer.data() + receiveStart, receiveEnd - receiveStart);
+		receiveCopiedCounter += receiveEnd - receiveStart;
+		receiveEnd -= receiveStart;
+		receiveStart = 0;
+	}
+
+	if (receiveBuffer.size() - receiveEnd < minSize)
+	{
+		auto newSize = std::max(receiveBuffer.size() * 2, std::max(ReceiveBufferSize, receiveEnd + minSize));
+
+		//growing moves whole buffer
+		if (newSize > receiveBuffer.capacity())
+			receiveCopiedCounter += receiveBuffer.size();
+
+		receiveBuffer.resize(newSize);
+	}
+
+	spaceSize = receiveBuffer.size() - receiveEnd;
+	return receiveBuffer.data() + receiveEnd;
+}
+
+void TcpAsyncStream::startReceive()
+{
+	size_t targetSize;
+	uint8_t* target = prepareReceiveSpace(MinReceiveSpace, targetSize);
+
+	socket.async_receive(asio::buffer(target, targetSize),
+		std::bind(&TcpAsyncStream::handle_receive, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+}
+
+void TcpAsyncStream::setTimeout(uint32_t seconds)
+{
+	if (!timeoutTimer)
+	{
+		timeoutTimer = TimerWheel::session().create([weak = std::weak_ptr<TcpAsyncStream>(shared_from_this())]()
+			{
+				if (auto stream = weak.lock())
+					stream->checkTimeout();
+			});
+	}
+
+	timeoutTimer->expireAfter(seconds * 1000);
 }
 
-void TcpAsyncStream::checkTimeout(const asio::error_code& error)
+void TcpAsyncStream::checkTimeout()
 {
-	if (state == Disconnected || error)
+	if (state == Disconnected)
 		return;
 
 	postFail("timeout", std::error_code());
@@ -1,12 +1,13 @@
 #pragma once
 
 #include "utils\Network.h"
+#include "utils\PacketHelper.h"
+#include "utils\TimerWheel.h"
 #include <mutex>
 #include <future>
 #include <memory>
 #include <array>
 #include <functional>
-#include <deque>
 
 class TcpAsyncServer;
 
@@ -17,7 +18,7 @@ class TcpAsyncStream : public std::enable_shared_from_this<TcpAsyncStream>
 public:
 
 	TcpAsyncStream(asio::io_service& io_service);
-	~TcpAsyncStream();
+	virtual ~TcpAsyncStream();
 
 	void init(const std::string& hostname, const std::string& port);
 
@@ -29,9 +30,33 @@ public:
 
 	void write(const DataBuffer& data);
 
-	DataBuffer getReceivedData();
+	//serialize message directly into pending send data, pending messages are sent together with one write
+	template<typename F>
+	void writeMessage(F serialize)
+	{
+		std::lock_guard<std::mutex> guard(write_mutex);
+		serialize(pendingWrite);
+		scheduleWrite();
+	}
+
+	//serialized message followed by payload sent directly from its memory, which is kept alive by payloadOwner until written
+	template<typename F>
+	void writeMessage(F serialize, const BufferView& payload, std::shared_ptr<void> payloadOwner)
+	{
+		std::lock_guard<std::mutex> guard(write_mutex);
+		serialize(pendingWrite);
+		pendingPayloads.push_back({ pendingWrite.out.size(), payload, std::move(payloadOwner) });
+		scheduleWrite();
+	}
+
+	//view of received and not consumed data, valid until next receive, use from onReceiveCallback
+	BufferView getReceivedData();
 	void consumeData(size_t size);
 
+	//callbacks and parsing of received data run serialized on strand of owner, otherwise directly on io threads
+	//can be set while stream is already receiving
+	void setCallbackStrand(std::shared_ptr<asio::io_service::strand>);
+
 	std::mutex callbackMutex;
 	std::function<void()> onConnectCallback;
 	std::function<void()> onReceiveCallback;
@@ -42,38 +67,86 @@ public:
 	tcp::endpoint& getEndpoint();
 
 	size_t getReceivedDataCount();
+	//bytes copied again after being received, when unconsumed data are moved in receive buffer
+	size_t getReceiveCopiedCount();
 
 protected:
 
-	void connectByHostname();
-	void connectEndpoint();
+	virtual void connectByHostname();
+	virtual void connectEndpoint();
 	void setAsConnected();
+	//common part of established connection, flushes data written while connecting
+	void connectionEstablished();
 
-	void postFail(std::string place, const std::error_code& error);
+	virtual void postFail(std::string place, const std::error_code& error);
+
+	std::shared_ptr<asio::io_service::strand> callbackStrand;
+	std::mutex strandMutex;
+	std::shared_ptr<asio::io_service::strand> getCallbackStrand();
+	//f runs on callback strand when set
+	template<typename F>
+	void runCallback(F f)
+	{
+		if (auto strand = getCallbackStrand())
+			strand->dispatch(std::move(f));
+		else
+			f();
+	}
 
 	enum { Disconnected, Connecting, Connected } state = Disconnected;
 	void handle_resolve(const std::error_code& error, tcp::resolver::iterator iterator, std::shared_ptr<tcp::resolver> resolver);
 	void handle_resolver_connect(const std::error_code& err, tcp::resolver::iterator endpoint_iterator, std::shared_ptr<tcp::resolver> resolver);
 	void handle_connect(const std::error_code& err);
-	void do_close();
+	virtual void do_close();
 
-	void do_write(DataBuffer data);
-	std::mutex write_msgs_mutex;
-	std::deque<DataBuffer> write_msgs;
+	void scheduleWrite();
+	void do_write();
+	virtual void startWrite();
 	void handle_write(const std::error_code& error);
+	std::mutex write_mutex;
+	//messages added since last write started
+	PacketBuilder pendingWrite;
+	//data of write in progress, swapped with pending data to keep allocations
+	DataBuffer sendBuffer;
 
-	std::array<char, 10*1024> recv_buffer;
+	struct Payload
+	{
+		//position in written data
+		size_t offset;
+		BufferView data;
+		std::shared_ptr<void> owner;
+	};
+	std::vector<Payload> pendingPayloads;
+	std::vector<Payload> sendPayloads;
+	//gather list of send data and payloads
+	std::vector<asio::const_buffer> sendBuffers;
+	//write posted or in progress
+	bool writing = false;
+
+	virtual void startReceive();
 	void handle_receive(const std::error_code& error, std::size_t bytes_transferred);
-	void appendData(char* data, size_t size);
+	//free space of at least minSize after unconsumed data, may move them
+	uint8_t* prepareReceiveSpace(size_t minSize, size_t& spaceSize);
+	//bytes written into prepared space, notifies receive callback
+	void onDataReceived(size_t size);
+	//bytes written into prepared space are made available without callback
+	void addReceivedData(size_t size);
+	void notifyReceived();
 	std::mutex receiveBuffer_mutex;
+	//unconsumed data are between receiveStart and receiveEnd, socket reads directly after them
 	DataBuffer receiveBuffer;
+	size_t receiveStart = 0;
+	size_t receiveEnd = 0;
 	size_t receivedCounter = 0;
+	size_t receiveCopiedCounter = 0;
 
 	std::mutex socket_mutex;
 	tcp::socket socket;
 
-	void checkTimeout(const asio::error_code& error);
-	asio::steady_timer  timeoutTimer;
+	//restarting running timeout is just stored by timer wheel
+	void setTimeout(uint32_t seconds);
+	void checkTimeout();
+	std::shared_ptr<TimerWheel::Timer> timeoutTimer;
 
 	asio::io_service& io_service;
 
@@ -87,5 +160,4 @@ protected:
 	info;
 
 	int32_t timeout = 15;
-	bool writing = false;
 };
@@ -0,0 +1,196 @@
+#include "TimerWheel.h"
+#include "ServiceThreadpool.h"
+
+TimerWheel::TimerWheel(asio::io_service& io) : tickTimer(io)
+{
+	startTime = std::chrono::steady_clock::now();
+	sweptTick = currentTick();
+
+	scheduleTick();
+}
+
+TimerWheel::~TimerWheel()
+{
+	std::lock_guard<std::mutex> guard(mtx);
+	asio::error_code ec;
+	tickTimer.cancel(ec);
+}
+
+TimerWheel& TimerWheel::session()
+{
+	static TimerWheel wheel(ServiceThreadpool::session().io);
+	return wheel;
+}
+
+std::shared_ptr<TimerWheel::Timer> TimerWheel::create(std::function<void()> callback)
+{
+	return std::make_shared<Timer>(*this, callback);
+}
+
+uint64_t TimerWheel::currentTick()
+{
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+
+	//0 is not scheduled
+	return 1 + elapsed / TickMs;
+}
+
+uint64_t TimerWheel::deadlineAfter(uint32_t ms)
+{
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+
+	//first tick starting after requested time
+	return 1 + (elapsed + ms + TickMs - 1) / TickMs;
+}
+
+void TimerWheel::insert(const std::shared_ptr<Timer>& timer, uint64_t deadline)
+{
+	std::lock_guard<std::mutex> guard(mtx);
+
+	//visited ticks wont be visited again, unless cancelled meanwhile
+	if (deadline <= sweptTick)
+	{
+		if (!timer->deadline.compare_exchange_strong(deadline, sweptTick + 1))
+			return;
+
+		deadline = sweptTick + 1;
+	}
+
+	//already placed by sweep
+	auto slot = timer->slotTick.load();
+	if (slot && slot <= deadline)
+		return;
+
+	place(timer, deadline);
+}
+
+void TimerWheel::place(const std::shared_ptr<Timer>& timer, uint64_t deadline)
+{
+	if (deadline - sweptTick < NearSlots)
+	{
+		timer->slotTick = deadline;
+		nearSlots[deadline % NearSlots].push_back(timer);
+	}
+	else
+	{
+		//far deadlines beyond far wheel are placed in its last slot and moved again after
+		auto revolution = std::min(deadline >> NearBits, (sweptTick >> NearBits) + FarSlots - 1);
+
+		timer->slotTick = revolution << NearBits;
+		farSlots[revolution % FarSlots].push_back(timer);
+	}
+}
+
+void TimerWheel::visit(std::vector<std::shared_ptr<Timer>>& slot)
+{
+	visiting.clear();
+	visiting.swap(slot);
+
+	for (auto& timer : visiting)
+	{
+		//copy left by earlier rescheduling
+		if (timer->slotTick != sweptTick)
+			continue;
+
+		timer->slotTick = 0;
+
+		for (;;)
+		{
+			uint64_t deadline = timer->deadline;
+
+			//cancelled
+			if (deadline == 0)
+				break;
+
+			if (deadline > sweptTick)
+			{
+				place(timer, deadline);
+				break;
+			}
+
+			//fails when rescheduled meanwhile
+			if (timer->deadline.compare_exchange_strong(deadline, 0))
+			{
+				expired.push_back(timer);
+				break;
+			}
+		}
+	}
+
+	visiting.clear();
+}
+
+void TimerWheel::scheduleTick()
+{
+	//start of tick following swept one
+	tickTimer.expires_at(startTime + std::chrono::milliseconds(sweptTick * TickMs));
+	tickTimer.async_wait(std::bind(&TimerWheel::onTick, this, std::placeholders::_1));
+}
+
+void TimerWheel::onTick(const asio::error_code& error)
+{
+	if (error)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(mtx);
+
+		auto now = currentTick();
+
+		while (sweptTick < now)
+		{
+			sweptTick++;
+
+			if (sweptTick % NearSlots == 0)
+				visit(farSlots[(sweptTick >> NearBits) % FarSlots]);
+
+			visit(nearSlots[sweptTick % NearSlots]);
+		}
+	}
+
+	for (auto& timer : expired)
+	{
+		if (timer->callback)
+			timer->callback();
+	}
+	expired.clear();
+
+	std::lock_guard<std::mutex> guard(mtx);
+	scheduleTick();
+}
+
+TimerWheel::Timer::Timer(TimerWheel& w, std::function<void()> cb) : wheel(w), callback(cb)
+{
+}
+
+void TimerWheel::Timer::expireAfter(uint32_t ms)
+{
+	auto newDeadline = wheel.deadlineAfter(ms);
+	deadline = newDeadline;
+
+	//rearming to later time, usual for timeouts
+	auto slot = slotTick.load();
+	if (slot && slot <= newDeadline)
+		return;
+
+	wheel.insert(shared_from_this(), newDeadline);
+}
+
+void TimerWheel::Timer::cancel()
+{
+	//left in slot until visited
+	deadline = 0;
+}
+
+uint32_t TimerWheel::Timer::remaining()
+{
+	uint64_t expiration = deadline;
+
+	if (expiration == 0)
+		return 0;
+
+	auto elapsed = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - wheel.startTime).count();
+	auto expirationMs = (expiration - 1) * TickMs;
+
+	return expirationMs > elapsed ? (uint32_t)(expirationMs - elapsed) : 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <asio.hpp>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//coarse timers sorted into slots by deadline and expired in batches every tick
+//near slots cover single ticks, far slots cover whole near wheel revolutions and are cascaded into near slots
+class TimerWheel
+{
+public:
+
+	TimerWheel(asio::io_service& io);
+	~TimerWheel();
+
+	//shared wheel ticking on session service
+	static TimerWheel& session();
+
+	static const uint32_t TickMs = 100;
+
+	class Timer : public std::enable_shared_from_this<Timer>
+	{
+		friend class TimerWheel;
+
+	public:
+
+		Timer(TimerWheel& wheel, std::function<void()> callback);
+
+		//later deadline than already scheduled one is only stored, wheel moves timer when reaching its slot
+		void expireAfter(uint32_t ms);
+		void cancel();
+		//milliseconds till expiration, 0 if not scheduled
+		uint32_t remaining();
+
+	private:
+
+		TimerWheel& wheel;
+		std::function<void()> callback;
+
+		//tick of expiration, 0 if not scheduled
+		std::atomic<uint64_t> deadline{ 0 };
+		//tick when wheel visits slot holding timer, 0 if not in wheel. Copies left in other slots are ignored
+		std::atomic<uint64_t> slotTick{ 0 };
+	};
+
+	//callback runs on wheel io thread
+	std::shared_ptr<Timer> create(std::function<void()> callback);
+
+private:
+
+	uint64_t currentTick();
+	uint64_t deadlineAfter(uint32_t ms);
+
+	void insert(const std::shared_ptr<Timer>& timer, uint64_t deadline);
+	void place(const std::shared_ptr<Timer>& timer, uint64_t deadline);
+	void visit(std::vector<std::shared_ptr<Timer>>& slot);
+
+	void scheduleTick();
+	void onTick(const asio::error_code& error);
+
+	static const uint32_t NearBits = 8;
+	static const uint32_t NearSlots = 1 << NearBits;
+	static const uint32_t FarSlots = 256;
+
+	std::vector<std::shared_ptr<Timer>> nearSlots[NearSlots];
+	std::vector<std::shared_ptr<Timer>> farSlots[FarSlots];
+	//swapped with visited slot to keep allocations
+	std::vector<std::shared_ptr<Timer>> visiting;
+	//callbacks run after sweep without lock
+	std::vector<std::shared_ptr<Timer>> expired;
+
+	//all ticks up to this were visited
+	uint64_t sweptTick;
+	std::mutex mtx;
+
+	std::chrono::steady_clock::time_point startTime;
+	asio::steady_timer tickTimer;
+};
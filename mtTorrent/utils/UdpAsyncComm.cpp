@@ -10,9 +10,8 @@ std::shared_ptr<UdpAsyncComm> UdpAsyncComm::Get()
 {
 	if (!ptr)
 	{
-		ptr = std::make_shared<UdpAsyncComm>();
+		ptr = std::make_shared<UdpAsyncComm>(ServiceThreadpool::session());
 		ptr->setBindPort(mtt::config::getExternal().connection.udpPort);
-		ptr->pool.start(4);
 	}
 
 	return ptr;
@@ -25,11 +24,14 @@ void UdpAsyncComm::Deinit()
 		ptr->removeListeners();
 		ptr->listener->stop();
 		ptr->listener.reset();
-		ptr->pool.stop();
 		ptr.reset();
 	}
 }
 
+UdpAsyncComm::UdpAsyncComm(ServiceThreadpool& p) : pool(p)
+{
+}
+
 void UdpAsyncComm::setBindPort(uint16_t port)
 {
 	bindPort = port;
@@ -53,6 +55,24 @@ void UdpAsyncComm::removeListeners()
 	}
 
 	onUnhandledReceive = nullptr;
+	packetFilter = nullptr;
+}
+
+void UdpAsyncComm::setPacketFilter(UdpPacketFilter filter)
+{
+	if (!listener)
+		startListening();
+
+	std::lock_guard<std::mutex> guard(respondingMutex);
+	packetFilter = filter;
+}
+
+void UdpAsyncComm::sendFromListener(const udp::endpoint& endpoint, const uint8_t* data, size_t size)
+{
+	if (!listener)
+		startListening();
+
+	listener->sendTo(endpoint, data, size);
 }
 
 UdpRequest UdpAsyncComm::create(const std::string& host, const std::string& port)
@@ -164,6 +184,9 @@ void UdpAsyncComm::onUdpReceive(udp::endpoint& source, DataBuffer& data)
 
 	std::lock_guard<std::mutex> guard(respondingMutex);
 
+	if (packetFilter && packetFilter(source, data))
+		return;
+
 	{
 		std::lock_guard<std::mutex> guard(responsesMutex);
 
@@ -5,6 +5,8 @@
 #include "ServiceThreadpool.h"
 
 using UdpResponseCallback = std::function<bool(UdpRequest, DataBuffer*)>;
+//returns true if packet was consumed
+using UdpPacketFilter = std::function<bool(udp::endpoint&, DataBuffer&)>;
 
 class UdpAsyncComm;
 using UdpCommPtr = std::shared_ptr<UdpAsyncComm>;
@@ -13,6 +15,9 @@ class UdpAsyncComm
 {
 public:
 
+	UdpAsyncComm(ServiceThreadpool& pool);
+
+	//shared instance running on session service
 	static UdpCommPtr Get();
 	static void Deinit();
 
@@ -21,6 +26,11 @@ public:
 	void listen(UdpPacketCallback received);
 	void removeListeners();
 
+	//packets received on listening port are first offered to filter
+	void setPacketFilter(UdpPacketFilter filter);
+	//send from listening port without expecting response
+	void sendFromListener(const udp::endpoint& endpoint, const uint8_t* data, size_t size);
+
 	UdpRequest create(const std::string& host, const std::string& port);
 	UdpRequest sendMessage(DataBuffer& data, const std::string& host, const std::string& port, UdpResponseCallback response, bool ipv6 = false, uint32_t timeout = 1, bool anySource = false);
 	UdpRequest sendMessage(DataBuffer& data, Addr& addr, UdpResponseCallback response);
@@ -52,10 +62,11 @@ private:
 	void onUdpReceive(udp::endpoint&, DataBuffer&);
 	void onUdpClose(UdpRequest);
 	UdpPacketCallback onUnhandledReceive;
+	UdpPacketFilter packetFilter;
 
 	void startListening();
 	std::shared_ptr<UdpAsyncReceiver> listener;
 	uint16_t bindPort = 0;
 
-	ServiceThreadpool pool;
+	ServiceThreadpool& pool;
 };
@@ -26,6 +26,16 @@ void UdpAsyncReceiver::stop()
 	socket_.cancel();
 }
 
+bool UdpAsyncReceiver::sendTo(const udp::endpoint& endpoint, const uint8_t* data, size_t size)
+{
+	std::lock_guard<std::mutex> guard(sendMutex);
+
+	std::error_code ec;
+	socket_.send_to(asio::buffer(data, size), endpoint, 0, ec);
+
+	return !ec;
+}
+
 void UdpAsyncReceiver::handle_receive(const std::error_code& error, std::size_t bytes_transferred)
 {
 	if (!active)
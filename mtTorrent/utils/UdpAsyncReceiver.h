@@ -1,3 +1,5 @@
+#pragma once
+
 #include "UdpAsyncWriter.h"
 
 using UdpPacketCallback = std::function<void(udp::endpoint&, DataBuffer&)>;
@@ -11,6 +13,9 @@ public:
 	void listen();
 	void stop();
 
+	//send from listening socket, replies come back to its port
+	bool sendTo(const udp::endpoint& endpoint, const uint8_t* data, size_t size);
+
 	UdpPacketCallback receiveCallback;
 
 private:
@@ -18,6 +23,7 @@ private:
 	void handle_receive(const std::error_code& error, std::size_t bytes_transferred);
 
 	bool active = false;
+	std::mutex sendMutex;
 	udp::socket socket_;
 	udp::endpoint remote_endpoint_;
 
@@ -0,0 +1,253 @@
+#include "UtpManager.h"
+#include "UdpAsyncComm.h"
+#include "Logging.h"
+
+#define UTP_LOG(x) WRITE_LOG(LogTypeUtp, x)
+
+const uint32_t TimeoutCheckInterval = 100;
+
+UtpManager::UtpManager(ServiceThreadpool& p) : pool(p)
+{
+}
+
+UtpManager::~UtpManager()
+{
+	stop();
+}
+
+UtpManager& UtpManager::Get()
+{
+	static UtpManager manager(ServiceThreadpool::session());
+	return manager;
+}
+
+void UtpManager::setTransport(SendFunction send)
+{
+	std::lock_guard<std::mutex> guard(sendMutex);
+	sendFunction = send;
+	ownTransport = true;
+}
+
+void UtpManager::listen(asio::io_service& io_service, std::function<void(std::shared_ptr<UtpStream>)> accepted)
+{
+	start();
+
+	std::lock_guard<std::mutex> guard(listenMutex);
+	acceptService = &io_service;
+	onAccepted = accepted;
+}
+
+void UtpManager::stopListening()
+{
+	std::lock_guard<std::mutex> guard(listenMutex);
+	acceptService = nullptr;
+	onAccepted = nullptr;
+}
+
+void UtpManager::stop()
+{
+	stopListening();
+
+	if (!started)
+		return;
+
+	std::vector<std::shared_ptr<UtpStream>> streams;
+	{
+		std::lock_guard<std::mutex> guard(connectionsMutex);
+
+		for (auto& c : connections)
+			if (auto s = c.second.lock())
+				streams.push_back(s);
+
+		connections.clear();
+	}
+
+	//closing streams would wait for acknowledgements which are not received anymore
+	for (auto& s : streams)
+		s->abort();
+
+	{
+		std::lock_guard<std::mutex> guard(sendMutex);
+
+		//check running on other service thread wont schedule again
+		if (timer)
+			timer->cancel();
+		timer.reset();
+
+		if (!ownTransport)
+		{
+			UdpAsyncComm::Get()->setPacketFilter(nullptr);
+			sendFunction = nullptr;
+		}
+	}
+
+	started = false;
+}
+
+void UtpManager::start()
+{
+	std::lock_guard<std::mutex> guard(sendMutex);
+
+	if (started)
+		return;
+
+	started = true;
+
+	if (!ownTransport)
+	{
+		auto udp = UdpAsyncComm::Get();
+		udp->setPacketFilter(std::bind(&UtpManager::onUdpPacket, this, std::placeholders::_1, std::placeholders::_2));
+		sendFunction = [udp](const udp::endpoint& endpoint, const uint8_t* data, size_t size)
+		{
+			udp->sendFromListener(endpoint, data, size);
+		};
+	}
+
+	timer = std::make_shared<asio::steady_timer>(pool.io);
+	timer->expires_from_now(std::chrono::milliseconds(TimeoutCheckInterval));
+	timer->async_wait(std::bind(&UtpManager::checkTimeouts, this, std::placeholders::_1));
+}
+
+bool UtpManager::onUdpPacket(udp::endpoint& source, DataBuffer& data)
+{
+	utp::Header header;
+	if (!header.parse(data.data(), data.size()))
+		return false;
+
+	std::shared_ptr<UtpStream> stream;
+	{
+		std::lock_guard<std::mutex> guard(connectionsMutex);
+
+		//syn carries id of initiator, accepted connection receives on id + 1
+		uint16_t id = header.type == utp::Syn ? uint16_t(header.connectionId + 1) : header.connectionId;
+		auto it = connections.find({ source, id });
+
+		//reset carries id of packet it responds to, which is receive id of other side +- 1
+		if (it == connections.end() && header.type == utp::Reset)
+		{
+			it = connections.find({ source, uint16_t(id - 1) });
+			if (it == connections.end())
+				it = connections.find({ source, uint16_t(id + 1) });
+		}
+
+		if (it != connections.end())
+			stream = it->second.lock();
+	}
+
+	if (stream)
+	{
+		stream->onPacket(header, data.data() + header.size, data.size() - header.size);
+		return true;
+	}
+
+	if (header.type == utp::Syn)
+	{
+		std::lock_guard<std::mutex> guard(listenMutex);
+
+		if (onAccepted)
+		{
+			UTP_LOG(source.address().to_string() << " incoming connection");
+
+			stream = std::make_shared<UtpStream>(*acceptService, *this);
+			{
+				std::lock_guard<std::mutex> guard(connectionsMutex);
+				connections[{ source, uint16_t(header.connectionId + 1) }] = stream;
+			}
+
+			stream->accept(source, header);
+			onAccepted(stream);
+
+			return true;
+		}
+	}
+
+	//unknown connection, let sender know
+	if (header.type == utp::Data || header.type == utp::Fin || header.type == utp::Syn)
+	{
+		uint8_t reset[utp::HeaderSize] = {};
+		reset[0] = (utp::Reset << 4) | utp::Version;
+		*reinterpret_cast<uint16_t*>(reset + 2) = swap16(header.connectionId);
+		*reinterpret_cast<uint16_t*>(reset + 16) = swap16((uint16_t)rand());
+		*reinterpret_cast<uint16_t*>(reset + 18) = swap16(header.seq);
+
+		send(source, reset, sizeof(reset));
+	}
+
+	return true;
+}
+
+size_t UtpManager::getConnectionsCount()
+{
+	std::lock_guard<std::mutex> guard(connectionsMutex);
+	return connections.size();
+}
+
+uint16_t UtpManager::addConnection(std::shared_ptr<UtpStream> stream, const udp::endpoint& endpoint)
+{
+	start();
+
+	std::lock_guard<std::mutex> guard(connectionsMutex);
+
+	uint16_t id;
+	do
+	{
+		id = (uint16_t)rand();
+	}
+	while (connections.find({ endpoint, id }) != connections.end());
+
+	connections[{ endpoint, id }] = stream;
+
+	return id;
+}
+
+void UtpManager::removeConnection(const udp::endpoint& endpoint, uint16_t receiveId)
+{
+	std::lock_guard<std::mutex> guard(connectionsMutex);
+	connections.erase({ endpoint, receiveId });
+}
+
+void UtpManager::send(const udp::endpoint& endpoint, const uint8_t* data, size_t size)
+{
+	SendFunction f;
+	{
+		std::lock_guard<std::mutex> guard(sendMutex);
+		f = sendFunction;
+	}
+
+	if (f)
+		f(endpoint, data, size);
+}
+
+void UtpManager::checkTimeouts(const asio::error_code& error)
+{
+	if (error)
+		return;
+
+	std::vector<std::shared_ptr<UtpStream>> streams;
+	{
+		std::lock_guard<std::mutex> guard(connectionsMutex);
+
+		for (auto it = connections.begin(); it != connections.end();)
+		{
+			if (auto s = it->second.lock())
+			{
+				streams.push_back(s);
+				it++;
+			}
+			else
+				it = connections.erase(it);
+		}
+	}
+
+	auto now = utp::currentTime();
+	for (auto& s : streams)
+		s->checkTimeouts(now);
+
+	std::lock_guard<std::mutex> guard(sendMutex);
+
+	if (!timer)
+		return;
+
+	timer->expires_from_now(std::chrono::milliseconds(TimeoutCheckInterval));
+	timer->async_wait(std::bind(&UtpManager::checkTimeouts, this, std::placeholders::_1));
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "UtpStream.h"
+#include "ServiceThreadpool.h"
+
+//uTP connections multiplexed over one udp port, by default listening port of UdpAsyncComm
+class UtpManager
+{
+	friend class UtpStream;
+
+public:
+
+	UtpManager(ServiceThreadpool& pool);
+	~UtpManager();
+
+	//shared manager running on session service
+	static UtpManager& Get();
+
+	using SendFunction = std::function<void(const udp::endpoint&, const uint8_t*, size_t)>;
+	//send packets using own transport, received packets are then passed with onUdpPacket
+	void setTransport(SendFunction send);
+
+	//accept incoming connections, created streams run on io_service
+	void listen(asio::io_service& io_service, std::function<void(std::shared_ptr<UtpStream>)> onAccepted);
+	void stopListening();
+
+	//close all connections
+	void stop();
+
+	//returns false if packet is not uTP
+	bool onUdpPacket(udp::endpoint& source, DataBuffer& data);
+
+	size_t getConnectionsCount();
+
+private:
+
+	void start();
+
+	//returns unique receive connection id
+	uint16_t addConnection(std::shared_ptr<UtpStream> stream, const udp::endpoint& endpoint);
+	void removeConnection(const udp::endpoint& endpoint, uint16_t receiveId);
+	void send(const udp::endpoint& endpoint, const uint8_t* data, size_t size);
+
+	void checkTimeouts(const asio::error_code& error);
+	std::shared_ptr<asio::steady_timer> timer;
+
+	std::mutex connectionsMutex;
+	std::map<std::pair<udp::endpoint, uint16_t>, std::weak_ptr<UtpStream>> connections;
+
+	std::mutex listenMutex;
+	asio::io_service* acceptService = nullptr;
+	std::function<void(std::shared_ptr<UtpStream>)> onAccepted;
+
+	std::mutex sendMutex;
+	SendFunction sendFunction;
+	bool ownTransport = false;
+
+	bool started = false;
+	ServiceThreadpool& pool;
+};
@@ -0,0 +1,828 @@
+#include "UtpStream.h"
+#include "UtpManager.h"
+#include "Logging.h"
+#include <chrono>
+
+#define UTP_LOG(x) WRITE_LOG(LogTypeUtp, getHostname() << " " << x)
+
+//payload small enough to not fragment with ipv6 and tunnels
+const uint32_t MaxPayloadSize = 1200;
+const uint32_t MinWindow = 2 * MaxPayloadSize;
+const uint32_t MaxWindow = 1024 * 1024;
+const uint32_t MaxReceiveWindow = 1024 * 1024;
+//packets sent and not acknowledged, keeps sequence numbers far from wrapping
+const size_t MaxOutPackets = 1000;
+const uint16_t MaxReorderDistance = 1000;
+
+//LEDBAT target queuing delay in microseconds
+const uint32_t TargetDelay = 100000;
+//window increase per rtt when there is no queuing delay
+const double MaxWindowIncreasePerRtt = 3000;
+
+const uint32_t MinRto = 500;
+const uint32_t MaxRto = 60000;
+const uint32_t MaxSynTransmissions = 3;
+const uint32_t MaxTransmissions = 6;
+const uint32_t DuplicateAcksResend = 3;
+
+static bool seqBefore(uint16_t a, uint16_t b)
+{
+	return (int16_t)(a - b) < 0;
+}
+
+static bool delayBefore(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+uint64_t utp::currentTime()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool utp::Header::parse(const uint8_t* data, size_t dataSize)
+{
+	if (dataSize < HeaderSize)
+		return false;
+
+	if ((data[0] & 0x0F) != Version || (data[0] >> 4) > Syn)
+		return false;
+
+	PacketReader reader(data, dataSize);
+	type = (Type)(reader.pop() >> 4);
+	extension = reader.pop();
+	connectionId = reader.pop16();
+	timestamp = reader.pop32();
+	timestampDiff = reader.pop32();
+	windowSize = reader.pop32();
+	seq = reader.pop16();
+	ack = reader.pop16();
+
+	size = HeaderSize;
+
+	//skip extensions, selective ack is not used
+	auto nextExtension = extension;
+	while (nextExtension)
+	{
+		if (dataSize < size + 2)
+			return false;
+
+		nextExtension = data[size];
+		size += 2 + data[size + 1];
+
+		if (dataSize < size)
+			return false;
+	}
+
+	return true;
+}
+
+UtpStream::UtpStream(asio::io_service& io, UtpManager& m) : TcpAsyncStream(io), manager(m)
+{
+	congestionWindow = MinWindow;
+	slowStartThreshold = MaxWindow;
+	peerWindow = MaxPayloadSize;
+}
+
+UtpStream::~UtpStream()
+{
+}
+
+UtpStream::Info UtpStream::getInfo()
+{
+	std::lock_guard<std::mutex> guard(utpMutex);
+
+	Info i;
+	i.congestionWindow = (uint32_t)congestionWindow;
+	i.peerWindow = peerWindow;
+	i.bytesInFlight = bytesInFlight;
+	i.rtt = rtt;
+	i.queuingDelay = queuingDelay;
+	i.retransmissions = retransmissions;
+
+	return i;
+}
+
+udp::endpoint UtpStream::getUdpEndpoint()
+{
+	return remote;
+}
+
+void UtpStream::connectByHostname()
+{
+	state = Connecting;
+
+	udp::resolver::query query(info.host, std::to_string(info.port));
+
+	auto resolver = std::make_shared<udp::resolver>(io_service);
+	resolver->async_resolve(query, std::bind(&UtpStream::handle_udp_resolve, std::static_pointer_cast<UtpStream>(shared_from_this()), std::placeholders::_1, std::placeholders::_2, resolver));
+}
+
+void UtpStream::handle_udp_resolve(const std::error_code& error, udp::resolver::iterator iterator, std::shared_ptr<udp::resolver> resolver)
+{
+	if (!error)
+	{
+		udp::endpoint endpoint = *iterator;
+		info.endpoint = tcp::endpoint(endpoint.address(), endpoint.port());
+		info.endpointInitialized = true;
+
+		connectEndpoint();
+	}
+	else
+	{
+		postFail("Resolve", error);
+	}
+}
+
+void UtpStream::connectEndpoint()
+{
+	UTP_LOG("connecting");
+
+	state = Connecting;
+
+	std::lock_guard<std::mutex> guard(utpMutex);
+
+	remote = udp::endpoint(info.endpoint.address(), info.endpoint.port());
+	receiveId = manager.addConnection(std::static_pointer_cast<UtpStream>(shared_from_this()), remote);
+	sendId = receiveId + 1;
+	seqNr = 1;
+
+	OutPacket syn;
+	syn.data.resize(utp::HeaderSize);
+	syn.seq = seqNr++;
+	syn.payloadSize = 0;
+	//syn is only packet sent with receive id
+	writeHeader(syn.data.data(), utp::Syn, receiveId, syn.seq, 0);
+	outPackets.push_back(std::move(syn));
+
+	auto now = utp::currentTime();
+	retransmitTimerStart = now;
+	transmit(outPackets.back(), now);
+}
+
+void UtpStream::accept(const udp::endpoint& source, const utp::Header& syn)
+{
+	{
+		std::lock_guard<std::mutex> guard(utpMutex);
+
+		remote = source;
+		receiveId = syn.connectionId + 1;
+		sendId = syn.connectionId;
+		seqNr = (uint16_t)rand();
+		ackNr = syn.seq;
+		peerWindow = syn.windowSize;
+		established = true;
+
+		info.endpoint = tcp::endpoint(source.address(), source.port());
+		info.endpointInitialized = true;
+		info.host = info.endpoint.address().to_string();
+		info.port = source.port();
+
+		sendPacket(utp::State, seqNr);
+	}
+
+	UTP_LOG("accepted");
+
+	connectionEstablished();
+}
+
+void UtpStream::postFail(std::string place, const std::error_code& error)
+{
+	if (state == Disconnected)
+		return;
+
+	manager.removeConnection(remote, receiveId);
+
+	std::shared_ptr<UtpStream> self;
+	{
+		std::lock_guard<std::mutex> guard(utpMutex);
+		self.swap(closingSelf);
+	}
+
+	TcpAsyncStream::postFail(place, error);
+}
+
+void UtpStream::do_close()
+{
+	if (state == Disconnected)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(utpMutex);
+
+		//same as closed tcp socket, queued data are delivered before fin, all retransmitted when lost
+		if (established && state == Connected && !failing)
+		{
+			closing = true;
+			closingSelf = std::static_pointer_cast<UtpStream>(shared_from_this());
+			sendPackets(utp::currentTime());
+			return;
+		}
+	}
+
+	postFail("Close", std::error_code());
+}
+
+void UtpStream::abort()
+{
+	if (state == Disconnected)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(utpMutex);
+
+		if (established)
+			sendPacket(utp::Reset, seqNr);
+	}
+
+	postFail("Close", asio::error::make_error_code(asio::error::connection_aborted));
+}
+
+void UtpStream::startWrite()
+{
+	//called with write_mutex, data are moved to send buffer and packetized later with utpMutex
+	writing = false;
+
+	if (pendingWrite.out.empty() && pendingPayloads.empty())
+		return;
+
+	size_t position = 0;
+	for (auto& p : pendingPayloads)
+	{
+		sendBuffer.insert(sendBuffer.end(), pendingWrite.out.begin() + position, pendingWrite.out.begin() + p.offset);
+		sendBuffer.insert(sendBuffer.end(), p.data.data(), p.data.data() + p.data.size());
+		position = p.offset;
+	}
+	sendBuffer.insert(sendBuffer.end(), pendingWrite.out.begin() + position, pendingWrite.out.end());
+
+	pendingWrite.out.clear();
+	pendingPayloads.clear();
+
+	io_service.post(std::bind(&UtpStream::flush, std::static_pointer_cast<UtpStream>(shared_from_this())));
+}
+
+void UtpStream::startReceive()
+{
+}
+
+void UtpStream::flush()
+{
+	std::lock_guard<std::mutex> guard(utpMutex);
+
+	if (state == Connected)
+		sendPackets(utp::currentTime());
+}
+
+void UtpStream::onPacket(const utp::Header& header, const uint8_t* payload, size_t payloadSize)
+{
+	if (state == Disconnected)
+		return;
+
+	Events e;
+	{
+		std::lock_guard<std::mutex> guard(utpMutex);
+
+		if (!failing)
+			handlePacket(header, payload, payloadSize);
+
+		std::swap(e, events);
+	}
+
+	runEvents(e);
+}
+
+void UtpStream::runEvents(Events& e)
+{
+	if (e.connected)
+	{
+		UTP_LOG("connected");
+		connectionEstablished();
+	}
+
+	if (e.received)
+		notifyReceived();
+
+	if (e.failed)
+		postFail(e.failPlace, e.failError);
+}
+
+void UtpStream::fail(std::string place, const std::error_code& error)
+{
+	if (failing)
+		return;
+
+	failing = true;
+	events.failed = true;
+	events.failPlace = std::move(place);
+	events.failError = error;
+}
+
+void UtpStream::handlePacket(const utp::Header& header, const uint8_t* payload, size_t payloadSize)
+{
+	if (header.type == utp::Reset)
+	{
+		fail("Receive", asio::error::make_error_code(asio::error::connection_reset));
+		return;
+	}
+
+	auto now = utp::currentTime();
+
+	if (header.timestamp)
+		replyMicro = (uint32_t)now - header.timestamp;
+
+	peerWindow = header.windowSize;
+
+	if (header.type == utp::Syn)
+	{
+		//our state response was lost
+		sendPacket(utp::State, seqNr);
+		return;
+	}
+
+	if (!established)
+	{
+		if (header.type != utp::State)
+			return;
+
+		//first data of accepting side continue from sequence of its state
+		ackNr = header.seq - 1;
+		established = true;
+		events.connected = true;
+	}
+
+	handleAck(header, now);
+
+	if (failing)
+		return;
+
+	if (header.type == utp::Data || header.type == utp::Fin)
+	{
+		handleData(header, payload, payloadSize);
+
+		if (failing)
+			return;
+	}
+
+	sendPackets(now);
+}
+
+void UtpStream::handleAck(const utp::Header& header, uint64_t now)
+{
+	uint32_t ackedBytes = 0;
+	uint32_t ackedPackets = 0;
+	uint64_t sample = 0;
+
+	while (!outPackets.empty() && !seqBefore(header.ack, outPackets.front().seq))
+	{
+		auto& packet = outPackets.front();
+
+		if (!packet.needResend)
+			bytesInFlight -= packet.payloadSize;
+		ackedBytes += packet.payloadSize;
+
+		//retransmitted packets are ambiguous
+		sample = packet.transmissions == 1 ? now - packet.sentTime : 0;
+
+		outPackets.pop_front();
+		ackedPackets++;
+	}
+
+	//ack covering more packets could wait for repaired loss
+	if (ackedPackets == 1 && sample)
+		updateRtt(sample);
+
+	//last sent packet is fin
+	if (finSent && outPackets.empty())
+	{
+		fail("Close", std::error_code());
+		return;
+	}
+
+	if (ackedPackets)
+	{
+		duplicateAcks = 0;
+		retransmitTimerStart = now;
+
+		if (ackedBytes && header.timestampDiff)
+			updateCongestionWindow(ackedBytes, header.timestampDiff, now);
+
+		if (fastRecovery)
+		{
+			//partial ack, next packet of same window was lost too
+			if (seqBefore(header.ack, recoverySeq) && !outPackets.empty())
+				resendFirst();
+			else
+				fastRecovery = false;
+		}
+	}
+	else if (header.type == utp::State && header.ack == lastAck && !outPackets.empty() && !fastRecovery)
+	{
+		if (++duplicateAcks == DuplicateAcksResend)
+		{
+			UTP_LOG("fast resend " << outPackets.front().seq);
+
+			resendFirst();
+
+			fastRecovery = true;
+			recoverySeq = seqNr - 1;
+
+			congestionWindow = std::max(congestionWindow / 2, (double)MinWindow);
+			slowStartThreshold = congestionWindow;
+			slowStart = false;
+		}
+	}
+
+	lastAck = header.ack;
+}
+
+void UtpStream::resendFirst()
+{
+	auto& lost = outPackets.front();
+
+	if (!lost.needResend)
+	{
+		lost.needResend = true;
+		bytesInFlight -= lost.payloadSize;
+	}
+}
+
+void UtpStream::handleData(const utp::Header& header, const uint8_t* payload, size_t payloadSize)
+{
+	uint16_t distance = header.seq - ackNr;
+
+	if (distance == 0 || distance > MaxReorderDistance)
+	{
+		//duplicate, acknowledge again
+		sendPacket(utp::State, seqNr);
+		return;
+	}
+
+	if (header.type == utp::Fin)
+	{
+		finReceived = true;
+		finSeq = header.seq;
+	}
+
+	if (distance > 1)
+	{
+		if (header.type == utp::Data && reorderBuffer.find(header.seq) == reorderBuffer.end())
+		{
+			reorderBuffer[header.seq] = DataBuffer(payload, payload + payloadSize);
+			reorderBufferSize += payloadSize;
+		}
+
+		sendPacket(utp::State, seqNr);
+		return;
+	}
+
+	//in order data with following buffered packets are delivered together
+	std::vector<BufferView> delivered;
+	size_t deliveredSize = 0;
+
+	if (header.type == utp::Data)
+	{
+		delivered.emplace_back(payload, payloadSize);
+		deliveredSize += payloadSize;
+	}
+	ackNr = header.seq;
+
+	auto it = reorderBuffer.begin();
+	while (!(finReceived && ackNr == finSeq) && (it = reorderBuffer.find(uint16_t(ackNr + 1))) != reorderBuffer.end())
+	{
+		delivered.emplace_back(it->second);
+		deliveredSize += it->second.size();
+		ackNr++;
+	}
+
+	if (finReceived && uint16_t(ackNr + 1) == finSeq)
+		ackNr = finSeq;
+
+	sendPacket(utp::State, seqNr);
+
+	if (deliveredSize)
+	{
+		auto strand = getCallbackStrand();
+
+		uint8_t* target;
+		if (strand)
+		{
+			strandReceived.resize(strandReceived.size() + deliveredSize);
+			target = strandReceived.data() + strandReceived.size() - deliveredSize;
+		}
+		else
+		{
+			size_t space;
+			target = prepareReceiveSpace(deliveredSize, space);
+		}
+
+		for (auto& d : delivered)
+		{
+			memcpy(target, d.data(), d.size());
+			target += d.size();
+		}
+
+		for (uint16_t seq = header.seq + 1; seq != uint16_t(ackNr + 1); seq++)
+		{
+			auto found = reorderBuffer.find(seq);
+			if (found != reorderBuffer.end())
+			{
+				reorderBufferSize -= found->second.size();
+				reorderBuffer.erase(found);
+			}
+		}
+
+		if (!strand)
+		{
+			addReceivedData(deliveredSize);
+			events.received = true;
+		}
+		else if (!strandReceivePosted)
+		{
+			strandReceivePosted = true;
+			strand->post(std::bind(&UtpStream::receiveOnStrand, std::static_pointer_cast<UtpStream>(shared_from_this())));
+		}
+	}
+
+	if (finReceived && ackNr == finSeq)
+		fail("Receive", asio::error::make_error_code(asio::error::eof));
+}
+
+void UtpStream::receiveOnStrand()
+{
+	DataBuffer data;
+	{
+		std::lock_guard<std::mutex> guard(utpMutex);
+		data.swap(strandReceived);
+		strandReceivePosted = false;
+	}
+
+	if (data.empty())
+		return;
+
+	size_t space;
+	auto target = prepareReceiveSpace(data.size(), space);
+	memcpy(target, data.data(), data.size());
+
+	{
+		std::lock_guard<std::mutex> guard(receiveBuffer_mutex);
+		receiveCopiedCounter += data.size();
+	}
+
+	onDataReceived(data.size());
+}
+
+void UtpStream::updateCongestionWindow(uint32_t ackedBytes, uint32_t delaySample, uint64_t now)
+{
+	if (baseDelaysCount == 0 || now - baseDelayMinuteStart > 60 * 1000000ull)
+	{
+		if (baseDelaysCount == BaseDelayHistory)
+			memmove(baseDelays, baseDelays + 1, sizeof(uint32_t) * (BaseDelayHistory - 1));
+		else
+			baseDelaysCount++;
+
+		baseDelays[baseDelaysCount - 1] = delaySample;
+		baseDelayMinuteStart = now;
+	}
+	else if (delayBefore(delaySample, baseDelays[baseDelaysCount - 1]))
+		baseDelays[baseDelaysCount - 1] = delaySample;
+
+	uint32_t baseDelay = baseDelays[0];
+	for (size_t i = 1; i < baseDelaysCount; i++)
+		if (delayBefore(baseDelays[i], baseDelay))
+			baseDelay = baseDelays[i];
+
+	//delay includes clock offset of both sides, which is removed with base delay
+	queuingDelay = delaySample - baseDelay;
+
+	double offTarget = ((double)TargetDelay - (double)queuingDelay) / TargetDelay;
+	offTarget = std::max(-1.0, std::min(1.0, offTarget));
+
+	if (slowStart && queuingDelay > TargetDelay / 2)
+	{
+		//window doubled since queue started to build up, drop the overshoot
+		slowStart = false;
+		congestionWindow /= 2;
+	}
+
+	if (slowStart)
+	{
+		congestionWindow += ackedBytes;
+
+		if (congestionWindow >= slowStartThreshold)
+			slowStart = false;
+	}
+	else
+		congestionWindow += MaxWindowIncreasePerRtt * offTarget * ackedBytes / congestionWindow;
+
+	congestionWindow = std::max((double)MinWindow, std::min((double)MaxWindow, congestionWindow));
+}
+
+void UtpStream::updateRtt(uint64_t sample)
+{
+	uint32_t sampleMs = (uint32_t)(sample / 1000);
+
+	if (rtt == 0)
+	{
+		rtt = sampleMs;
+		rttVariance = sampleMs / 2;
+	}
+	else
+	{
+		int32_t delta = (int32_t)rtt - (int32_t)sampleMs;
+		rttVariance += (std::abs(delta) - (int32_t)rttVariance) / 4;
+		rtt = (rtt * 7 + sampleMs) / 8;
+	}
+
+	rto = std::max(rtt + rttVariance * 4, MinRto);
+}
+
+void UtpStream::checkTimeouts(uint64_t now)
+{
+	if (state == Disconnected)
+		return;
+
+	Events e;
+	{
+		std::lock_guard<std::mutex> guard(utpMutex);
+
+		if (!failing)
+			resendTimedOut(now);
+
+		std::swap(e, events);
+	}
+
+	runEvents(e);
+}
+
+void UtpStream::resendTimedOut(uint64_t now)
+{
+	if (outPackets.empty() || now - retransmitTimerStart < rto * 1000ull)
+		return;
+
+	auto& oldest = outPackets.front();
+	if (oldest.transmissions >= (established ? MaxTransmissions : MaxSynTransmissions))
+	{
+		fail(established ? "Timeout" : "Connect", asio::error::make_error_code(asio::error::timed_out));
+		return;
+	}
+
+	UTP_LOG("timeout, resending from " << oldest.seq);
+
+	//everything in flight is considered lost
+	for (auto& p : outPackets)
+		p.needResend = true;
+	bytesInFlight = 0;
+	fastRecovery = false;
+
+	slowStartThreshold = std::max(congestionWindow / 2, (double)MinWindow);
+	congestionWindow = MinWindow;
+	slowStart = true;
+
+	rto = std::min(rto * 2, MaxRto);
+	retransmitTimerStart = now;
+
+	sendPackets(now);
+}
+
+uint32_t UtpStream::getReceiveWindow()
+{
+	//everything received and not consumed yet, slow reader closes the window
+	size_t buffered = reorderBufferSize + strandReceived.size();
+	{
+		std::lock_guard<std::mutex> guard(receiveBuffer_mutex);
+		buffered += receiveEnd - receiveStart;
+	}
+
+	return MaxReceiveWindow - (uint32_t)std::min<size_t>(buffered, MaxReceiveWindow);
+}
+
+void UtpStream::sendPackets(uint64_t now)
+{
+	auto window = std::min((uint32_t)congestionWindow, peerWindow);
+
+	for (auto& p : outPackets)
+	{
+		if (!p.needResend)
+			continue;
+
+		if (p.payloadSize && bytesInFlight + p.payloadSize > window && bytesInFlight > 0)
+			return;
+
+		p.needResend = false;
+		bytesInFlight += p.payloadSize;
+		retransmissions++;
+		transmit(p, now);
+	}
+
+	if (!established || state != Connected)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(write_mutex);
+
+		if (!sendBuffer.empty())
+		{
+			if (unsentOffset == unsent.size())
+			{
+				unsent.swap(sendBuffer);
+				unsentOffset = 0;
+			}
+			else
+				unsent.insert(unsent.end(), sendBuffer.begin(), sendBuffer.end());
+
+			sendBuffer.clear();
+		}
+	}
+
+	while (unsentOffset < unsent.size() && outPackets.size() < MaxOutPackets)
+	{
+		auto size = (uint32_t)std::min<size_t>(unsent.size() - unsentOffset, MaxPayloadSize);
+
+		//one packet can be always in flight, even with smaller window
+		if (bytesInFlight + size > window && bytesInFlight > 0)
+			break;
+
+		OutPacket packet;
+		packet.seq = seqNr++;
+		packet.payloadSize = size;
+		packet.data.resize(utp::HeaderSize + size);
+		writeHeader(packet.data.data(), utp::Data, sendId, packet.seq, 0);
+		memcpy(packet.data.data() + utp::HeaderSize, unsent.data() + unsentOffset, size);
+		unsentOffset += size;
+
+		if (outPackets.empty())
+			retransmitTimerStart = now;
+
+		outPackets.push_back(std::move(packet));
+		bytesInFlight += size;
+		transmit(outPackets.back(), now);
+	}
+
+	if (unsentOffset == unsent.size())
+	{
+		unsent.clear();
+		unsentOffset = 0;
+
+		if (closing && !finSent && outPackets.size() < MaxOutPackets)
+			sendFin(now);
+	}
+}
+
+void UtpStream::sendFin(uint64_t now)
+{
+	{
+		std::lock_guard<std::mutex> guard(write_mutex);
+
+		//data written before close are not in send buffer yet
+		if (writing || !pendingWrite.out.empty() || !pendingPayloads.empty() || !sendBuffer.empty())
+			return;
+	}
+
+	OutPacket fin;
+	fin.data.resize(utp::HeaderSize);
+	fin.seq = seqNr++;
+	fin.payloadSize = 0;
+	writeHeader(fin.data.data(), utp::Fin, sendId, fin.seq, 0);
+
+	if (outPackets.empty())
+		retransmitTimerStart = now;
+
+	outPackets.push_back(std::move(fin));
+	transmit(outPackets.back(), now);
+	finSent = true;
+}
+
+void UtpStream::transmit(OutPacket& packet, uint64_t now)
+{
+	//timestamp and acknowledgement are refreshed with each transmission
+	auto data = packet.data.data();
+	*reinterpret_cast<uint32_t*>(data + 4) = swap32((uint32_t)now);
+	*reinterpret_cast<uint32_t*>(data + 8) = swap32(replyMicro);
+	*reinterpret_cast<uint32_t*>(data + 12) = swap32(getReceiveWindow());
+	*reinterpret_cast<uint16_t*>(data + 18) = swap16(ackNr);
+
+	packet.sentTime = now;
+	packet.transmissions++;
+
+	manager.send(remote, data, packet.data.size());
+}
+
+void UtpStream::sendPacket(utp::Type type, uint16_t seq)
+{
+	uint8_t data[utp::HeaderSize];
+	writeHeader(data, type, sendId, seq, utp::currentTime());
+
+	manager.send(remote, data, sizeof(data));
+}
+
+void UtpStream::writeHeader(uint8_t* out, utp::Type type, uint16_t connectionId, uint16_t seq, uint64_t now)
+{
+	out[0] = (type << 4) | utp::Version;
+	out[1] = 0;
+	*reinterpret_cast<uint16_t*>(out + 2) = swap16(connectionId);
+	*reinterpret_cast<uint32_t*>(out + 4) = swap32((uint32_t)now);
+	*reinterpret_cast<uint32_t*>(out + 8) = swap32(replyMicro);
+	*reinterpret_cast<uint32_t*>(out + 12) = swap32(getReceiveWindow());
+	*reinterpret_cast<uint16_t*>(out + 16) = swap16(seq);
+	*reinterpret_cast<uint16_t*>(out + 18) = swap16(ackNr);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "TcpAsyncStream.h"
+#include <deque>
+#include <map>
+
+class UtpManager;
+
+//uTP (BEP 29) packets
+namespace utp
+{
+	enum Type : uint8_t { Data = 0, Fin, State, Reset, Syn };
+
+	const uint8_t Version = 1;
+	const size_t HeaderSize = 20;
+
+	struct Header
+	{
+		Type type;
+		uint8_t extension;
+		uint16_t connectionId;
+		uint32_t timestamp;
+		uint32_t timestampDiff;
+		uint32_t windowSize;
+		uint16_t seq;
+		uint16_t ack;
+
+		//size including extensions, payload follows
+		size_t size;
+
+		bool parse(const uint8_t* data, size_t dataSize);
+	};
+
+	//microseconds of monotonic clock
+	uint64_t currentTime();
+}
+
+//reliable stream over uTP packets with LEDBAT congestion control, usable in place of tcp stream
+class UtpStream : public TcpAsyncStream
+{
+	friend class UtpManager;
+
+public:
+
+	UtpStream(asio::io_service& io_service, UtpManager& manager);
+	~UtpStream();
+
+	struct Info
+	{
+		uint32_t congestionWindow;
+		uint32_t peerWindow;
+		uint32_t bytesInFlight;
+		//milliseconds
+		uint32_t rtt;
+		//estimated queuing delay of sent packets in microseconds
+		uint32_t queuingDelay;
+		uint32_t retransmissions;
+	};
+	Info getInfo();
+
+	udp::endpoint getUdpEndpoint();
+
+protected:
+
+	void connectByHostname() override;
+	void connectEndpoint() override;
+	void postFail(std::string place, const std::error_code& error) override;
+	//queued data are sent first, stream is closed when following fin is acknowledged
+	void do_close() override;
+	//written data are copied to send queue and sent in packets within window
+	void startWrite() override;
+	//received packets are pushed to receive buffer
+	void startReceive() override;
+
+	void handle_udp_resolve(const std::error_code& error, udp::resolver::iterator iterator, std::shared_ptr<udp::resolver> resolver);
+
+	//called by manager
+	void accept(const udp::endpoint& source, const utp::Header& syn);
+	void onPacket(const utp::Header& header, const uint8_t* payload, size_t payloadSize);
+	void checkTimeouts(uint64_t now);
+
+	void flush();
+	//closes at once with reset, used when manager stops handling packets
+	void abort();
+
+	UtpManager& manager;
+
+	std::mutex utpMutex;
+
+	//stream events found with utpMutex, their callbacks run after it is released and can use stream again
+	struct Events
+	{
+		bool connected = false;
+		bool received = false;
+		bool failed = false;
+		std::string failPlace;
+		std::error_code failError;
+	};
+	Events events;
+	void runEvents(Events& e);
+	//stops handling packets, stream is closed with next events
+	void fail(std::string place, const std::error_code& error);
+	bool failing = false;
+
+	void handlePacket(const utp::Header& header, const uint8_t* payload, size_t payloadSize);
+
+	udp::endpoint remote;
+	uint16_t receiveId = 0;
+	uint16_t sendId = 0;
+	//next sent sequence number
+	uint16_t seqNr = 1;
+	//last received in order sequence number
+	uint16_t ackNr = 0;
+	bool established = false;
+
+	struct OutPacket
+	{
+		DataBuffer data;
+		uint16_t seq;
+		uint32_t payloadSize;
+		uint64_t sentTime = 0;
+		uint32_t transmissions = 0;
+		bool needResend = false;
+	};
+	//sent and not acknowledged, ordered by sequence
+	std::deque<OutPacket> outPackets;
+	//payload bytes sent and not acknowledged or lost
+	uint32_t bytesInFlight = 0;
+	//written data not yet packetized
+	DataBuffer unsent;
+	size_t unsentOffset = 0;
+
+	bool closing = false;
+	bool finSent = false;
+	//keeps closing stream alive until fin is acknowledged or times out
+	std::shared_ptr<UtpStream> closingSelf;
+	void sendFin(uint64_t now);
+
+	void sendPackets(uint64_t now);
+	void transmit(OutPacket& packet, uint64_t now);
+	void sendPacket(utp::Type type, uint16_t seq);
+	void writeHeader(uint8_t* out, utp::Type type, uint16_t connectionId, uint16_t seq, uint64_t now);
+	//free space of receive buffers, advertised to peer
+	uint32_t getReceiveWindow();
+
+	void handleAck(const utp::Header& header, uint64_t now);
+	void resendTimedOut(uint64_t now);
+	void resendFirst();
+	void handleData(const utp::Header& header, const uint8_t* payload, size_t payloadSize);
+	//out of order received payloads by sequence
+	std::map<uint16_t, DataBuffer> reorderBuffer;
+	size_t reorderBufferSize = 0;
+	bool finReceived = false;
+	uint16_t finSeq = 0;
+
+	//in order payload waiting for callback strand, receive buffer is used only there, guarded by utpMutex
+	DataBuffer strandReceived;
+	bool strandReceivePosted = false;
+	void receiveOnStrand();
+
+	//last measured delay of received packet, sent back to peer
+	uint32_t replyMicro = 0;
+
+	//LEDBAT
+	void updateCongestionWindow(uint32_t ackedBytes, uint32_t delaySample, uint64_t now);
+	double congestionWindow;
+	double slowStartThreshold;
+	bool slowStart = true;
+	uint32_t peerWindow;
+	//minimal one way delay of each of last minutes, lowest is taken as base delay without queuing
+	static const size_t BaseDelayHistory = 10;
+	uint32_t baseDelays[BaseDelayHistory];
+	size_t baseDelaysCount = 0;
+	uint64_t baseDelayMinuteStart = 0;
+	uint32_t queuingDelay = 0;
+
+	//retransmission timeout
+	void updateRtt(uint64_t sample);
+	uint32_t rtt = 0;
+	uint32_t rttVariance = 0;
+	uint32_t rto = 1000;
+	uint64_t retransmitTimerStart = 0;
+	uint16_t lastAck = 0;
+	uint32_t duplicateAcks = 0;
+	//resending lost packets of window sent until recoverySeq
+	bool fastRecovery = false;
+	uint16_t recoverySeq = 0;
+	uint32_t retransmissions = 0;
+};